@@ -0,0 +1,136 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include "spq_sigs.hpp"
+
+constexpr unsigned char hashlen=24;
+constexpr unsigned char wotsbits=12;
+constexpr unsigned char merkleheight=3;
+
+typedef std::pair<std::string, std::vector<std::pair<std::string, std::string>>> signature_parts;
+
+double elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Benchmark keygen, signing and (full and cached) verification for a given stack of merkle trees.
+template<uint8_t ...heights>
+void run_benchmark(int signature_count) {
+    typedef spqsigs::spq_signing_key<hashlen, wotsbits, heights...> key_type;
+    typedef spqsigs::multi_signature<hashlen, wotsbits, heights...> signature_type;
+    typedef spqsigs::deserializer<hashlen, wotsbits, heights...> deserializer_type;
+    constexpr size_t levels = sizeof...(heights);
+    std::string msg("This is just a test.");
+    auto start = std::chrono::steady_clock::now();
+    key_type skey;
+    double keygen = elapsed_ms(start);
+    std::vector<signature_parts> signatures;
+    start = std::chrono::steady_clock::now();
+    for (int index=0; index < signature_count; index++) {
+        signatures.push_back(skey.sign_message(msg));
+    }
+    double sign = elapsed_ms(start) / signature_count;
+    deserializer_type deserialize;
+    size_t size = 0;
+    int failed = 0;
+    start = std::chrono::steady_clock::now();
+    for (auto &sig : signatures) {
+        std::string serialized = spqsigs::serialize(sig, skey.public_key());
+        size = serialized.size();
+        auto parts = deserialize(serialized).second;
+        //Nothing known but the root key, every level gets validated.
+        std::vector<std::string> last_known(levels - 1, "");
+        last_known.push_back(skey.public_key());
+        signature_type verifyable(parts, last_known);
+        failed += verifyable.validate(msg) ? 0 : 1;
+    }
+    double verify_full = elapsed_ms(start) / signature_count;
+    start = std::chrono::steady_clock::now();
+    for (auto &sig : signatures) {
+        //All intermediate level keys known, only the message signature gets validated.
+        std::vector<std::string> last_known;
+        for (auto &level : sig.second) {
+            last_known.push_back(level.first);
+        }
+        last_known.push_back(skey.public_key());
+        signature_type verifyable(sig, last_known);
+        failed += verifyable.validate(msg) ? 0 : 1;
+    }
+    double verify_cached = elapsed_ms(start) / signature_count;
+    //The same signatures as a reduced, ordered stream through the verify pipeline on all cores.
+    spqsigs::reducer reducer;
+    std::vector<std::pair<std::string, std::string>> stream;
+    for (auto sig : signatures) {
+        reducer.reduce(sig);
+        stream.emplace_back(spqsigs::serialize(sig, skey.public_key()), msg);
+    }
+    start = std::chrono::steady_clock::now();
+    {
+        spqsigs::verify_pipeline<hashlen, wotsbits, heights...> pipeline(skey.public_key(), std::max(1u, std::thread::hardware_concurrency()));
+        for (bool ok : pipeline.verify(stream)) {
+            failed += ok ? 0 : 1;
+        }
+    }
+    double verify_pipeline = elapsed_ms(start) / signature_count;
+    std::cout << std::setw(6) << levels
+              << std::setw(10) << spqsigs::non_api::determine_signature_index_bits<heights...>()
+              << std::setw(12) << std::fixed << std::setprecision(1) << keygen
+              << std::setw(10) << sign
+              << std::setw(13) << verify_full
+              << std::setw(15) << verify_cached
+              << std::setw(14) << verify_pipeline
+              << std::setw(10) << size
+              << std::setw(8) << failed << std::endl;
+}
+
+// Benchmark verification cost against auth-path size for a single merkle tree of the given arity.
+template<uint8_t arity>
+void run_arity_benchmark() {
+    constexpr uint8_t treeheight = 6;
+    typedef spqsigs::signing_key<hashlen, wotsbits, treeheight, spqsigs::dual_chain, arity> key_type;
+    typedef spqsigs::signature<hashlen, wotsbits, treeheight, spqsigs::dual_chain, arity> signature_type;
+    std::string msg("This is just a test.");
+    spqsigs::non_api::master_key<hashlen> master;
+    auto start = std::chrono::steady_clock::now();
+    key_type skey(spqsigs::non_api::unique_index_generator<hashlen, wotsbits, treeheight>(master, 0));
+    double keygen = elapsed_ms(start);
+    std::vector<std::string> signatures;
+    for (int index=0; index < (1 << treeheight); index++) {
+        signatures.push_back(skey.sign_message(msg));
+    }
+    int failed = 0;
+    start = std::chrono::steady_clock::now();
+    for (auto &sig : signatures) {
+        failed += signature_type(sig).validate(msg) ? 0 : 1;
+    }
+    double verify = elapsed_ms(start) / static_cast<double>(signatures.size());
+    //Node hashes on the auth path and the BLAKE2b compressions (128-byte blocks) they take.
+    constexpr size_t node_hashes = signature_type::depth;
+    constexpr size_t compressions = node_hashes * ((arity * hashlen + 127) / 128);
+    std::cout << std::setw(6) << int(arity)
+              << std::setw(7) << node_hashes
+              << std::setw(14) << compressions
+              << std::setw(12) << signature_type::auth_path_nodes * hashlen
+              << std::setw(9) << signatures[0].size()
+              << std::setw(12) << std::fixed << std::setprecision(1) << keygen
+              << std::setw(12) << std::setprecision(3) << verify
+              << std::setw(8) << failed << std::endl;
+}
+
+int main() {
+    std::cout << "hashlen=" << int(hashlen) << " wotsbits=" << int(wotsbits) << " merkleheight=" << int(merkleheight) << " per level" << std::endl;
+    std::cout << "levels  capacity  keygen(ms)  sign(ms)  verify(ms)  cached(ms)  pipeline(ms)   bytes  failed" << std::endl;
+    constexpr int count = 1 << merkleheight;
+    run_benchmark<merkleheight, merkleheight>(count);
+    run_benchmark<merkleheight, merkleheight, merkleheight>(count);
+    run_benchmark<merkleheight, merkleheight, merkleheight, merkleheight>(count);
+    run_benchmark<merkleheight, merkleheight, merkleheight, merkleheight, merkleheight>(count);
+    run_benchmark<merkleheight, merkleheight, merkleheight, merkleheight, merkleheight, merkleheight>(count);
+    run_benchmark<merkleheight, merkleheight, merkleheight, merkleheight, merkleheight, merkleheight, merkleheight>(count);
+    run_benchmark<merkleheight, merkleheight, merkleheight, merkleheight, merkleheight, merkleheight, merkleheight, merkleheight>(count);
+    std::cout << std::endl << "Single tree of 64 signatures by merkle tree arity" << std::endl;
+    std::cout << " arity  depth  compressions  path-bytes    bytes  keygen(ms)  verify(ms)  failed" << std::endl;
+    run_arity_benchmark<2>();
+    run_arity_benchmark<4>();
+    run_arity_benchmark<8>();
+}
@@ -1,4 +1,5 @@
 #include <iostream>
+#include <cstdio>
 #include "spq_sigs.hpp"
 
 
@@ -46,6 +47,14 @@ constexpr unsigned char merkleheight3=5;
 constexpr unsigned char merkleheight4=6;
 //typedef spqsigs::signing_key<hashlen, wotsbits, merkleheight> signing_key;
 typedef spqsigs::signature<hashlen, wotsbits, merkleheight> verifyable_signature;
+typedef spqsigs::signing_key<hashlen, wotsbits, merkleheight1, spqsigs::checksum_chain> checksum_signing_key;
+typedef spqsigs::signature<hashlen, wotsbits, merkleheight1, spqsigs::checksum_chain> checksum_signature;
+typedef spqsigs::signing_key<hashlen, wotsbits, merkleheight2, spqsigs::dual_chain, 4> quad_signing_key;
+typedef spqsigs::signature<hashlen, wotsbits, merkleheight2, spqsigs::dual_chain, 4> quad_signature;
+typedef spqsigs::mapped_signing_key<hashlen, wotsbits, merkleheight1> mapped_signing_key;
+typedef spqsigs::signature<hashlen, wotsbits, merkleheight1> mapped_signature;
+//Out-of-core keys may grow beyond the 16 levels of an in-memory tree.
+static_assert(spqsigs::mapped_signing_key<hashlen, wotsbits, 20>::leaf_count == (1ull << 20), "Tall mapped signing key");
 
 typedef spqsigs::spq_signing_key<hashlen, wotsbits, merkleheight1, merkleheight2> signing_key_2l;
 typedef spqsigs::multi_signature<hashlen, wotsbits, merkleheight1, merkleheight2> verifyable_signature_2l;
@@ -54,11 +63,65 @@ typedef spqsigs::deserializer<hashlen, wotsbits, merkleheight1, merkleheight2>
 typedef spqsigs::spq_signing_key<hashlen, wotsbits, merkleheight1, merkleheight2, merkleheight3> signing_key_3l;
 typedef spqsigs::multi_signature<hashlen, wotsbits, merkleheight1, merkleheight2, merkleheight3> verifyable_signature_3l;
 typedef spqsigs::deserializer<hashlen, wotsbits, merkleheight1, merkleheight2, merkleheight3>  deserializer_3l;
+//Cheap bottom-level signing below wider, smaller signatures higher up.
+constexpr uint64_t wotsbits_3pl = spqsigs::wotsbits_per_level<wotsbits, 8, 6>();
+typedef spqsigs::spq_signing_key<hashlen, wotsbits_3pl, merkleheight1, merkleheight1, merkleheight1> signing_key_3pl;
+typedef spqsigs::multi_signature<hashlen, wotsbits_3pl, merkleheight1, merkleheight1, merkleheight1> verifyable_signature_3pl;
+typedef spqsigs::deserializer<hashlen, wotsbits_3pl, merkleheight1, merkleheight1, merkleheight1>  deserializer_3pl;
+//Same, with single chains plus checksum at every level.
+constexpr uint64_t wotsbits_3cl = spqsigs::with_ots<spqsigs::checksum_chain>(wotsbits_3pl);
+typedef spqsigs::spq_signing_key<hashlen, wotsbits_3cl, merkleheight1, merkleheight1, merkleheight1> signing_key_3cl;
+typedef spqsigs::multi_signature<hashlen, wotsbits_3cl, merkleheight1, merkleheight1, merkleheight1> verifyable_signature_3cl;
+typedef spqsigs::deserializer<hashlen, wotsbits_3cl, merkleheight1, merkleheight1, merkleheight1>  deserializer_3cl;
+typedef spqsigs::view_deserializer<hashlen, wotsbits_3cl, merkleheight1, merkleheight1, merkleheight1>  view_deserializer_3cl;
+static_assert(view_deserializer_3cl::serialized_length(2) <
+              spqsigs::view_deserializer<hashlen, wotsbits_3pl, merkleheight1, merkleheight1, merkleheight1>::serialized_length(2),
+              "Checksum chain signatures are smaller");
 
 typedef spqsigs::spq_signing_key<hashlen, wotsbits, merkleheight1, merkleheight2, merkleheight3, merkleheight4> signing_key_4l;
 typedef spqsigs::multi_signature<hashlen, wotsbits, merkleheight1, merkleheight2, merkleheight3, merkleheight4> verifyable_signature_4l;
 typedef spqsigs::deserializer<hashlen, wotsbits, merkleheight1, merkleheight2, merkleheight3, merkleheight4>  deserializer_4l;
+typedef spqsigs::push_parser<hashlen, wotsbits, merkleheight1, merkleheight2, merkleheight3, merkleheight4>  push_parser_4l;
 
+typedef spqsigs::spq_signing_key<hashlen, wotsbits, merkleheight1, merkleheight1, merkleheight1, merkleheight1, merkleheight1, merkleheight1, merkleheight1, merkleheight1> signing_key_8l;
+typedef spqsigs::multi_signature<hashlen, wotsbits, merkleheight1, merkleheight1, merkleheight1, merkleheight1, merkleheight1, merkleheight1, merkleheight1, merkleheight1> verifyable_signature_8l;
+typedef spqsigs::deserializer<hashlen, wotsbits, merkleheight1, merkleheight1, merkleheight1, merkleheight1, merkleheight1, merkleheight1, merkleheight1, merkleheight1>  deserializer_8l;
+
+//Sign every signature of a binary dual-chain key and of a 4-ary checksum key, made from the same master key with
+//the given hash backend.
+template<typename backend>
+std::vector<std::string> backend_signatures(const std::string &master, const std::string &msg) {
+    spqsigs::non_api::master_key<hashlen> mkey(master);
+    spqsigs::signing_key<hashlen, wotsbits, merkleheight1, spqsigs::dual_chain, 2, backend> dual_key(spqsigs::non_api::unique_index_generator<hashlen, wotsbits, merkleheight1>(mkey, 0));
+    spqsigs::signing_key<hashlen, wotsbits, merkleheight2, spqsigs::checksum_chain, 4, backend> quad_key(spqsigs::non_api::unique_index_generator<hashlen, wotsbits, merkleheight2>(mkey, 1));
+    std::vector<std::string> rval;
+    while (not dual_key.exhausted()) {
+        rval.push_back(dual_key.sign_message(msg));
+    }
+    while (not quad_key.exhausted()) {
+        rval.push_back(quad_key.sign_message(msg));
+    }
+    return rval;
+}
+
+//Check a hash backend makes bit-identical signatures, and validates the expected ones.
+template<typename backend>
+bool backend_matches(const std::string &master, const std::string &msg, const std::vector<std::string> &expected) {
+    bool ok = backend_signatures<backend>(master, msg) == expected;
+    for (size_t index=0; ok and index < expected.size(); index++) {
+        if (index < (1 << merkleheight1)) {
+            ok = spqsigs::signature<hashlen, wotsbits, merkleheight1, spqsigs::dual_chain, 2, backend>(expected[index]).validate(msg);
+        } else {
+            ok = spqsigs::signature<hashlen, wotsbits, merkleheight2, spqsigs::checksum_chain, 4, backend>(expected[index]).validate(msg);
+        }
+    }
+    spqsigs::non_api::master_key<hashlen, backend> derived(master);
+    spqsigs::non_api::master_key<hashlen, spqsigs::libsodium_backend> reference(master);
+    for (uint64_t index=0; ok and index < 64; index++) {
+        ok = derived[index * 1000003] == reference[index * 1000003];
+    }
+    return ok;
+}
 
 int main() {
     std::cout << "Signing key generated, running signing test." << std::endl;
@@ -68,6 +131,226 @@ int main() {
     int except_count = 0;
     fail_count = 0;
     except_count = 0;
+    std::cout << "Cross-checking fixed-input BLAKE2b against libsodium." << std::endl;
+    for (int ind=0; ind < 8; ind++) {
+        std::string salt = spqsigs::non_api::master_key<hashlen>()[static_cast<uint64_t>(ind)];
+        const unsigned char *key = reinterpret_cast<const unsigned char *>(salt.c_str());
+        uint64_t keyed[8];
+        spqsigs::non_api::blake2b_keyed_state<hashlen>(salt, keyed);
+        unsigned char nodes[2 * hashlen];
+        randombytes_buf(nodes, sizeof(nodes));
+        unsigned char fixed[hashlen];
+        unsigned char reference[hashlen];
+        spqsigs::non_api::blake2b_node<hashlen>(keyed, nodes, nodes + hashlen, fixed);
+        crypto_generichash_blake2b(reference, hashlen, nodes, sizeof(nodes), key, hashlen);
+        bool ok = std::memcmp(fixed, reference, hashlen) == 0;
+        spqsigs::non_api::blake2b_chain<hashlen>(keyed, fixed, static_cast<size_t>(ind) * 100);
+        for (int step=0; step < ind * 100; step++) {
+            crypto_generichash_blake2b(reference, hashlen, reference, hashlen, key, hashlen);
+        }
+        std::cout << "BLAKE2b cross-check " << ind << " ";
+        if (ok and std::memcmp(fixed, reference, hashlen) == 0) {
+            std::cout << "OK" << std::endl;
+        } else {
+            std::cout << "FAIL, WE HAVE WORK TO DO HERE" << std::endl;
+            fail_count += 1;
+        }
+    }
+    std::cout << "Cross-checking hash backends, " << spqsigs::dispatched_backend::name() << " kernel dispatched." << std::endl;
+    std::string backend_master = spqsigs::non_api::master_key<hashlen>();
+    std::vector<std::string> libsodium_signatures = backend_signatures<spqsigs::libsodium_backend>(backend_master, msg);
+    std::vector<std::pair<std::string, bool>> backend_results;
+    backend_results.emplace_back(spqsigs::libsodium_backend::name(), backend_matches<spqsigs::libsodium_backend>(backend_master, msg, libsodium_signatures));
+    backend_results.emplace_back(spqsigs::reference_backend::name(), backend_matches<spqsigs::reference_backend>(backend_master, msg, libsodium_signatures));
+    if (spqsigs::avx2_backend::supported()) {
+        backend_results.emplace_back(spqsigs::avx2_backend::name(), backend_matches<spqsigs::avx2_backend>(backend_master, msg, libsodium_signatures));
+    }
+    if (spqsigs::avx512_backend::supported()) {
+        backend_results.emplace_back(spqsigs::avx512_backend::name(), backend_matches<spqsigs::avx512_backend>(backend_master, msg, libsodium_signatures));
+    }
+    backend_results.emplace_back("dispatched", backend_matches<spqsigs::dispatched_backend>(backend_master, msg, libsodium_signatures));
+    for (auto &result : backend_results) {
+        std::cout << "Hash backend " << result.first << " ";
+        if (result.second) {
+            std::cout << "OK" << std::endl;
+        } else {
+            std::cout << "FAIL, WE HAVE WORK TO DO HERE" << std::endl;
+            fail_count += 1;
+        }
+    }
+    std::cout << "Creating a new single-chain checksum signing key." << std::endl;
+    spqsigs::non_api::master_key<hashlen> checksum_master;
+    checksum_signing_key checksum_key(spqsigs::non_api::unique_index_generator<hashlen, wotsbits, merkleheight1>(checksum_master, 0));
+    for (int ind=0; ind < (1 << merkleheight1); ind++) {
+        auto signature = checksum_signature(checksum_key.sign_message(msg));
+        std::cout << "Checksum signature " << ind << " ";
+        if (signature.validate(msg) and signature.get_pubkey() == checksum_key.pubkey() and not signature.validate(msg + ".")) {
+            std::cout << "OK" << std::endl;
+        } else {
+            std::cout << "FAIL, WE HAVE WORK TO DO HERE" << std::endl;
+            fail_count += 1;
+        }
+    }
+    std::cout << "Creating a new 4-ary merkle tree signing key." << std::endl;
+    quad_signing_key quad_key(spqsigs::non_api::unique_index_generator<hashlen, wotsbits, merkleheight2>(checksum_master, 1));
+    spqsigs::merkle_node_cache<hashlen, merkleheight2> quad_nodes;
+    for (int ind=0; ind < (1 << merkleheight2); ind++) {
+        std::string serialized = quad_key.sign_message(msg);
+        std::cout << "4-ary signature " << ind << " ";
+        bool valid = quad_signature(serialized).validate(msg, false, &quad_nodes);
+        //An auth path contradicting a proven node gets rejected before any hashing, so even without budget.
+        std::string tampered = serialized;
+        tampered[2 * hashlen + spqsigs::non_api::signature_index_bytes] ^= 1;
+        uint64_t no_budget = 0;
+        bool rejected = false;
+        try {
+            rejected = not quad_signature(tampered).validate(msg, false, &quad_nodes, &no_budget);
+        } catch (const spqsigs::hash_budget_exceeded&) {
+        }
+        //With the leaf proven, validation stops right there and never looks at the auth path.
+        std::string leaf;
+        spqsigs::merkle_node_cache<hashlen, merkleheight2> leaf_only;
+        if (quad_nodes.get(quad_key.pubkey(), 0, static_cast<uint64_t>(ind), leaf)) {
+            leaf_only.put(quad_key.pubkey(), {std::make_tuple(0u, static_cast<uint64_t>(ind), leaf)});
+        }
+        bool early = quad_signature(tampered).validate(msg, false, &leaf_only) and not quad_signature(tampered).validate(msg);
+        if (valid and rejected and early and quad_signature(serialized).validate(msg) and
+            quad_signature(serialized).get_pubkey() == quad_key.pubkey() and not quad_signature(serialized).validate(msg + ".")) {
+            std::cout << "OK" << std::endl;
+        } else {
+            std::cout << "FAIL, WE HAVE WORK TO DO HERE" << std::endl;
+            fail_count += 1;
+        }
+    }
+    std::cout << "Creating a new out-of-core signing key in a node file." << std::endl;
+    {
+        std::string node_file = "spq_main_nodes.tmp";
+        std::remove(node_file.c_str());
+        std::string mapped_private = mapped_signing_key::new_private_key();
+        spqsigs::non_api::master_key<hashlen> mapped_master(mapped_private);
+        spqsigs::signing_key<hashlen, wotsbits, merkleheight1> in_memory_key(spqsigs::non_api::unique_index_generator<hashlen, wotsbits, merkleheight1>(mapped_master, 0));
+        std::string mapped_pubkey;
+        {
+            mapped_signing_key mapped_key(mapped_private, node_file);
+            mapped_pubkey = mapped_key.pubkey();
+            std::string serialized = mapped_key.sign_message(msg);
+            std::cout << "Mapped signature 0 ";
+            if (serialized == in_memory_key.sign_message(msg) and mapped_signature(serialized).validate(msg)) {
+                std::cout << "OK" << std::endl;
+            } else {
+                std::cout << "FAIL, WE HAVE WORK TO DO HERE" << std::endl;
+                fail_count += 1;
+            }
+        }
+        //Reopen the node file and carry on signing where the first key left off.
+        mapped_signing_key reopened_key(mapped_private, node_file, 1);
+        for (int ind=1; ind < (1 << merkleheight1); ind++) {
+            std::string serialized = reopened_key.sign_message(msg);
+            std::cout << "Mapped signature " << ind << " ";
+            if (reopened_key.pubkey() == mapped_pubkey and mapped_pubkey == in_memory_key.pubkey() and
+                serialized == in_memory_key.sign_message(msg) and mapped_signature(serialized).validate(msg) and
+                mapped_signature(serialized).get_pubkey() == mapped_pubkey and not mapped_signature(serialized).validate(msg + ".")) {
+                std::cout << "OK" << std::endl;
+            } else {
+                std::cout << "FAIL, WE HAVE WORK TO DO HERE" << std::endl;
+                fail_count += 1;
+            }
+        }
+        std::remove(node_file.c_str());
+    }
+    std::cout << "Creating a new triple-tree signing key with per-level wotsbits." << std::endl;
+    auto skey3pl = signing_key_3pl();
+    std::vector<std::string> cached3pl(2, "");
+    cached3pl.push_back(skey3pl.public_key());
+    deserializer_3pl deserialize3pl;
+    for (int ind=0; ind < (1 << (merkleheight1 + 1)); ind++) {
+        auto signature = skey3pl.sign_message(msg);
+        std::string serialized3pl = spqsigs::serialize(signature, skey3pl.public_key());
+        std::cout << "Per-level signature " << ind << " " << serialized3pl.size() << "-byte signature ";
+        auto signature_out = deserialize3pl(serialized3pl).second;
+        if (compare_signatures(signature, signature_out) and verifyable_signature_3pl(signature_out, cached3pl).validate(msg)) {
+            std::cout << "OK" << std::endl;
+        } else {
+            std::cout << "FAIL, WE HAVE WORK TO DO HERE" << std::endl;
+            fail_count += 1;
+        }
+    }
+    std::cout << "Creating a new triple-tree checksum signing key with per-level wotsbits." << std::endl;
+    {
+        auto skey3cl = signing_key_3cl();
+        std::vector<std::string> cached3cl(2, "");
+        cached3cl.push_back(skey3cl.public_key());
+        spqsigs::reducer reducer3cl;
+        spqsigs::expander expander3cl;
+        deserializer_3cl deserialize3cl;
+        view_deserializer_3cl deserialize_views3cl;
+        //Same, but also leaving out the message signature fields the peer already has.
+        spqsigs::reducer omitting_reducer3cl(spqsigs::omit_known{merkleheight1});
+        spqsigs::expander omitting_expander3cl(spqsigs::omit_known{merkleheight1});
+        deserializer_3cl omitting_deserialize3cl(true);
+        for (int ind=0; ind < (1 << (merkleheight1 + 1)); ind++) {
+            auto signature = skey3cl.sign_message(msg);
+            std::string full = spqsigs::serialize(signature, skey3cl.public_key());
+            std::vector<std::string> unknown3cl(2, "");
+            unknown3cl.push_back(skey3cl.public_key());
+            auto full_out = deserialize3cl(full).second;
+            bool ok = compare_signatures(signature, full_out);
+            auto views = deserialize_views3cl(full);
+            ok = ok and verifyable_signature_3cl(views.second, unknown3cl).validate(msg);
+            auto omitted = signature;
+            omitting_reducer3cl.reduce(omitted);
+            auto omitted_out = omitting_deserialize3cl(spqsigs::serialize(omitted, skey3cl.public_key())).second;
+            omitting_expander3cl.expand(omitted_out);
+            reducer3cl.reduce(signature);
+            std::string serialized3cl = spqsigs::serialize(signature, skey3cl.public_key());
+            std::cout << "Checksum chain signature " << ind << " " << serialized3cl.size() << "-byte signature ";
+            auto signature_out = deserialize3cl(serialized3cl).second;
+            expander3cl.expand(signature_out);
+            ok = ok and compare_signatures(signature_out, omitted_out);
+            if (ok and verifyable_signature_3cl(signature_out, cached3cl).validate(msg)) {
+                std::cout << "OK" << std::endl;
+            } else {
+                std::cout << "FAIL, WE HAVE WORK TO DO HERE" << std::endl;
+                fail_count += 1;
+            }
+        }
+    }
+    std::cout << "Creating a new eight-tree signing key. This may take a while." << std::endl;
+    std::cout << " - key meant to sign " <<  (1ull << (8 * merkleheight1)) << " messages" << std::endl;
+    auto skey8l = signing_key_8l();
+    std::vector<std::string> cached7(7, "");
+    cached7.push_back(skey8l.public_key());
+    spqsigs::reducer reducer8l;
+    spqsigs::expander expander8l;
+    deserializer_8l deserialize8l;
+    auto sign_and_validate8l = [&](signing_key_8l &key) {
+        std::cout <<  "Making signature " << key.get_next_index() << " ";
+        auto signature = key.sign_message(msg);
+        reducer8l.reduce(signature);
+        std::string serialized8l = spqsigs::serialize(signature, key.public_key());
+        std::cout << " " << serialized8l.size() << "-byte signature ";
+        auto signature_out = deserialize8l(serialized8l).second;
+        expander8l.expand(signature_out);
+        auto sign8 = verifyable_signature_8l(signature_out, cached7);
+        if (sign8.validate(msg)) {
+            std::cout << "OK" << std::endl;
+        } else {
+            std::cout << "FAIL, WE HAVE WORK TO DO HERE" << std::endl;
+            fail_count += 1;
+        }
+    };
+    for (int ind=0; ind < 10; ind++) {
+        sign_and_validate8l(skey8l);
+    }
+    //Fast-forward to just before all intermediate levels roll over, and sign some more.
+    uint64_t rollover = (1ull << (7 * merkleheight1)) - 2;
+    std::cout << "Fast-forwarding to signature " << rollover << std::endl;
+    auto skey8l_ff = signing_key_8l(skey8l.private_key(), false, rollover);
+    for (int ind=0; ind < 4; ind++) {
+        sign_and_validate8l(skey8l_ff);
+    }
+    std::cout << std::endl << " FAIL:" << fail_count  << std::endl;
+    fail_count = 0;
     std::cout << "Creating a new double-tree signing key. This may take a while." << std::endl;
     std::cout << " - key meant to sign " <<  (1ull << (merkleheight1 + merkleheight2)) << " messages" << std::endl;
     auto skey2l = signing_key_2l();
@@ -77,21 +360,48 @@ int main() {
     spqsigs::reducer reducer2l;
     spqsigs::expander expander2l;
     deserializer_2l deserialize2l; 
+    //Same, but also leaving out the message signature fields the peer already has.
+    spqsigs::reducer omitting_reducer2l(spqsigs::omit_known{merkleheight2});
+    spqsigs::expander omitting_expander2l(spqsigs::omit_known{merkleheight2});
+    deserializer_2l omitting_deserialize2l(true);
     for (int ind=0; ind < (1 << (merkleheight1 + merkleheight2)); ind++) {
         try {
 	    std::cout <<  "Making signature " << ind << " out of " << (1 << (merkleheight1 + merkleheight2)) << " ";
+	    std::pair<std::string, std::vector<std::pair<std::string, std::string>>> fast_forwarded;
+	    if (ind == (1 << merkleheight2) + 5) {
+                //Check that a key restored at the current signature index signs just like the original.
+                signing_key_2l restored(skey2l.private_key(), false, skey2l.get_next_index());
+                fast_forwarded = restored.sign_message(msg);
+	    }
             auto signature = skey2l.sign_message(msg);
+	    if (fast_forwarded.first != "") {
+                if (compare_signatures(signature, fast_forwarded)) {
+                    std::cout << "(fast-forward OK) ";
+                } else {
+                    std::cout << "(FAST-FORWARD FAIL) ";
+                    fail_count += 1;
+                }
+	    }
+	    auto omitted = signature;
+	    omitting_reducer2l.reduce(omitted);
+	    auto omitted_out = omitting_deserialize2l(spqsigs::serialize(omitted, skey2l.public_key())).second;
+	    omitting_expander2l.expand(omitted_out);
 	    reducer2l.reduce(signature);
 	    std::string serialized2l = spqsigs::serialize(signature, skey2l.public_key());
 	    std::cout << " " << serialized2l.size() << "-byte signature "; 
 	    auto deserialized2 = deserialize2l(serialized2l);
 	    signature = deserialized2.second;
             expander2l.expand(signature);
+            if (not compare_signatures(signature, omitted_out)) {
+                std::cout << "(OMIT KNOWN FAIL) ";
+                fail_count += 1;
+            }
             auto sign2 = verifyable_signature_2l(signature, cached);
 	    if (sign2.validate(msg)) {
                  std::cout << "OK" << std::endl;
 	    } else {
                  std::cout << "FAIL, WE HAVE WORK TO DO HERE" << std::endl;
+                 fail_count += 1;
 	    }
 
         } catch  (const spqsigs::signingkey_exhausted&) {
@@ -99,7 +409,352 @@ int main() {
             except_count += 1;
 	}
     }
-    std::cout << std::endl << " EXCEPT:" << except_count  << std::endl;
+    std::cout << "Verifying a reduced double-tree stream through the verify pipeline." << std::endl;
+    {
+        auto pipeline_key = signing_key_2l();
+        spqsigs::reducer pipeline_reducer;
+        std::vector<std::pair<std::string, std::string>> stream;
+        for (int ind=0; ind < 12; ind++) {
+            auto signature = pipeline_key.sign_message(msg);
+            pipeline_reducer.reduce(signature);
+            stream.emplace_back(spqsigs::serialize(signature, pipeline_key.public_key()), msg);
+        }
+        //A signature for another message halfway, only that one should fail.
+        stream[5].second = msg + ".";
+        spqsigs::verify_pipeline<hashlen, wotsbits, merkleheight1, merkleheight2> pipeline(pipeline_key.public_key(), 3, 4);
+        std::vector<bool> results = pipeline.verify(stream);
+        for (size_t ind=0; ind < stream.size(); ind++) {
+            std::cout << "Pipeline result " << ind << " ";
+            if (ind < results.size() and results[ind] == (ind != 5)) {
+                std::cout << "OK" << std::endl;
+            } else {
+                std::cout << "FAIL, WE HAVE WORK TO DO HERE" << std::endl;
+                fail_count += 1;
+            }
+        }
+    }
+    std::cout << "Sharing verified pairs through a shared memory segment." << std::endl;
+    {
+        std::string table_name = "/spqsigs-main-" + std::to_string(::getpid());
+        spqsigs::shared_pair_table::remove(table_name);
+        std::vector<bool> checks;
+        {
+            spqsigs::shared_pair_table first(table_name, 1024);
+            spqsigs::shared_pair_table second(table_name, 1024);
+            first.insert("parent-pubkey", "child-pubkey");
+            checks.push_back(second.contains("parent-pubkey", "child-pubkey"));
+            checks.push_back(not second.contains("parent-pubkey", "other-pubkey"));
+        }
+        spqsigs::shared_pair_table::remove(table_name);
+        //A creator that died before publishing the table, once after sizing the segment and once before.
+        for (off_t size : {static_cast<off_t>(spqsigs::shared_pair_table::header_size + 1024 * sizeof(uint64_t)), static_cast<off_t>(0)}) {
+            int fd = ::shm_open(table_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+            checks.push_back(fd >= 0 and ::ftruncate(fd, size) == 0);
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            try {
+                spqsigs::shared_pair_table recovered(table_name, 1024);
+                recovered.insert("parent-pubkey", "child-pubkey");
+                checks.push_back(recovered.contains("parent-pubkey", "child-pubkey"));
+            } catch (const std::exception &) {
+                checks.push_back(false);
+            }
+            spqsigs::shared_pair_table::remove(table_name);
+        }
+        for (size_t ind=0; ind < checks.size(); ind++) {
+            std::cout << "Shared pair table check " << ind << " ";
+            if (checks[ind]) {
+                std::cout << "OK" << std::endl;
+            } else {
+                std::cout << "FAIL, WE HAVE WORK TO DO HERE" << std::endl;
+                fail_count += 1;
+            }
+        }
+    }
+    std::cout << "Verifying a reduced double-tree stream from several threads through the verifier registry." << std::endl;
+    {
+        auto registry_key = signing_key_2l();
+        spqsigs::reducer registry_reducer;
+        std::vector<std::pair<std::string, std::string>> stream;
+        for (int ind=0; ind < 16; ind++) {
+            auto signature = registry_key.sign_message(msg);
+            registry_reducer.reduce(signature);
+            stream.emplace_back(spqsigs::serialize(signature, registry_key.public_key()), msg);
+        }
+        stream[6].second = msg + ".";
+        spqsigs::verifier_registry<hashlen, wotsbits, merkleheight1, merkleheight2> registry(4);
+        //Signatures of signers that weren't added fail without leaving state behind.
+        bool unknown_ok = not registry.verify(registry_key.public_key(), 0, stream[0].first, msg) and registry.size() == 0;
+        registry.add(registry_key.public_key());
+        std::vector<char> results(stream.size(), 0);
+        std::vector<std::thread> threads;
+        for (size_t thread=0; thread < 4; thread++) {
+            threads.emplace_back([&, thread]() {
+                for (size_t ind=thread; ind < stream.size(); ind += 4) {
+                    results[ind] = registry.verify(registry_key.public_key(), ind, stream[ind].first, stream[ind].second);
+                }
+            });
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        std::cout << "Registry unknown signer ";
+        if (unknown_ok) {
+            std::cout << "OK" << std::endl;
+        } else {
+            std::cout << "FAIL, WE HAVE WORK TO DO HERE" << std::endl;
+            fail_count += 1;
+        }
+        for (size_t ind=0; ind < stream.size(); ind++) {
+            std::cout << "Registry result " << ind << " ";
+            if ((results[ind] != 0) == (ind != 6)) {
+                std::cout << "OK" << std::endl;
+            } else {
+                std::cout << "FAIL, WE HAVE WORK TO DO HERE" << std::endl;
+                fail_count += 1;
+            }
+        }
+    }
+    std::cout << "Deduplicating verified signatures." << std::endl;
+    {
+        std::vector<bool> checks;
+        std::string root1(hashlen, '1');
+        std::string root2(hashlen, '2');
+        std::string digest1(hashlen, 'a');
+        std::string digest2(hashlen, 'b');
+        spqsigs::verified_signature_cache<hashlen> cache(2);
+        cache.insert(root1, "signature-a", digest1);
+        checks.push_back(cache.contains(root1, "signature-a", digest1));
+        checks.push_back(not cache.contains(root2, "signature-a", digest1));
+        checks.push_back(not cache.contains(root1, "signature-a", digest2));
+        cache.insert(root1, "signature-b", digest1);
+        //At capacity, the recently hit signature gets a second chance and the other one goes.
+        checks.push_back(cache.contains(root1, "signature-a", digest1));
+        cache.insert(root1, "signature-c", digest1);
+        checks.push_back(not cache.contains(root1, "signature-b", digest1));
+        checks.push_back(cache.contains(root1, "signature-a", digest1));
+        checks.push_back(cache.contains(root1, "signature-c", digest1));
+        checks.push_back(cache.size() == 2);
+        checks.push_back(cache.hits() == 4 and cache.misses() == 3 and cache.evictions() == 1);
+        //The same through a verifier registry, a repeated signature hits and the signature with another message
+        //misses and fails.
+        auto dedup_key = signing_key_2l();
+        auto signature = dedup_key.sign_message(msg);
+        std::string serialized = spqsigs::serialize(signature, dedup_key.public_key());
+        spqsigs::verifier_registry<hashlen, wotsbits, merkleheight1, merkleheight2> registry(4, 16, 8);
+        registry.add(dedup_key.public_key());
+        checks.push_back(registry.verify(dedup_key.public_key(), serialized, msg));
+        checks.push_back(registry.verify(dedup_key.public_key(), serialized, msg));
+        checks.push_back(not registry.verify(dedup_key.public_key(), serialized, msg + "."));
+        spqsigs::verified_signature_cache<hashlen> *dedup = registry.dedup_cache();
+        checks.push_back(dedup != nullptr and dedup->hits() == 1 and dedup->misses() == 2 and dedup->size() == 1);
+        for (size_t ind=0; ind < checks.size(); ind++) {
+            std::cout << "Signature cache check " << ind << " ";
+            if (checks[ind]) {
+                std::cout << "OK" << std::endl;
+            } else {
+                std::cout << "FAIL, WE HAVE WORK TO DO HERE" << std::endl;
+                fail_count += 1;
+            }
+        }
+    }
+    std::cout << "Writing and reading back a double-tree signature log." << std::endl;
+    {
+        const char *log_path = "spq_main_log.tmp";
+        std::remove(log_path);
+        std::vector<bool> checks;
+        auto log_key = signing_key_2l();
+        std::vector<std::pair<std::string, std::vector<std::pair<std::string, std::string>>>> written;
+        {
+            spqsigs::signature_log_writer<hashlen, wotsbits, merkleheight1, merkleheight2> writer(log_path, log_key.public_key(), 4);
+            for (int ind=0; ind < 20; ind++) {
+                written.push_back(log_key.sign_message(msg));
+                writer.append(written.back());
+            }
+        }
+        {
+            spqsigs::signature_log_reader<hashlen, wotsbits, merkleheight1, merkleheight2> reader(log_path);
+            checks.push_back(reader.size() == 20);
+            //Out of order, on both sides of keyframes.
+            for (uint64_t index : {13, 2, 19, 3, 4, 8, 0, 11}) {
+                auto signature = reader[index];
+                checks.push_back(compare_signatures(signature, written[index]));
+            }
+        }
+        //Cut the last record in half, as a crash while appending would.
+        struct stat info;
+        checks.push_back(::stat(log_path, &info) == 0 and ::truncate(log_path, info.st_size - 7) == 0);
+        {
+            spqsigs::signature_log_reader<hashlen, wotsbits, merkleheight1, merkleheight2> reader(log_path);
+            auto signature = reader[18];
+            checks.push_back(reader.size() == 19 and compare_signatures(signature, written[18]));
+        }
+        {
+            spqsigs::signature_log_writer<hashlen, wotsbits, merkleheight1, merkleheight2> writer(log_path, log_key.public_key(), 4);
+            checks.push_back(writer.size() == 19);
+            written.push_back(log_key.sign_message(msg));
+            writer.append(written.back());
+        }
+        {
+            spqsigs::signature_log_reader<hashlen, wotsbits, merkleheight1, merkleheight2> reader(log_path);
+            auto signature = reader[19];
+            std::vector<std::string> last_known(1, "");
+            last_known.push_back(reader.root_pubkey());
+            verifyable_signature_2l verifyable(signature, last_known);
+            checks.push_back(reader.size() == 20 and compare_signatures(signature, written[20]) and verifyable.validate(msg));
+        }
+        std::remove(log_path);
+        for (size_t ind=0; ind < checks.size(); ind++) {
+            std::cout << "Signature log check " << ind << " ";
+            if (checks[ind]) {
+                std::cout << "OK" << std::endl;
+            } else {
+                std::cout << "FAIL, WE HAVE WORK TO DO HERE" << std::endl;
+                fail_count += 1;
+            }
+        }
+    }
+    std::cout << "Resuming an interrupted double-tree key generation from a checkpoint." << std::endl;
+    {
+        std::vector<bool> checks;
+        std::string private_key = signing_key_2l::new_private_key();
+        std::string saved;
+        int persisted = 0;
+        size_t largest_append = 0;
+        auto persist = [&saved, &largest_append](const std::string &serialized, bool append) {
+            saved = append ? saved + serialized : serialized;
+            if (append) {
+                largest_append = std::max(largest_append, serialized.size());
+            }
+        };
+        spqsigs::keygen_checkpoint<hashlen> interrupted([&persist, &persisted](const std::string &serialized, bool append) {
+            if (++persisted == 3) {
+                throw std::runtime_error("Key generation interrupted.");
+            }
+            persist(serialized, append);
+        }, 2);
+        bool stopped = false;
+        try {
+            signing_key_2l never_done(private_key, false, 0, interrupted);
+        } catch (const std::runtime_error &) {
+            stopped = true;
+        }
+        checks.push_back(stopped and not saved.empty());
+        //Also after a torn append of leaves the checkpoint already has.
+        saved += saved.substr(0, hashlen + 8 + hashlen + hashlen / 2);
+        spqsigs::keygen_checkpoint<hashlen> resumed(persist, 2, saved);
+        signing_key_2l resumed_key(private_key, false, 0, resumed);
+        signing_key_2l reference_key(private_key, false);
+        checks.push_back(resumed_key.public_key() == reference_key.public_key());
+        //Completed trees are dropped from the checkpoint, and appending never writes more than a subtree of leaves.
+        checks.push_back(saved.empty());
+        checks.push_back(largest_append > 0 and largest_append <= hashlen + 8 + 4 * hashlen);
+        auto signature = resumed_key.sign_message(msg);
+        std::vector<std::string> last_known(1, "");
+        last_known.push_back(reference_key.public_key());
+        verifyable_signature_2l verifyable(signature, last_known);
+        checks.push_back(verifyable.validate(msg));
+        for (size_t ind=0; ind < checks.size(); ind++) {
+            std::cout << "Keygen checkpoint check " << ind << " ";
+            if (checks[ind]) {
+                std::cout << "OK" << std::endl;
+            } else {
+                std::cout << "FAIL, WE HAVE WORK TO DO HERE" << std::endl;
+                fail_count += 1;
+            }
+        }
+    }
+    std::cout << "Deserializing double-tree signatures into views." << std::endl;
+    {
+        std::vector<bool> checks;
+        auto view_key = signing_key_2l();
+        spqsigs::reducer view_reducer;
+        spqsigs::view_deserializer<hashlen, wotsbits, merkleheight1, merkleheight2> deserialize_views;
+        deserializer_2l deserialize_strings;
+        std::vector<std::string> last_known(1, "");
+        last_known.push_back(view_key.public_key());
+        //A full signature and a reduced one.
+        for (int ind=0; ind < 2; ind++) {
+            auto signature = view_key.sign_message(msg);
+            view_reducer.reduce(signature);
+            std::string serialized = spqsigs::serialize(signature, view_key.public_key());
+            auto views = deserialize_views(serialized);
+            auto strings = deserialize_strings(serialized);
+            bool same = views.first == strings.first and views.second.first == strings.second.first and
+                        views.second.second.size() == strings.second.second.size();
+            for (size_t level=0; same and level < views.second.second.size(); level++) {
+                same = views.second.second[level].first == strings.second.second[level].first and
+                       views.second.second[level].second == strings.second.second[level].second;
+            }
+            checks.push_back(same);
+            std::string buffer(spqsigs::serialized_size(views.second, views.first), '\0');
+            checks.push_back(buffer.size() == serialized.size() and
+                             spqsigs::serialize(views.second, views.first, buffer.data(), buffer.size()) == buffer.size() and
+                             buffer == serialized);
+            verifyable_signature_2l verifyable(views.second, last_known);
+            checks.push_back(verifyable.validate(msg));
+            last_known[0] = strings.second.second[0].first;
+        }
+        for (size_t ind=0; ind < checks.size(); ind++) {
+            std::cout << "View deserializer check " << ind << " ";
+            if (checks[ind]) {
+                std::cout << "OK" << std::endl;
+            } else {
+                std::cout << "FAIL, WE HAVE WORK TO DO HERE" << std::endl;
+                fail_count += 1;
+            }
+        }
+    }
+    std::cout << "Signing digests with a double-tree signing key." << std::endl;
+    {
+        std::vector<bool> checks;
+        auto digest_key = signing_key_2l();
+        std::vector<std::string> last_known(1, "");
+        last_known.push_back(digest_key.public_key());
+        //Digests of the wrong length get refused without using up a signature index.
+        bool refused = false;
+        try {
+            digest_key.sign_digest(std::string(hashlen - 1, 'x'));
+        } catch (const std::invalid_argument &) {
+            refused = digest_key.get_next_index() == 0;
+        }
+        checks.push_back(refused);
+        //A digest from hasher() signs just like the message, both validate either way. The last one rolls over to a
+        //new bottom-level key.
+        for (int ind=0; ind < (1 << merkleheight1) + 1; ind++) {
+            std::string digest = digest_key.hasher().update(msg).finish();
+            auto signature = ind % 2 == 0 ? digest_key.sign_digest(digest) : digest_key.sign_message(msg);
+            verifyable_signature_2l by_message(signature, last_known);
+            verifyable_signature_2l by_digest(signature, last_known);
+            verifyable_signature_2l other_digest(signature, last_known);
+            checks.push_back(by_message.validate(msg) and by_digest.validate(digest, true) and
+                             not other_digest.validate(std::string(hashlen, 'x'), true));
+        }
+        std::string node_file = "spq_main_digest_nodes.tmp";
+        std::remove(node_file.c_str());
+        {
+            mapped_signing_key mapped_key(mapped_signing_key::new_private_key(), node_file);
+            bool mapped_refused = false;
+            try {
+                mapped_key.sign_digest(std::string(hashlen + 1, 'x'));
+            } catch (const std::invalid_argument &) {
+                mapped_refused = true;
+            }
+            checks.push_back(mapped_refused and mapped_signature(mapped_key.sign_message(msg)).validate(msg));
+        }
+        std::remove(node_file.c_str());
+        for (size_t ind=0; ind < checks.size(); ind++) {
+            std::cout << "Digest signing check " << ind << " ";
+            if (checks[ind]) {
+                std::cout << "OK" << std::endl;
+            } else {
+                std::cout << "FAIL, WE HAVE WORK TO DO HERE" << std::endl;
+                fail_count += 1;
+            }
+        }
+    }
+    std::cout << std::endl << " FAIL:" << fail_count << " EXCEPT:" << except_count  << std::endl;
     ok_count = 0;
     fail_count = 0;
     except_count = 0;
@@ -113,34 +768,57 @@ int main() {
     spqsigs::reducer reducer3l;
     spqsigs::expander expander3l;
     deserializer_3l deserialize3l;
+    spqsigs::verified_pair_cache<hashlen> pair_cache3l(4);
     for (int ind=0; ind < (1 << (merkleheight1 + merkleheight2 +merkleheight3)); ind++) {
         try {
             std::cout <<  "Making signature " << ind << " out of " << (1 << (merkleheight1 + merkleheight2 + merkleheight3)) << " ";
             auto signature = skey3l.sign_message(msg);
+	    reducer3l = spqsigs::reducer(static_cast<std::string>(reducer3l));
 	    reducer3l.reduce(signature);
 	    std::string serialized3l = spqsigs::serialize(signature, skey3l.public_key());
             std::cout << " " << serialized3l.size() << " -byte signature ";
 	    auto deserialized3 = deserialize3l(serialized3l);
 	    auto signature_out = deserialized3.second;
 	    if (compare_signatures(signature, signature_out) == false) {
+                fail_count += 1;
 		std::cout << std::endl;
 		std::cout << as_hex(serialized3l) << std::endl;
                 std::cout << hex_signature(signature);
                 std::cout << hex_signature(signature_out);
 	    }
+            //Carry on with restored state, as a restarted verifier would.
+            expander3l = spqsigs::expander(static_cast<std::string>(expander3l));
             expander3l.expand(signature_out);
             auto sign3 = verifyable_signature_3l(signature_out, cached2);
+            //Nothing known but the root key, intermediate-level signatures come from the verified pair cache.
+            std::vector<std::string> unknown3(cached2.size() - 1, "");
+            unknown3.push_back(skey3l.public_key());
+            auto sign3_paircached = verifyable_signature_3l(signature_out, unknown3, pair_cache3l);
+            if (not sign3_paircached.validate(msg)) {
+                std::cout << "PAIR CACHE FAIL ";
+                fail_count += 1;
+            }
+            //A budget one hash short gets refused before any hashing.
+            auto sign3_budget = verifyable_signature_3l(signature_out, unknown3);
+            uint64_t budget = sign3_budget.validation_cost() - 1;
+            try {
+                sign3_budget.validate(msg, false, &budget);
+                std::cout << "BUDGET FAIL ";
+                fail_count += 1;
+            } catch (const spqsigs::hash_budget_exceeded&) {
+            }
 	    if (sign3.validate(msg)) {
                  std::cout << "OK" << std::endl;
             } else {
                  std::cout << "FAIL, WE HAVE WORK TO DO HERE" << std::endl;
+                 fail_count += 1;
             }
         } catch  (const spqsigs::signingkey_exhausted&) {
             std::cout << "OOPS" << std::endl;
             except_count += 1;
         }
     }
-    std::cout << std::endl << " EXCEPT:" << except_count  << std::endl;
+    std::cout << std::endl << " FAIL:" << fail_count << " EXCEPT:" << except_count  << std::endl;
     ok_count = 0;
     fail_count = 0;
     except_count = 0;
@@ -155,6 +833,8 @@ int main() {
     spqsigs::reducer reducer4l;
     spqsigs::expander expander4l;
     deserializer_4l deserialize4l;
+    size_t levels_emitted = 0;
+    push_parser_4l parser4l([&levels_emitted](size_t, std::string_view, std::string_view) { levels_emitted++; });
     for (int ind=0; ind < (1 << (merkleheight1 + merkleheight2 + merkleheight3 + merkleheight4)); ind++) {
         try {
             std::cout <<  "Making signature " << ind << " out of " << (1 << (merkleheight1 + merkleheight2 + merkleheight3 + merkleheight4)) << " ";
@@ -165,22 +845,39 @@ int main() {
 	    auto deserialized4 = deserialize4l(serialized4l);
 	    auto signature_out = deserialized4.second;
 	    if (compare_signatures(signature, signature_out) == false) {
+                fail_count += 1;
                 std::cout << std::endl;
                 std::cout << as_hex(serialized4l) << std::endl;
                 std::cout << hex_signature(signature);
                 std::cout << hex_signature(signature_out);
             }
+            //Feed the signature to the push parser in small chunks, it should find the same parts.
+            parser4l.reset();
+            levels_emitted = 0;
+            for (size_t offset=0; offset < serialized4l.size(); offset += 7) {
+                parser4l.push(std::string_view(serialized4l).substr(offset, 7));
+            }
+            bool parsed_ok = parser4l.complete() and levels_emitted == 4 and parser4l.parts().first == signature_out.first;
+            for (size_t level=0; level < 3; level++) {
+                parsed_ok = parsed_ok and parser4l.parts().second[level].first == signature_out.second[level].first
+                                      and parser4l.parts().second[level].second == signature_out.second[level].second;
+            }
+            if (not parsed_ok) {
+                std::cout << "PUSH PARSER MISMATCH ";
+                fail_count += 1;
+            }
             expander4l.expand(signature_out);
             auto sign4 = verifyable_signature_4l(signature_out, cached3);
 	    if (sign4.validate(msg)) {
                  std::cout << "OK" << std::endl;
             } else {
                  std::cout << "FAIL, WE HAVE WORK TO DO HERE" << std::endl;
+                 fail_count += 1;
             }
         } catch  (const spqsigs::signingkey_exhausted&) {
             std::cout << "OOPS" << std::endl;
             except_count += 1;
         }
     }
-    std::cout << std::endl << " EXCEPT:" << except_count  << std::endl;
+    std::cout << std::endl << " FAIL:" << fail_count << " EXCEPT:" << except_count  << std::endl;
 }
@@ -0,0 +1,554 @@
+// spq-audit: re-verify a whole archive of files and their detached signatures.
+//
+// usage: spq-audit [-j threads] [-q depth] <pubkeyfile> <file>...
+//
+// Every file is checked against its <file>.spqsig detached signature, just like spq-verify does, but reading is
+// done asynchronously with at most 'depth' reads outstanding, through io_uring when the kernel allows it and with
+// plain pread otherwise. Signatures get expanded in the order the files are given, so an archive of signatures
+// reduced against each other can be audited too. Files are read in chunks that get hashed as soon as they arrive,
+// with a bounded number of bytes in memory, so files of any size can be audited. Files get opened just before their
+// reads are queued, with a bounded number open at once, so any number of files can be audited. Hashing and
+// validation run on a pool of worker threads sharing a cache of verified intermediate-level signatures, so an audit
+// is limited by disk bandwidth rather than by a single core.
+#include <deque>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <linux/io_uring.h>
+#include "spq_tool.hpp"
+
+namespace {
+// Largest single read request.
+constexpr size_t chunk_size = 1 << 20;
+
+// Reads with a bounded number of outstanding requests. Uses io_uring when available, and falls back to synchronous
+// pread, completing every request on submission, when it is not. Kernels before 5.6 set up a ring but reject
+// IORING_OP_READ, so a ring that fails its first reads with EINVAL gets abandoned for pread too.
+class async_reader {
+  public:
+    async_reader(unsigned int depth):
+        m_depth(depth), m_outstanding(0), m_ring_fd(-1), m_sq_ring(nullptr), m_cq_ring(nullptr), m_sqes(nullptr),
+        m_sq_ring_size(0), m_cq_ring_size(0), m_sqes_size(0), m_params(), m_completed(), m_in_ring(),
+        m_ring_confirmed(false), m_pread_only(false)
+    {
+        std::memset(&m_params, 0, sizeof(m_params));
+        int fd = static_cast<int>(::syscall(__NR_io_uring_setup, depth, &m_params));
+        if (fd < 0) {
+            return;
+        }
+        m_sq_ring_size = m_params.sq_off.array + m_params.sq_entries * sizeof(uint32_t);
+        m_cq_ring_size = m_params.cq_off.cqes + m_params.cq_entries * sizeof(io_uring_cqe);
+        if (m_params.features & IORING_FEAT_SINGLE_MMAP) {
+            m_sq_ring_size = m_cq_ring_size = std::max(m_sq_ring_size, m_cq_ring_size);
+        }
+        m_sqes_size = m_params.sq_entries * sizeof(io_uring_sqe);
+        m_sq_ring = map(fd, m_sq_ring_size, IORING_OFF_SQ_RING);
+        m_cq_ring = (m_params.features & IORING_FEAT_SINGLE_MMAP) ? m_sq_ring : map(fd, m_cq_ring_size, IORING_OFF_CQ_RING);
+        m_sqes = map(fd, m_sqes_size, IORING_OFF_SQES);
+        if (m_sq_ring == nullptr or m_cq_ring == nullptr or m_sqes == nullptr) {
+            unmap();
+            ::close(fd);
+            return;
+        }
+        m_ring_fd = fd;
+    }
+    async_reader(const async_reader&) = delete;
+    async_reader& operator=(const async_reader&) = delete;
+    ~async_reader()
+    {
+        if (m_ring_fd >= 0) {
+            unmap();
+            ::close(m_ring_fd);
+        }
+    }
+    bool using_uring() const
+    {
+        return m_ring_fd >= 0 and not m_pread_only;
+    }
+    bool full() const
+    {
+        return m_outstanding >= m_depth;
+    }
+    size_t outstanding() const
+    {
+        return m_outstanding;
+    }
+    // Queue a read of length bytes at offset, tag comes back with its completion.
+    void submit(int fd, char *buffer, size_t length, uint64_t offset, uint64_t tag)
+    {
+        m_outstanding++;
+        if (not using_uring()) {
+            m_completed.emplace_back(tag, read_now({fd, buffer, length, offset}));
+            return;
+        }
+        m_in_ring[tag] = {fd, buffer, length, offset};
+        uint32_t *tail = ring_field(m_sq_ring, m_params.sq_off.tail);
+        uint32_t mask = *ring_field(m_sq_ring, m_params.sq_off.ring_mask);
+        uint32_t index = *tail & mask;
+        io_uring_sqe *sqe = reinterpret_cast<io_uring_sqe *>(m_sqes) + index;
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = fd;
+        sqe->addr = reinterpret_cast<uint64_t>(buffer);
+        sqe->len = static_cast<uint32_t>(length);
+        sqe->off = offset;
+        sqe->user_data = tag;
+        ring_field(m_sq_ring, m_params.sq_off.array)[index] = index;
+        __atomic_store_n(tail, *tail + 1, __ATOMIC_RELEASE);
+        if (::syscall(__NR_io_uring_enter, m_ring_fd, 1, 0, 0, nullptr, 0) < 0) {
+            throw std::runtime_error("io_uring submission failed");
+        }
+    }
+    // Wait for at least one outstanding read, returns the (tag, bytes read or -errno) of all completed ones.
+    std::vector<std::pair<uint64_t, int64_t>> reap()
+    {
+        std::vector<std::pair<uint64_t, int64_t>> rval;
+        rval.swap(m_completed);
+        if (m_ring_fd >= 0 and rval.empty() and not m_in_ring.empty()) {
+            if (::syscall(__NR_io_uring_enter, m_ring_fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 and errno != EINTR) {
+                throw std::runtime_error("io_uring wait failed");
+            }
+            uint32_t *head = ring_field(m_cq_ring, m_params.cq_off.head);
+            uint32_t tail = __atomic_load_n(ring_field(m_cq_ring, m_params.cq_off.tail), __ATOMIC_ACQUIRE);
+            uint32_t mask = *ring_field(m_cq_ring, m_params.cq_off.ring_mask);
+            io_uring_cqe *cqes = reinterpret_cast<io_uring_cqe *>(static_cast<char *>(m_cq_ring) + m_params.cq_off.cqes);
+            for (uint32_t index = *head; index != tail; index++) {
+                uint64_t tag = cqes[index & mask].user_data;
+                int64_t result = cqes[index & mask].res;
+                auto request = m_in_ring.find(tag);
+                if (result == -EINVAL and not m_ring_confirmed and request != m_in_ring.end()) {
+                    //The kernel does not know the read opcode, redo the read and use pread from now on.
+                    if (not m_pread_only) {
+                        std::cerr << "io_uring rejected reads, falling back to pread" << std::endl;
+                        m_pread_only = true;
+                    }
+                    result = read_now(request->second);
+                }
+                else if (result >= 0) {
+                    m_ring_confirmed = true;
+                }
+                if (request != m_in_ring.end()) {
+                    m_in_ring.erase(request);
+                }
+                rval.emplace_back(tag, result);
+            }
+            __atomic_store_n(head, tail, __ATOMIC_RELEASE);
+        }
+        m_outstanding -= rval.size();
+        return rval;
+    }
+  private:
+    struct pending_read {
+        int fd;
+        char *buffer;
+        size_t length;
+        uint64_t offset;
+    };
+    static int64_t read_now(const pending_read &request)
+    {
+        ssize_t result = ::pread(request.fd, request.buffer, request.length, static_cast<off_t>(request.offset));
+        return result < 0 ? -errno : result;
+    }
+    static void *map(int fd, size_t size, uint64_t offset)
+    {
+        void *rval = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, static_cast<off_t>(offset));
+        return rval == MAP_FAILED ? nullptr : rval;
+    }
+    static uint32_t *ring_field(void *ring, uint32_t offset)
+    {
+        return reinterpret_cast<uint32_t *>(static_cast<char *>(ring) + offset);
+    }
+    void unmap()
+    {
+        if (m_sqes != nullptr) {
+            ::munmap(m_sqes, m_sqes_size);
+        }
+        if (m_cq_ring != nullptr and m_cq_ring != m_sq_ring) {
+            ::munmap(m_cq_ring, m_cq_ring_size);
+        }
+        if (m_sq_ring != nullptr) {
+            ::munmap(m_sq_ring, m_sq_ring_size);
+        }
+    }
+    size_t m_depth;
+    size_t m_outstanding;
+    int m_ring_fd;
+    void *m_sq_ring;
+    void *m_cq_ring;
+    void *m_sqes;
+    size_t m_sq_ring_size;
+    size_t m_cq_ring_size;
+    size_t m_sqes_size;
+    io_uring_params m_params;
+    std::vector<std::pair<uint64_t, int64_t>> m_completed;
+    std::unordered_map<uint64_t, pending_read> m_in_ring;
+    bool m_ring_confirmed;
+    bool m_pread_only;
+};
+
+// One file and its signature, from reading to verification. The signature is read as a whole, the message in
+// chunks that get hashed in order, each chunk taking memory only from its read until it is hashed.
+struct audit_job {
+    std::string path{};
+    int fds[2] = {-1, -1};
+    std::string signature_content{};
+    size_t signature_size = 0;
+    size_t signature_pending = 0;
+    std::vector<std::string> chunks{};
+    std::vector<bool> ready{};
+    size_t hashed = 0;
+    bool expanded = false;
+    bool scheduled = false;
+    size_t pending = 0;
+    size_t size = 0;
+    std::string error{};
+    std::chrono::steady_clock::time_point started{};
+    double read_seconds = 0;
+    double verify_seconds = 0;
+    spqtool::signature_parts parts{};
+    std::vector<std::string> last_known{};
+    std::unique_ptr<spqsigs::message_hasher<spqtool::hashlen>> hasher{};
+    std::string result{};
+};
+
+// A pending read of (part of) a message chunk (0) or the signature (1) of a job.
+struct read_request {
+    size_t job;
+    int which;
+    size_t chunk;
+    size_t offset;
+    size_t length;
+};
+
+// Blocking queue handing expanded signatures to the worker pool.
+class job_queue {
+  public:
+    job_queue(): m_mutex(), m_ready(), m_jobs(), m_closed(false) {}
+    void push(size_t job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_jobs.push_back(job);
+        }
+        m_ready.notify_one();
+    }
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_closed = true;
+        }
+        m_ready.notify_all();
+    }
+    // Returns false once the queue is closed and drained.
+    bool pop(size_t &job)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_ready.wait(lock, [this]() { return m_closed or not m_jobs.empty(); });
+        if (m_jobs.empty()) {
+            return false;
+        }
+        job = m_jobs.front();
+        m_jobs.pop_front();
+        return true;
+    }
+  private:
+    std::mutex m_mutex;
+    std::condition_variable m_ready;
+    std::deque<size_t> m_jobs;
+    bool m_closed;
+};
+}
+
+int main(int argc, char **argv) {
+    unsigned int threads;
+    int first = spqtool::parse_threads(argc, argv, threads);
+    unsigned int depth = 64;
+    if (argc - first > 2 and std::string(argv[first]) == "-q") {
+        first = spqtool::parse_count(argv[first + 1], depth) ? first + 2 : argc;
+    }
+    if (argc - first < 2) {
+        std::cerr << "usage: spq-audit [-j threads] [-q depth] <pubkeyfile> <file>..." << std::endl;
+        return 2;
+    }
+    std::string pubkey = spqtool::read_file(argv[first]);
+    std::vector<audit_job> jobs(static_cast<size_t>(argc - first - 1));
+    for (size_t index=0; index < jobs.size(); index++) {
+        jobs[index].path = argv[first + 1 + static_cast<int>(index)];
+    }
+    async_reader reader(depth);
+    std::cerr << "Reading with " << (reader.using_uring() ? "io_uring" : "pread") << ", " << depth << " outstanding reads" << std::endl;
+    auto start = std::chrono::steady_clock::now();
+    //Bytes of signatures and message chunks read but not yet expanded or hashed. Shared with the workers, that
+    //free chunks as they hash them.
+    const size_t max_in_memory = (depth + 2 * static_cast<size_t>(threads)) * chunk_size;
+    //Every open job holds up to two file descriptors, keep well within the process limit.
+    size_t max_open = depth;
+    struct rlimit limit;
+    if (::getrlimit(RLIMIT_NOFILE, &limit) == 0 and limit.rlim_cur != RLIM_INFINITY) {
+        size_t available = static_cast<size_t>(limit.rlim_cur);
+        max_open = std::min(max_open, available > 34 ? (available - 32) / 2 : 1);
+    }
+    size_t open_jobs = 0;
+    //Intermediate-level signatures verified by any worker, consulted when a job gets validated rather than when it
+    //gets expanded, as expanding runs far ahead of validation.
+    spqsigs::verified_pair_cache<spqtool::hashlen> cache(4096);
+    std::mutex state_mutex;
+    std::condition_variable room;
+    size_t in_memory = 0;
+    //Workers hash the chunks of a message in order and validate the expanded signature once all are hashed. At
+    //most one worker has a job scheduled at a time.
+    job_queue queue;
+    std::vector<std::thread> workers;
+    for (unsigned int thread=0; thread < threads; thread++) {
+        workers.emplace_back([&]() {
+            size_t index;
+            while (queue.pop(index)) {
+                audit_job &job = jobs[index];
+                auto verify_start = std::chrono::steady_clock::now();
+                bool complete = false;
+                while (true) {
+                    std::string chunk;
+                    {
+                        std::lock_guard<std::mutex> lock(state_mutex);
+                        if (job.hashed == job.chunks.size()) {
+                            complete = true;
+                            break;
+                        }
+                        if (not job.ready[job.hashed]) {
+                            //The read of the next chunk schedules the job again, hands off from here on.
+                            job.verify_seconds += spqtool::seconds_since(verify_start);
+                            job.scheduled = false;
+                            break;
+                        }
+                        chunk.swap(job.chunks[job.hashed]);
+                    }
+                    if (job.hasher) {
+                        job.hasher->update(chunk);
+                    }
+                    {
+                        std::lock_guard<std::mutex> lock(state_mutex);
+                        job.hashed++;
+                        in_memory -= chunk.size();
+                    }
+                    room.notify_one();
+                }
+                if (complete) {
+                    if (job.error.empty()) {
+                        try {
+                            spqtool::signature signature(job.parts, job.last_known, cache);
+                            job.result = signature.validate(job.hasher->finish(), true) ? "OK" : "FAIL";
+                        }
+                        catch (const std::exception &e) {
+                            job.error = e.what();
+                        }
+                    }
+                    if (not job.error.empty()) {
+                        job.result = "FAIL (" + job.error + ")";
+                    }
+                    job.hasher.reset();
+                    job.verify_seconds += spqtool::seconds_since(verify_start);
+                }
+            }
+        });
+    }
+    //Hand a job to the workers when its next chunk can be hashed. Called with state_mutex held.
+    auto schedule = [&](size_t index) {
+        audit_job &job = jobs[index];
+        if (job.expanded and not job.scheduled and (job.hashed == job.chunks.size() or job.ready[job.hashed])) {
+            job.scheduled = true;
+            queue.push(index);
+        }
+    };
+    std::deque<read_request> requests;
+    std::vector<read_request> submitted;
+    std::vector<uint64_t> free_tags;
+    spqtool::deserializer deserialize;
+    spqsigs::expander expand;
+    size_t next_open = 0;
+    size_t next_dispatch = 0;
+    size_t bytes = 0;
+    auto close_files = [&](audit_job &job) {
+        for (auto &fd : job.fds) {
+            if (fd >= 0) {
+                ::close(fd);
+                fd = -1;
+            }
+        }
+    };
+    auto finish_read = [&](size_t index) {
+        close_files(jobs[index]);
+        jobs[index].read_seconds = spqtool::seconds_since(jobs[index].started);
+    };
+    while (next_dispatch < jobs.size() or not requests.empty() or reader.outstanding() > 0) {
+        bool progress = false;
+        //Open the next files once the reads queued so far no longer fill the reader, queueing the signature read
+        //first and then the message chunks. Buffers only get memory once their read is submitted.
+        while (next_open < jobs.size() and open_jobs < max_open and requests.size() < depth) {
+            audit_job &job = jobs[next_open];
+            std::string paths[2] = {job.path, job.path + spqtool::signature_extension};
+            size_t sizes[2] = {0, 0};
+            bool out_of_fds = false;
+            for (int which=0; which < 2 and job.error.empty(); which++) {
+                struct stat info;
+                job.fds[which] = ::open(paths[which].c_str(), O_RDONLY);
+                if (job.fds[which] < 0 and (errno == EMFILE or errno == ENFILE) and open_jobs > 0) {
+                    out_of_fds = true;
+                    break;
+                }
+                if (job.fds[which] < 0 or ::fstat(job.fds[which], &info) != 0) {
+                    job.error = "unable to read " + paths[which];
+                    break;
+                }
+                sizes[which] = static_cast<size_t>(info.st_size);
+            }
+            if (out_of_fds) {
+                //Some other part of the process holds descriptors too, open no more than now until some get closed.
+                close_files(job);
+                max_open = open_jobs;
+                break;
+            }
+            job.started = std::chrono::steady_clock::now();
+            job.size = sizes[0] + sizes[1];
+            if (job.error.empty()) {
+                job.signature_size = sizes[1];
+                for (size_t offset=0; offset < sizes[1]; offset += chunk_size) {
+                    requests.push_back({next_open, 1, 0, offset, std::min(chunk_size, sizes[1] - offset)});
+                    job.signature_pending++;
+                }
+                size_t chunk_count = (sizes[0] + chunk_size - 1) / chunk_size;
+                job.chunks.resize(chunk_count);
+                job.ready.resize(chunk_count, false);
+                for (size_t chunk=0; chunk < chunk_count; chunk++) {
+                    requests.push_back({next_open, 0, chunk, chunk * chunk_size, std::min(chunk_size, sizes[0] - chunk * chunk_size)});
+                }
+                job.pending = job.signature_pending + chunk_count;
+            }
+            if (job.pending == 0) {
+                finish_read(next_open);
+            }
+            else {
+                open_jobs++;
+            }
+            next_open++;
+            progress = true;
+        }
+        //Keep the reader filled up, signatures and message chunks getting their buffer while memory allows. Requests
+        //are queued in file order, so whatever holds memory only waits for reads already submitted.
+        while (not requests.empty() and not reader.full()) {
+            read_request request = requests.front();
+            audit_job &job = jobs[request.job];
+            std::string &target = request.which == 1 ? job.signature_content : job.chunks[request.chunk];
+            if (target.empty()) {
+                size_t length = request.which == 1 ? job.signature_size : request.length;
+                std::lock_guard<std::mutex> lock(state_mutex);
+                if (in_memory > 0 and in_memory + length > max_in_memory) {
+                    break;
+                }
+                in_memory += length;
+                target.resize(length);
+            }
+            char *buffer = target.data() + (request.offset - (request.which == 1 ? 0 : request.chunk * chunk_size));
+            requests.pop_front();
+            uint64_t tag = submitted.size();
+            if (not free_tags.empty()) {
+                tag = free_tags.back();
+                free_tags.pop_back();
+                submitted[tag] = request;
+            }
+            else {
+                submitted.push_back(request);
+            }
+            reader.submit(job.fds[request.which], buffer, request.length, request.offset, tag);
+            progress = true;
+        }
+        //Handle completed reads, re-queueing the remainder of short reads.
+        if (reader.outstanding() > 0) {
+            for (auto &completion : reader.reap()) {
+                read_request request = submitted[completion.first];
+                free_tags.push_back(completion.first);
+                audit_job &job = jobs[request.job];
+                if (completion.second <= 0) {
+                    if (job.error.empty()) {
+                        job.error = "read error on " + job.path;
+                    }
+                }
+                else if (static_cast<size_t>(completion.second) < request.length) {
+                    auto done = static_cast<size_t>(completion.second);
+                    bytes += done;
+                    requests.push_front({request.job, request.which, request.chunk, request.offset + done, request.length - done});
+                    continue;
+                }
+                else {
+                    bytes += request.length;
+                }
+                if (request.which == 1) {
+                    if (--job.signature_pending == 0 and job.fds[1] >= 0) {
+                        ::close(job.fds[1]);
+                        job.fds[1] = -1;
+                    }
+                }
+                else {
+                    std::lock_guard<std::mutex> lock(state_mutex);
+                    job.ready[request.chunk] = true;
+                    schedule(request.job);
+                }
+                if (--job.pending == 0) {
+                    finish_read(request.job);
+                    open_jobs--;
+                }
+            }
+            progress = true;
+        }
+        //Expand signatures in file order as soon as they are read, and let the workers start hashing.
+        while (next_dispatch < next_open and jobs[next_dispatch].signature_pending == 0) {
+            audit_job &job = jobs[next_dispatch];
+            if (job.error.empty()) {
+                try {
+                    job.parts = deserialize(job.signature_content).second;
+                    expand.expand(job.parts);
+                    //Nothing known but the public key, every level gets validated unless the cache has it.
+                    job.last_known.assign(spqtool::levels - 1, "");
+                    job.last_known.push_back(pubkey);
+                    //Messages are hashed with the salt of the bottom-level key.
+                    job.hasher.reset(new spqsigs::message_hasher<spqtool::hashlen>(job.parts.first.substr(spqtool::hashlen, spqtool::hashlen)));
+                }
+                catch (const std::exception &e) {
+                    job.error = e.what();
+                }
+            }
+            std::lock_guard<std::mutex> lock(state_mutex);
+            in_memory -= job.signature_content.size();
+            job.signature_content = std::string();
+            job.expanded = true;
+            schedule(next_dispatch);
+            next_dispatch++;
+            progress = true;
+        }
+        //Nothing to read and no room for more, wait for the workers to hash some chunks.
+        if (not progress) {
+            std::unique_lock<std::mutex> lock(state_mutex);
+            size_t before = in_memory;
+            room.wait(lock, [&]() { return in_memory < before; });
+        }
+    }
+    queue.close();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    double seconds = spqtool::seconds_since(start);
+    int failed = 0;
+    for (auto &job : jobs) {
+        double job_seconds = job.read_seconds + job.verify_seconds;
+        std::cout << job.path << ": " << job.result << " (" << job.size << " bytes, read " << job.read_seconds * 1000
+                  << " ms, verify " << job.verify_seconds * 1000 << " ms, "
+                  << (job_seconds > 0 ? static_cast<double>(job.size) / job_seconds / 1048576 : 0) << " MiB/s)" << std::endl;
+        if (job.result != "OK") {
+            failed++;
+        }
+    }
+    spqtool::report("Audited", jobs.size(), bytes, seconds);
+    return failed == 0 ? 0 : 1;
+}
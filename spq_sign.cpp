@@ -0,0 +1,101 @@
+// spq-sign: sign files with detached signatures.
+//
+// usage: spq-sign [-j threads] <keyfile> <file>...
+//
+// The keyfile holds the private key and the index of the next signature, and gets created when it doesn't exist yet.
+// Next to it, <keyfile>.pub holds the public key and <keyfile>.ckpt a keygen checkpoint that keeps restarts cheap.
+// Every file gets a <file>.spqsig detached signature. Files are memory mapped and hashed on a pool of threads, the
+// signing itself is sequential as the key is stateful.
+#include "spq_tool.hpp"
+
+int main(int argc, char **argv) {
+    unsigned int threads;
+    int first = spqtool::parse_threads(argc, argv, threads);
+    if (argc - first < 2) {
+        std::cerr << "usage: spq-sign [-j threads] <keyfile> <file>..." << std::endl;
+        return 2;
+    }
+    std::string keyfile(argv[first]);
+    std::vector<std::string> files(argv + first + 1, argv + argc);
+    //Load or create the private key and signing state.
+    std::string private_key;
+    uint64_t next_index = 0;
+    if (spqtool::file_exists(keyfile)) {
+        std::string state = spqtool::read_file(keyfile);
+        if (state.size() != crypto_kdf_KEYBYTES + spqsigs::non_api::signature_index_bytes) {
+            std::cerr << "Corrupt key file " << keyfile << std::endl;
+            return 2;
+        }
+        private_key = state.substr(0, crypto_kdf_KEYBYTES);
+        next_index = spqsigs::non_api::decode_signature_index(state.c_str() + crypto_kdf_KEYBYTES);
+    }
+    else {
+        private_key = spqtool::signing_key::new_private_key();
+    }
+    auto save_state = [&private_key, &keyfile](uint64_t index) {
+        spqtool::write_file(keyfile, private_key + spqsigs::non_api::encode_signature_index(index));
+    };
+    save_state(next_index);
+    std::string checkpoint_file = keyfile + ".ckpt";
+    std::string saved_checkpoint;
+    if (spqtool::file_exists(checkpoint_file)) {
+        saved_checkpoint = spqtool::read_file(checkpoint_file);
+    }
+    auto start = std::chrono::steady_clock::now();
+    spqsigs::keygen_checkpoint<spqtool::hashlen> checkpoint([&checkpoint_file](const std::string &serialized, bool append) {
+        if (append) {
+            spqtool::append_file(checkpoint_file, serialized);
+        }
+        else {
+            spqtool::write_file(checkpoint_file, serialized);
+        }
+    }, spqtool::merkleheight, saved_checkpoint);
+    spqtool::signing_key key(private_key, false, next_index, checkpoint);
+    std::string pubkey = key.public_key();
+    spqtool::write_file(keyfile + ".pub", pubkey);
+    std::cerr << "Key restored at signature " << next_index << " in " << spqtool::seconds_since(start) << " s" << std::endl;
+    //Sign in rounds, one round per bottom-level key, as all digests in a round need that key's salt.
+    start = std::chrono::steady_clock::now();
+    size_t done = 0;
+    size_t bytes = 0;
+    int failed = 0;
+    double hashing = 0;
+    while (done < files.size()) {
+        auto hasher = key.hasher();
+        uint64_t round_size = std::min<uint64_t>(spqtool::bottom_capacity - key.get_next_index() % spqtool::bottom_capacity,
+                                                 files.size() - done);
+        //Reserve the signature indices before using any of them.
+        save_state(key.get_next_index() + round_size);
+        std::vector<std::string> digests(round_size);
+        std::vector<size_t> sizes(round_size, 0);
+        auto hash_start = std::chrono::steady_clock::now();
+        spqtool::parallel_for(round_size, threads, [&](size_t index) {
+            try {
+                spqsigs::non_api::mapped_file input(files[done + index]);
+                auto file_hasher = hasher;
+                digests[index] = file_hasher.update(input.view()).finish();
+                sizes[index] = input.size();
+            }
+            catch (const std::exception &) {
+                digests[index] = "";
+            }
+        });
+        hashing += spqtool::seconds_since(hash_start);
+        for (size_t index=0; index < round_size; index++) {
+            const std::string &path = files[done + index];
+            if (digests[index] == "") {
+                std::cerr << path << ": unable to read" << std::endl;
+                failed++;
+                continue;
+            }
+            auto signature = key.sign_digest(digests[index]);
+            spqtool::write_file(path + spqtool::signature_extension, spqsigs::serialize(signature, pubkey));
+            bytes += sizes[index];
+        }
+        done += round_size;
+        save_state(key.get_next_index());
+    }
+    spqtool::report("Hashed", files.size() - static_cast<size_t>(failed), bytes, hashing);
+    spqtool::report("Signed", files.size() - static_cast<size_t>(failed), bytes, spqtool::seconds_since(start));
+    return failed == 0 ? 0 : 1;
+}
@@ -7,13 +7,30 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <tuple>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
 #include <stdexcept>
 #include <algorithm>
 #include <string_view>
+#include <array>
 #include <exception>
 #include <iomanip>
+#include <functional>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <utility>
+#include <type_traits>
 #include <sodium.h>
 #include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
 #include <exception>
 //TODO: Add documenting comments to multi tree part of this file.
 //FIXME: implement serialize for signing keys and multi tree signing keys
@@ -36,11 +53,37 @@ struct signingkey_exhausted : std::exception {
 struct insufficient_expand_state : std::exception {
     using std::exception::exception;
 };
-// declaration for signing_key class template defined at bottom of this file.
-template<uint8_t hashlen=24, uint8_t wotsbits=12, uint8_t merkleheight=10>
+struct hash_budget_exceeded : std::exception {
+    using std::exception::exception;
+};
+//One-time signature schemes, for the ots policy parameter of signing_key and signature. The multi-tree types take
+//theirs through their wotsbits parameter, see with_ots.
+//Every subkey signs its wotsbits with two chains running in opposite directions. The default.
+struct dual_chain {
+    static constexpr bool single_chain = false;
+};
+//WOTS+/LMS style, every subkey signs with a single forward chain, while a checksum block of extra subkeys keeps
+//anyone from running the chains of a signature further forward. Signature body and verification hashing halve.
+struct checksum_chain {
+    static constexpr bool single_chain = true;
+};
+//Hash backends, all computing the same BLAKE2b hashes at a different speed. Defined with the BLAKE2b code below.
+struct libsodium_backend;
+struct reference_backend;
+struct avx2_backend;
+struct avx512_backend;
+struct dispatched_backend;
+// declaration for signing_key class template defined at bottom of this file. The arity is the number of children of
+// every merkle tree node, merkleheight stays the number of signature index bits of the tree.
+template<uint8_t hashlen=24, uint8_t wotsbits=12, uint8_t merkleheight=10, typename ots=dual_chain, uint8_t arity=2,
+         typename backend=dispatched_backend>
 struct signing_key;
-template<uint8_t hashlen, uint8_t wotsbits, uint8_t merkleheight>
+template<uint8_t hashlen, uint8_t wotsbits, uint8_t merkleheight, typename ots=dual_chain, uint8_t arity=2,
+         typename backend=dispatched_backend>
 struct signature;
+// declaration for the out-of-core mapped_signing_key class template.
+template<uint8_t hashlen, uint8_t wotsbits, uint8_t merkleheight>
+struct mapped_signing_key;
 
 // Anything in the non_api sub namespace is not part of the public API of this single-file header-only library.
 namespace non_api {
@@ -48,11 +91,12 @@ namespace non_api {
 //generated salt.
 class GENERATE {};
 // declaration for private_keys class template
-template<uint8_t hashlen,  uint8_t merkleheight, uint8_t wotsbits, uint32_t pubkey_size>
+template<uint8_t hashlen,  uint8_t merkleheight, uint8_t wotsbits, uint32_t pubkey_size, typename ots=dual_chain,
+         typename backend=dispatched_backend>
 struct private_keys;
 
-//Master key
-template<uint8_t hashlen>
+//Master key, deriving its keys through the hash backend.
+template<uint8_t hashlen, typename backend=dispatched_backend>
 struct master_key {
           //Hash length must be 16 up to 64 bytes long.
           static_assert(hashlen > 15, "Hash size should be at least 128 bits (16 bytes).");
@@ -71,7 +115,7 @@ struct master_key {
           }
           std::string operator[](uint64_t index) {
               uint8_t output[hashlen];
-              crypto_kdf_derive_from_key(output, hashlen, index, "Signatur", m_master_key);
+              backend::template derive<hashlen>(m_master_key, index, "Signatur", output);
               return std::string(reinterpret_cast<const char *>(output), hashlen);
           }
       private:
@@ -91,49 +135,282 @@ uint16_t determine_subkeys_per_signature() {
       return (hashlen * 8 + wotsbits -1) / wotsbits;
 }
 
-//Determine (deep) the required key count at a given level and below.
-template<uint8_t hashlen, uint8_t wotsbits, uint8_t merkleheight, uint8_t ...Args>
+//constexpr-able function for determining the number of checksum subkeys a single-chain signature needs, enough
+//base 2^wotsbits digits for the largest possible checksum.
+constexpr int checksum_subkeys(size_t hashlen, size_t wotsbits) {
+      uint64_t max_checksum = static_cast<uint64_t>((hashlen * 8 + wotsbits -1) / wotsbits) * ((1u << wotsbits) - 1);
+      int bits = 0;
+      for (; max_checksum != 0; max_checksum >>= 1) {
+          bits++;
+      }
+      return static_cast<int>((bits + wotsbits - 1) / wotsbits);
+}
+template<uint8_t hashlen, uint8_t wotsbits>
+constexpr int determine_checksum_subkeys() {
+      return checksum_subkeys(hashlen, wotsbits);
+}
+
+//constexpr-able function for determining the number of subkeys of a one-time signing key.
+template<typename ots, uint8_t hashlen, uint8_t wotsbits>
+constexpr int determine_ots_subkeys() {
+      return (hashlen * 8 + wotsbits -1) / wotsbits + (ots::single_chain ? determine_checksum_subkeys<hashlen, wotsbits>() : 0);
+}
+
+//constexpr-able function for determining the number of chain values in a one-time signature.
+template<typename ots, uint8_t hashlen, uint8_t wotsbits>
+constexpr int determine_ots_chain_values() {
+      return ots::single_chain ? determine_ots_subkeys<ots, hashlen, wotsbits>() : 2 * ((hashlen * 8 + wotsbits -1) / wotsbits);
+}
+
+//constexpr-able function for determining the number of signature index bits that pick a child of a merkle tree node.
+template<uint8_t arity>
+constexpr uint8_t determine_arity_bits() {
+      uint8_t rval = 0;
+      while ((1u << rval) < arity) {
+          rval++;
+      }
+      return rval;
+}
+
+//constexpr-able function for determining the number of auth-path nodes in a signature, all siblings at every level.
+template<uint8_t merkleheight, uint8_t arity>
+constexpr size_t determine_auth_path_nodes() {
+      return (arity - 1) * (merkleheight / determine_arity_bits<arity>());
+}
+
+//The wotsbits parameter of the multi-tree templates is either a plain wotsbits value used at every level, or a
+//per-level specification made by wotsbits_per_level: this flag plus wotsbits-1 for every level, four bits each,
+//the top level in the lowest bits. Either can carry the flag made by with_ots for checksum_chain at every level.
+constexpr uint64_t wotsbits_per_level_flag = static_cast<uint64_t>(1) << 63;
+constexpr uint64_t checksum_chain_flag = static_cast<uint64_t>(1) << 62;
+constexpr uint64_t wotsbits_flags = wotsbits_per_level_flag | checksum_chain_flag;
+
+//Get the wotsbits of the top level of a wotsbits specification.
+constexpr uint8_t level_wotsbits(uint64_t wotsbits) {
+      return static_cast<uint8_t>((wotsbits & wotsbits_per_level_flag) != 0 ? (wotsbits & 15) + 1 : wotsbits);
+}
+
+//Get the wotsbits specification for the lower_levels levels below the top level. A single level gets a plain
+//wotsbits value without flags, so it matches the single-tree templates.
+constexpr uint64_t lower_wotsbits(uint64_t wotsbits, size_t lower_levels) {
+      uint64_t rval = wotsbits;
+      if ((wotsbits & wotsbits_per_level_flag) != 0) {
+          rval = ((wotsbits & ~wotsbits_flags) >> 4) | (wotsbits & wotsbits_flags);
+      }
+      return lower_levels == 1 ? level_wotsbits(rval) : rval;
+}
+
+//Get the wotsbits of the level depth levels below the top level.
+constexpr uint8_t level_wotsbits(uint64_t wotsbits, size_t depth) {
+      for (; depth > 0; depth--) {
+          wotsbits = lower_wotsbits(wotsbits, 2);
+      }
+      return level_wotsbits(wotsbits);
+}
+
+//Check a wotsbits specification fits a key of tree_count merkle trees. A plain wotsbits value fits any key, a
+//per-level specification must have exactly one entry per tree. Entries are never zero, as every level needs at
+//least four wotsbits, so the entries end at the first zero.
+constexpr bool wotsbits_levels_match(uint64_t wotsbits, size_t tree_count) {
+      if ((wotsbits & wotsbits_per_level_flag) == 0) {
+          return true;
+      }
+      size_t entries = 0;
+      for (uint64_t rest = wotsbits & ~wotsbits_flags; rest != 0; rest >>= 4) {
+          entries++;
+      }
+      return entries == tree_count;
+}
+
+//Get the ots policy of a wotsbits specification, the same at every level.
+template<uint64_t wotsbits>
+using level_ots = std::conditional_t<(wotsbits & checksum_chain_flag) != 0, checksum_chain, dual_chain>;
+}
+
+//Per-level wotsbits for the wotsbits parameter of the multi-tree templates, one value per merkle tree from the top
+//level down. For example spq_signing_key<24, wotsbits_per_level<16, 16, 6>(), 5, 5, 5> makes small signatures at
+//the rarely used upper levels and signs fast at the bottom.
+template<uint8_t ...levels>
+constexpr uint64_t wotsbits_per_level() {
+      static_assert(sizeof...(levels) < 16, "No more than 15 levels of per-level wotsbits are supported");
+      static_assert(((levels > 3 and levels < 17) and ...), "Every level needs wotsbits of 4 upto 16 bits");
+      uint64_t rval = non_api::wotsbits_per_level_flag;
+      unsigned int shift = 0;
+      for (uint8_t level : {levels...}) {
+          rval |= static_cast<uint64_t>(level - 1) << shift;
+          shift += 4;
+      }
+      return rval;
+}
+
+//One-time signature scheme for the wotsbits parameter of the multi-tree templates, used at every level, dual_chain
+//if not given. For example spq_signing_key<24, with_ots<checksum_chain>(wotsbits_per_level<16, 12>()), 5, 5> signs
+//with single chains plus checksum, halving signature bodies.
+template<typename ots>
+constexpr uint64_t with_ots(uint64_t wotsbits) {
+      return ots::single_chain ? wotsbits | non_api::checksum_chain_flag : wotsbits & ~non_api::checksum_chain_flag;
+}
+
+namespace non_api {
+
+//Determine (deep) the required key count at a given level and below. Independent of the ots policy, checksum_chain
+//one-time keys take the same key indices as dual_chain ones.
+template<uint8_t hashlen, uint64_t wotsbits, uint8_t merkleheight, uint8_t ...Args>
 struct determine_required_keycount {
           //Hash length must be 16 up to 64 bytes long.
           static_assert(hashlen > 15, "Hash size should be at least 128 bits (16 bytes).");
           static_assert(hashlen < 65,  "Hash size of more then 512 bits is not supported");
           //The number of bits used for wots encoding must be 3 upto 16 bits.
-          static_assert(wotsbits < 17, "Wots chains longer than 64k hash operations (wotsbits>16) are not supported");
-          static_assert(wotsbits > 3, "A wots chain should be at least 16 hash operations long (wotsbits > 1)");
+          static_assert(level_wotsbits(wotsbits) < 17, "Wots chains longer than 64k hash operations (wotsbits>16) are not supported");
+          static_assert(level_wotsbits(wotsbits) > 3, "A wots chain should be at least 16 hash operations long (wotsbits > 1)");
           //The height of a singe merkle-tree must be 3 up to 16 levels.
           static_assert(merkleheight < 17, "A single merkle tree should not be more than 16 levels high");
           static_assert(merkleheight > 2, "A single merkle tree should be at least two levels high. A value between 8 and 10 is recomended");
-          static_assert(39 * wotsbits >= hashlen * 8, "Wotsbits and hashlen must not combine into signing keys of more than 39 subkeys each");
+          static_assert(39 * level_wotsbits(wotsbits) >= hashlen * 8, "Wotsbits and hashlen must not combine into signing keys of more than 39 subkeys each");
           uint64_t operator()() {
-                  determine_required_keycount<hashlen, wotsbits, Args...> determine;
+                  determine_required_keycount<hashlen, lower_wotsbits(wotsbits, sizeof...(Args)), Args...> determine;
                   uint64_t rval = 1 +
                     (1<<merkleheight) *
-                    (2 * determine_subkeys_per_signature<hashlen, wotsbits>() + determine());
+                    (2 * determine_subkeys_per_signature<hashlen, level_wotsbits(wotsbits)>() + determine());
                   return rval;
           }
 };
 
 //Determine (shallow or at deepest level) the required key count at a given level
-template<uint8_t hashlen, uint8_t wotsbits, uint8_t merkleheight>
+template<uint8_t hashlen, uint64_t wotsbits, uint8_t merkleheight>
 struct determine_required_keycount<hashlen, wotsbits, merkleheight> {
           //Hash length must be 16 up to 64 bytes long.
           static_assert(hashlen > 15, "Hash size should be at least 128 bits (16 bytes).");
           static_assert(hashlen < 65,  "Hash size of more then 512 bits is not supported");
           //The number of bits used for wots encoding must be 3 upto 16 bits.
-          static_assert(wotsbits < 17, "Wots chains longer than 64k hash operations (wotsbits>16) are not supported");
-          static_assert(wotsbits > 3, "A wots chain should be at least 16 hash operations long (wotsbits > 1)");
-          //The height of a singe merkle-tree must be 3 up to 16 levels.
-          static_assert(merkleheight < 17, "A single merkle tree should not be more than 16 levels high");
+          static_assert(level_wotsbits(wotsbits) < 17, "Wots chains longer than 64k hash operations (wotsbits>16) are not supported");
+          static_assert(level_wotsbits(wotsbits) > 3, "A wots chain should be at least 16 hash operations long (wotsbits > 1)");
+          //The height of a singe merkle-tree must be 3 up to 32 levels, 16 when kept in memory.
+          static_assert(merkleheight < 33, "A single merkle tree should not be more than 32 levels high");
           static_assert(merkleheight > 2, "A single merkle tree should be at least two levels high. A value between 8 and 10 is recomended");
-          static_assert(39 * wotsbits >= hashlen * 8, "Wotsbits and hashlen must not combine into signing keys of more than 39 subkeys each");
+          static_assert(39 * level_wotsbits(wotsbits) >= hashlen * 8, "Wotsbits and hashlen must not combine into signing keys of more than 39 subkeys each");
           uint64_t operator()() {
               uint64_t rval = 1 +
-                  (1<<merkleheight) *
-                  2* determine_subkeys_per_signature<hashlen, wotsbits>();
+                  (static_cast<uint64_t>(1) << merkleheight) *
+                  2* determine_subkeys_per_signature<hashlen, level_wotsbits(wotsbits)>();
               return rval;
       }
 };
 
+//constexpr-able function for determining the number of signature-index bits used by a stack of merkle trees.
+template<uint8_t ...Args>
+constexpr uint32_t determine_signature_index_bits() {
+      return (0 + ... + static_cast<uint32_t>(Args));
+}
+
+//constexpr-able function for determining (deep) the required key count at a given level and below, saturating at
+//UINT64_MAX when the key index space of the stack would not fit in 64 bits.
+template<uint8_t hashlen, uint64_t wotsbits, uint8_t merkleheight, uint8_t ...Args>
+constexpr uint64_t determine_saturated_keycount() {
+      constexpr uint64_t max = UINT64_MAX;
+      constexpr uint64_t per_signature = 2 * ((hashlen * 8 + level_wotsbits(wotsbits) -1) / level_wotsbits(wotsbits));
+      uint64_t below = 0;
+      if constexpr (sizeof...(Args) > 0) {
+          below = determine_saturated_keycount<hashlen, lower_wotsbits(wotsbits, sizeof...(Args)), Args...>();
+      }
+      if (below > max - per_signature or (below + per_signature) > ((max - 1) >> merkleheight)) {
+          return max;
+      }
+      return 1 + ((below + per_signature) << merkleheight);
+}
+
+//Number of bytes used to encode the signature index within a signature.
+constexpr size_t signature_index_bytes = 8;
+
+//constexpr-able function for determining the length of a single-tree signature.
+template<uint8_t hashlen, uint8_t wotsbits, uint8_t merkleheight, typename ots=dual_chain>
+constexpr size_t signature_length() {
+      return signature_index_bytes + hashlen * (2 + merkleheight + determine_ots_chain_values<ots, hashlen, wotsbits>());
+}
+
+//constexpr-able function for determining the signature length of every tree of a stack, from the top down.
+template<uint8_t hashlen, uint64_t wotsbits, uint8_t ...heights>
+constexpr std::array<size_t, sizeof...(heights)> signature_lengths() {
+      std::array<size_t, sizeof...(heights)> rval{};
+      size_t level = 0;
+      for (uint8_t merkleheight : {heights...}) {
+          size_t bits = level_wotsbits(wotsbits, level);
+          size_t digest_subkeys = (hashlen * 8 + bits -1) / bits;
+          size_t chain_values = level_ots<wotsbits>::single_chain ? digest_subkeys + checksum_subkeys(hashlen, bits) : 2 * digest_subkeys;
+          rval[level] = signature_index_bytes + hashlen * (2 + merkleheight + chain_values);
+          level++;
+      }
+      return rval;
+}
+
+//A message signature with known fields omitted starts with a header: the signature index with its top bit set if
+//the pubkey and salt are omitted, followed by a network order 16 bit mask of the omitted auth-path nodes.
+constexpr size_t omitted_header_bytes = signature_index_bytes + 2;
+
+//Get the length of a message signature with known fields omitted from its header.
+template<uint8_t hashlen, uint8_t wotsbits, uint8_t merkleheight, typename ots=dual_chain>
+size_t omitted_signature_length(std::string_view in) {
+      if (in.size() < omitted_header_bytes) {
+          throw std::invalid_argument("Wrong signature size (*4).");
+      }
+      const unsigned char *data = reinterpret_cast<const unsigned char *>(in.data());
+      unsigned int mask = (static_cast<unsigned int>(data[signature_index_bytes]) << 8) + data[signature_index_bytes + 1];
+      if ((mask >> merkleheight) != 0) {
+          throw std::invalid_argument("Omitted auth-path node out of range.");
+      }
+      size_t omitted = 0;
+      for (; mask != 0; mask >>= 1) {
+          omitted += mask & 1;
+      }
+      size_t known_tree = (data[0] & 0x80) != 0 ? 2 * hashlen : 0;
+      return signature_length<hashlen, wotsbits, merkleheight, ots>() + 2 - known_tree - omitted * hashlen;
+}
+
+//Encode a signature index as network order bytes.
+inline std::string encode_signature_index(uint64_t index) {
+      std::string rval(signature_index_bytes, '\0');
+      for (size_t pos=signature_index_bytes; pos > 0; pos--) {
+          rval[pos - 1] = static_cast<char>(index & 255);
+          index >>= 8;
+      }
+      return rval;
+}
+
+//Decode a network order signature index.
+inline uint64_t decode_signature_index(const char *encoded) {
+      const unsigned char *data = reinterpret_cast<const unsigned char *>(encoded);
+      uint64_t rval = 0;
+      for (size_t pos=0; pos < signature_index_bytes; pos++) {
+          rval = (rval << 8) + data[pos];
+      }
+      return rval;
+}
+
+//Get the index of the child key at a given level for a global signature index. The Args are the merkle heights
+//of the levels below. Throws when the signature index falls outside of the capacity of the key.
+template<uint8_t merkleheight, uint8_t ...Args>
+uint64_t determine_child_index(uint64_t signature_index) {
+      constexpr uint32_t below = determine_signature_index_bits<Args...>();
+      uint64_t rval = 0;
+      if constexpr (below < 64) {
+          rval = signature_index >> below;
+      }
+      if (rval >= (static_cast<uint64_t>(1) << merkleheight)) {
+          throw signingkey_exhausted();
+      }
+      return rval;
+}
+
+//Get the signature index within the child key at a given level for a global signature index. The Args are the
+//merkle heights of the levels below.
+template<uint8_t ...Args>
+uint64_t determine_index_within_child(uint64_t signature_index) {
+      constexpr uint32_t below = determine_signature_index_bits<Args...>();
+      if constexpr (below < 64) {
+          return signature_index & ((static_cast<uint64_t>(1) << below) - 1);
+      }
+      return signature_index;
+}
 
 //Get the proper index and/or high-entropy subkey data for one or both of the subkey WOTS chains
 template<uint8_t hashlen>
@@ -192,18 +469,18 @@ struct wots_index_generator {
 };
 
 // Get the index for a level key.
-template<uint8_t hashlen, uint8_t wotsbits, uint8_t merkleheight, uint8_t ...Args>
+template<uint8_t hashlen, uint64_t wotsbits, uint8_t merkleheight, uint8_t ...Args>
 struct unique_index_generator {
           //Hash length must be 16 up to 64 bytes long.
           static_assert(hashlen > 15, "Hash size should be at least 128 bits (16 bytes).");
           static_assert(hashlen < 65,  "Hash size of more then 512 bits is not supported");
           //The number of bits used for wots encoding must be 3 upto 16 bits.
-          static_assert(wotsbits < 17, "Wots chains longer than 64k hash operations (wotsbits>16) are not supported");
-          static_assert(wotsbits > 3, "A wots chain should be at least 16 hash operations long (wotsbits > 1)");
+          static_assert(level_wotsbits(wotsbits) < 17, "Wots chains longer than 64k hash operations (wotsbits>16) are not supported");
+          static_assert(level_wotsbits(wotsbits) > 3, "A wots chain should be at least 16 hash operations long (wotsbits > 1)");
           //The height of a singe merkle-tree must be 3 up to 16 levels.
           static_assert(merkleheight < 17, "A single merkle tree should not be more than 16 levels high");
           static_assert(merkleheight > 2, "A single merkle tree should be at least two levels high. A value between 8 and 10 is recomended");
-          static_assert(39 * wotsbits >= hashlen * 8, "Wotsbits and hashlen must not combine into signing keys of more than 39 subkeys each");
+          static_assert(39 * level_wotsbits(wotsbits) >= hashlen * 8, "Wotsbits and hashlen must not combine into signing keys of more than 39 subkeys each");
           unique_index_generator(master_key<hashlen> &mkey, uint64_t own=0):
                   m_master_key(mkey),
                   m_own(own),
@@ -213,6 +490,7 @@ struct unique_index_generator {
                   m_generate(
                       own + m_determine()
                   ) {}
+          unique_index_generator(const unique_index_generator&) = default;
           virtual ~unique_index_generator() {}
 	  unique_index_generator& operator=(const unique_index_generator& other) {
               m_master_key=other.m_master_key;
@@ -221,58 +499,59 @@ struct unique_index_generator {
               m_generate = other.m_generate;
 	      return *this;
 	  }
-          unique_index_generator<hashlen, wotsbits, Args...> operator()(uint64_t index){
+          unique_index_generator<hashlen, lower_wotsbits(wotsbits, sizeof...(Args)), Args...> operator()(uint64_t index){
               if (index >= (1<<merkleheight)) {
                   throw std::out_of_range("invalid index for key structure");
               }
-              return unique_index_generator<hashlen, wotsbits, Args...>(m_master_key, m_generate + index * m_determine2());
+              return unique_index_generator<hashlen, lower_wotsbits(wotsbits, sizeof...(Args)), Args...>(m_master_key, m_generate + index * m_determine2());
           }
-          uint64_t operator[](uint16_t index) {
+          uint64_t operator[](uint32_t index) {
               if (index >= (1<<merkleheight)) {
                   throw std::out_of_range("invalid index for key structure");
               }
-              return m_own + 1 + index * 2* determine_subkeys_per_signature<hashlen, wotsbits>();
+              return m_own + 1 + index * 2* determine_subkeys_per_signature<hashlen, level_wotsbits(wotsbits)>();
           }
           operator uint64_t(){ return m_own;}
           operator std::string(){ return m_master_key[m_own]; }
-	  unique_index_generator<hashlen, wotsbits, merkleheight> cast() {
+	  unique_index_generator<hashlen, level_wotsbits(wotsbits), merkleheight> cast() {
               return m_cast;
 	  }
       private:
           master_key<hashlen> &m_master_key;
           uint64_t m_own;
-	  unique_index_generator<hashlen, wotsbits, merkleheight> m_cast;
-          determine_required_keycount<hashlen, wotsbits, merkleheight> m_determine;
-          determine_required_keycount<hashlen, wotsbits, Args...> m_determine2;
+	  unique_index_generator<hashlen, level_wotsbits(wotsbits), merkleheight> m_cast;
+          determine_required_keycount<hashlen, level_wotsbits(wotsbits), merkleheight> m_determine;
+          determine_required_keycount<hashlen, lower_wotsbits(wotsbits, sizeof...(Args)), Args...> m_determine2;
           uint64_t m_generate;
 };
 
-template<uint8_t hashlen, uint8_t wotsbits, uint8_t merkleheight>
+template<uint8_t hashlen, uint64_t wotsbits, uint8_t merkleheight>
 struct unique_index_generator<hashlen, wotsbits, merkleheight> {
           //Hash length must be 16 up to 64 bytes long.
           static_assert(hashlen > 15, "Hash size should be at least 128 bits (16 bytes).");
           static_assert(hashlen < 65,  "Hash size of more then 512 bits is not supported");
           //The number of bits used for wots encoding must be 3 upto 16 bits.
-          static_assert(wotsbits < 17, "Wots chains longer than 64k hash operations (wotsbits>16) are not supported");
-          static_assert(wotsbits > 3, "A wots chain should be at least 16 hash operations long (wotsbits > 1)");
-          //The height of a singe merkle-tree must be 3 up to 16 levels.
-          static_assert(merkleheight < 17, "A single merkle tree should not be more than 16 levels high");
+          static_assert(level_wotsbits(wotsbits) < 17, "Wots chains longer than 64k hash operations (wotsbits>16) are not supported");
+          static_assert(level_wotsbits(wotsbits) > 3, "A wots chain should be at least 16 hash operations long (wotsbits > 1)");
+          //The height of a singe merkle-tree must be 3 up to 32 levels, 16 when kept in memory.
+          static_assert(merkleheight < 33, "A single merkle tree should not be more than 32 levels high");
           static_assert(merkleheight > 2, "A single merkle tree should be at least two levels high. A value between 8 and 10 is recomended");
-          static_assert(39 * wotsbits >= hashlen * 8, "Wotsbits and hashlen must not combine into signing keys of more than 39 subkeys each");
+          static_assert(39 * level_wotsbits(wotsbits) >= hashlen * 8, "Wotsbits and hashlen must not combine into signing keys of more than 39 subkeys each");
           unique_index_generator(master_key<hashlen> &mkey, uint64_t own):
               m_master_key(mkey),
               m_own(own) {}
+          unique_index_generator(const unique_index_generator&) = default;
           virtual ~unique_index_generator() {}
 	  unique_index_generator& operator=(const unique_index_generator& other) {
               m_master_key=other.m_master_key;
               m_own = other.m_own;
 	      return *this;
           }
-          wots_index_generator<hashlen, wotsbits> operator[](uint16_t index) {
-              if (index >= (1<<merkleheight)) {
+          wots_index_generator<hashlen, level_wotsbits(wotsbits)> operator[](uint32_t index) {
+              if (index >= (static_cast<uint64_t>(1) << merkleheight)) {
                   throw std::out_of_range("invalid index for key structure");
               }
-              return wots_index_generator<hashlen, wotsbits>(m_own + 1 + index * 2 * determine_subkeys_per_signature<hashlen, wotsbits>(), m_master_key);
+              return wots_index_generator<hashlen, level_wotsbits(wotsbits)>(m_own + 1 + static_cast<uint64_t>(index) * 2 * determine_subkeys_per_signature<hashlen, level_wotsbits(wotsbits)>(), m_master_key);
           }
           operator uint64_t(){ return m_own;}
           operator std::string(){ return m_master_key[m_own]; }
@@ -342,164 +621,916 @@ std::vector<uint32_t> digest_to_numlist(std::string &msg_digest)
     return rval;
 }
 
-//Helper function for turning a small number into a vector of booleans (bits).
-template<uint8_t merkleheight>
-std::vector<bool> as_bits(uint32_t signing_key_index)
+//Append the checksum a single-chain signature signs along with the digest: the sum of the chain steps still left
+//after every digest chunk, as big endian base 2^wotsbits digits. Running any chain further forward lowers it.
+template<uint8_t hashlen, uint8_t wotsbits>
+void append_checksum(std::vector<uint32_t> &numlist)
 {
-    //The height of a singe merkle-tree must be 3 up to 16 levels.
-    static_assert(merkleheight < 17, "A single merkle tree should not be more than 16 levels high");
-    static_assert(merkleheight > 2, "A single merkle tree should be at least two levels high. A value between 8 and 10 is recomended");
-    std::vector<bool> rval;
-    //Go from left (higher index value) to right (zero).
-    for (uint8_t index=merkleheight; index>0; index--) {
-        //Convert one bit into a boolean.
-        bool val = (((signing_key_index >> (index - 1)) & 1) == 1);
-        //Add boolena to return vector.
-        rval.push_back(val);
+    uint64_t checksum = 0;
+    for (auto num : numlist) {
+        checksum += (1u << wotsbits) - 1 - num;
+    }
+    for (int digit = determine_checksum_subkeys<hashlen, wotsbits>(); digit > 0; digit--) {
+        numlist.push_back(static_cast<uint32_t>((checksum >> ((digit - 1) * wotsbits)) & ((1u << wotsbits) - 1)));
     }
-    return rval;
 }
 
-// Hashing primative for 'hashlen' long digests, with a little extra. The hashing primative runs using libsodium.
-template<uint8_t hashlen, uint8_t wotsbits, uint8_t merkleheight>
-struct primative {
-    //Hash length must be 16 up to 64 bytes long.
-    static_assert(hashlen > 15, "Hash size should be at least 128 bits (16 bytes).");
-    static_assert(hashlen < 65,  "Hash size of more then 512 bits is not supported");
-    //The number of bits used for wots encoding must be 3 upto 16 bits.
-    static_assert(wotsbits < 17, "Wots chains longer than 64k hash operations (wotsbits>16) are not supported");
-    static_assert(wotsbits > 3, "A wots chain should be at least 16 hash operations long (wotsbits > 1)");
-    //The height of a singe merkle-tree must be 3 up to 16 levels.
-    static_assert(merkleheight < 17, "A single merkle tree should not be more than 16 levels high");
-    static_assert(merkleheight > 2, "A single merkle tree should be at least two levels high. A value between 8 and 10 is recomended");
-    static_assert(39 * wotsbits >= hashlen * 8, "Wotsbits and hashlen must not combine into signing keys of more than 39 subkeys each");
-    // Virtual distructor
-    virtual ~primative() {}
-    //Hash the input with the salt and return the digest.
-    std::string operator()(std::string &input)
-    {
-        unsigned char output[hashlen];
-        crypto_generichash_blake2b(output,
-                                   hashlen,
-                                   reinterpret_cast<const unsigned char *>(input.c_str()),
-                                   input.length(),
-                                   reinterpret_cast<const unsigned char *>(m_salt.c_str()),
-                                   hashlen);
-        return std::string(reinterpret_cast<const char *>(output), hashlen);
-    };
-    //Hash the input with the salt 'times' times. This is used for wots chains.
-    std::string operator()(std::string &input, size_t times)
-    {
-        unsigned char output[hashlen];
-        std::memcpy(output, input.c_str(), hashlen);
-        crypto_generichash_blake2b_state state;
-        for (uint32_t index=0; index < times; index++) {
-            crypto_generichash_blake2b_init(&state,
-                                            reinterpret_cast<const unsigned char *>(m_salt.c_str()),
-                                            hashlen,
-                                            hashlen);
-            crypto_generichash_blake2b_update(&state, output, hashlen);
-            crypto_generichash_blake2b_final(&state, output, hashlen);
-        }
-        auto rval = std::string(reinterpret_cast<const char *>(output), hashlen);
-        return rval;
-    };
-    //Hash two inputs with salts and return the digest.
-    std::string operator()(std::string &input, std::string &input2)
-    {
-        unsigned char output[hashlen];
-        crypto_generichash_blake2b_state state;
-        crypto_generichash_blake2b_init(&state,
-                                        reinterpret_cast<const unsigned char *>(m_salt.c_str()),
-                                        hashlen,
-                                        hashlen);
-        crypto_generichash_blake2b_update(&state,
-                                          reinterpret_cast<const unsigned char *>(input.c_str()),
-                                          hashlen);
-        crypto_generichash_blake2b_update(&state,
-                                          reinterpret_cast<const unsigned char *>(input2.c_str()),
-                                          hashlen);
-        crypto_generichash_blake2b_final(&state, output, hashlen);
-        return std::string(reinterpret_cast<const char *>(output), hashlen);
-    };
-    //Convert the seed, together with the index of the full-message-signing-key, the sub-index
-    // of the wotsbits chunk of bits to sign, and the bit indicating the left or right wots chain
-    // for these indices, into the secret key for signing wotsbits bits with.
-    //std::string seed_to_secret(std::string &seed, uint64_t master_index)
-    //{
-        //unsigned char unsalted[hashlen];
-        //unsigned char output[hashlen];
-        //std::string sidec = (side) ? "R" : "L";
-        //std::string designator=std::to_string(index) + sidec + std::to_string(subindex);
-        //crypto_generichash_blake2b(unsalted,
-        //                           hashlen,
-        //                           reinterpret_cast<const unsigned char *>(designator.c_str()),
-        //                           designator.length(),
-        //                           reinterpret_cast<const unsigned char *>(seed.c_str()),
-        //                           hashlen);
-        //crypto_generichash_blake2b(output,
-        //                           hashlen,
-        //                           unsalted,
-        //                           hashlen,
-        //                           reinterpret_cast<const unsigned char *>(m_salt.c_str()),
-        //                           hashlen);
-        //return std::string(reinterpret_cast<const char *>(output), hashlen);
-	//FIXME: use libsodium key derivation.
-//	auto ind = master_index;
-//	ind++;
-//	return seed;
-  //  };
-    //Retreive the salt for serialization purposes and later usage.
-    std::string get_salt()
-    {
-        return m_salt;
+//BLAKE2b initialization vector and message schedule.
+constexpr uint64_t blake2b_iv[8] = {
+    0x6a09e667f3bcc908ull, 0xbb67ae8584caa73bull, 0x3c6ef372fe94f82bull, 0xa54ff53a5f1d36f1ull,
+    0x510e527fade682d1ull, 0x9b05688c2b3e6c1full, 0x1f83d9abfb41bd6bull, 0x5be0cd19137e2179ull
+};
+constexpr uint8_t blake2b_sigma[12][16] = {
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3},
+    {11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4},
+    { 7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8},
+    { 9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13},
+    { 2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9},
+    {12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11},
+    {13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10},
+    { 6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5},
+    {10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0},
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3}
+};
+
+//The BLAKE2b G function on every lane. State words are stored lane-minor, so each step is one loop over the lanes
+//that the compiler can turn into vector instructions.
+template<size_t lanes>
+inline void blake2b_g(uint64_t (&v)[16][lanes], size_t a, size_t b, size_t c, size_t d,
+                      const uint64_t (&x)[lanes], const uint64_t (&y)[lanes])
+{
+    for (size_t lane=0; lane < lanes; lane++) {
+        v[a][lane] += v[b][lane] + x[lane];
+        v[d][lane] ^= v[a][lane];
+        v[d][lane] = (v[d][lane] >> 32) | (v[d][lane] << 32);
+        v[c][lane] += v[d][lane];
+        v[b][lane] ^= v[c][lane];
+        v[b][lane] = (v[b][lane] >> 24) | (v[b][lane] << 40);
+        v[a][lane] += v[b][lane] + y[lane];
+        v[d][lane] ^= v[a][lane];
+        v[d][lane] = (v[d][lane] >> 16) | (v[d][lane] << 48);
+        v[c][lane] += v[d][lane];
+        v[b][lane] ^= v[c][lane];
+        v[b][lane] = (v[b][lane] >> 63) | (v[b][lane] << 1);
     }
-    void refresh(std::string &salt)
+}
+
+//The BLAKE2b compression function on every lane, for a block of byte offset t that is the last block or not.
+template<size_t lanes>
+inline void blake2b_compress(uint64_t (&h)[8][lanes], const uint64_t (&m)[16][lanes], uint64_t t, bool last)
+{
+    uint64_t v[16][lanes];
+    for (size_t word=0; word < 8; word++) {
+        for (size_t lane=0; lane < lanes; lane++) {
+            v[word][lane] = h[word][lane];
+            v[word + 8][lane] = blake2b_iv[word];
+        }
+    }
+    for (size_t lane=0; lane < lanes; lane++) {
+        v[12][lane] ^= t;
+        v[14][lane] ^= last ? ~static_cast<uint64_t>(0) : 0;
+    }
+    for (size_t round=0; round < 12; round++) {
+        const uint8_t *sigma = blake2b_sigma[round];
+        blake2b_g<lanes>(v, 0, 4, 8, 12, m[sigma[0]], m[sigma[1]]);
+        blake2b_g<lanes>(v, 1, 5, 9, 13, m[sigma[2]], m[sigma[3]]);
+        blake2b_g<lanes>(v, 2, 6, 10, 14, m[sigma[4]], m[sigma[5]]);
+        blake2b_g<lanes>(v, 3, 7, 11, 15, m[sigma[6]], m[sigma[7]]);
+        blake2b_g<lanes>(v, 0, 5, 10, 15, m[sigma[8]], m[sigma[9]]);
+        blake2b_g<lanes>(v, 1, 6, 11, 12, m[sigma[10]], m[sigma[11]]);
+        blake2b_g<lanes>(v, 2, 7, 8, 13, m[sigma[12]], m[sigma[13]]);
+        blake2b_g<lanes>(v, 3, 4, 9, 14, m[sigma[14]], m[sigma[15]]);
+    }
+    for (size_t word=0; word < 8; word++) {
+        for (size_t lane=0; lane < lanes; lane++) {
+            h[word][lane] ^= v[word][lane] ^ v[word + 8][lane];
+        }
+    }
+}
+
+//Load up to 128 bytes as a zero padded, little endian, message block.
+template<size_t lanes>
+inline void blake2b_load_block(uint64_t (&m)[16][lanes], size_t lane, const unsigned char *in, size_t length)
+{
+    for (size_t word=0; word < 16; word++) {
+        m[word][lane] = 0;
+    }
+    for (size_t index=0; index < length; index++) {
+        m[index / 8][lane] |= static_cast<uint64_t>(in[index]) << (8 * (index % 8));
+    }
+}
+
+//The BLAKE2b state of a hashlen byte digest after compressing the key block, the same for every input hashed
+//with that key.
+template<uint8_t hashlen>
+void blake2b_keyed_state(const std::string &key, uint64_t (&keyed)[8])
+{
+    uint64_t h[8][1];
+    uint64_t m[16][1];
+    for (size_t word=0; word < 8; word++) {
+        h[word][0] = blake2b_iv[word];
+    }
+    h[0][0] ^= 0x01010000ull ^ (static_cast<uint64_t>(key.size()) << 8) ^ hashlen;
+    blake2b_load_block<1>(m, 0, reinterpret_cast<const unsigned char *>(key.data()), key.size());
+    blake2b_compress<1>(h, m, 128, false);
+    for (size_t word=0; word < 8; word++) {
+        keyed[word] = h[word][0];
+    }
+}
+
+//Keyed BLAKE2b of lanes inputs of exactly inlen bytes each, laid out back to back, starting from the keyed state.
+//Every lane gets its own hashlen byte digest in out, also back to back.
+template<uint8_t hashlen, size_t inlen, size_t lanes>
+void blake2b_keyed_lanes(const uint64_t (&keyed)[8], const unsigned char *in, unsigned char *out)
+{
+    static_assert(inlen > 0, "Fixed-size BLAKE2b input can not be empty");
+    uint64_t h[8][lanes];
+    uint64_t m[16][lanes];
+    for (size_t word=0; word < 8; word++) {
+        for (size_t lane=0; lane < lanes; lane++) {
+            h[word][lane] = keyed[word];
+        }
+    }
+    for (size_t offset=0; offset < inlen; offset += 128) {
+        size_t length = std::min(static_cast<size_t>(128), inlen - offset);
+        for (size_t lane=0; lane < lanes; lane++) {
+            blake2b_load_block<lanes>(m, lane, in + lane * inlen + offset, length);
+        }
+        blake2b_compress<lanes>(h, m, 128 + offset + length, offset + length == inlen);
+    }
+    for (size_t lane=0; lane < lanes; lane++) {
+        for (size_t index=0; index < hashlen; index++) {
+            out[lane * hashlen + index] = static_cast<unsigned char>(h[index / 8][lane] >> (8 * (index % 8)));
+        }
+    }
+}
+
+//Scalar BLAKE2b G function.
+inline void blake2b_g(uint64_t &a, uint64_t &b, uint64_t &c, uint64_t &d, uint64_t x, uint64_t y)
+{
+    a += b + x;
+    d ^= a;
+    d = (d >> 32) | (d << 32);
+    c += d;
+    b ^= c;
+    b = (b >> 24) | (b << 40);
+    a += b + y;
+    d ^= a;
+    d = (d >> 16) | (d << 48);
+    c += d;
+    b ^= c;
+    b = (b >> 63) | (b << 1);
+}
+
+//One scalar BLAKE2b round with its message schedule fixed at compile time, so message words known to be zero for
+//a fixed input size drop out.
+template<size_t round>
+inline void blake2b_round(uint64_t (&v)[16], const uint64_t (&m)[16])
+{
+    constexpr const uint8_t *sigma = blake2b_sigma[round];
+    blake2b_g(v[0], v[4], v[8], v[12], m[sigma[0]], m[sigma[1]]);
+    blake2b_g(v[1], v[5], v[9], v[13], m[sigma[2]], m[sigma[3]]);
+    blake2b_g(v[2], v[6], v[10], v[14], m[sigma[4]], m[sigma[5]]);
+    blake2b_g(v[3], v[7], v[11], v[15], m[sigma[6]], m[sigma[7]]);
+    blake2b_g(v[0], v[5], v[10], v[15], m[sigma[8]], m[sigma[9]]);
+    blake2b_g(v[1], v[6], v[11], v[12], m[sigma[10]], m[sigma[11]]);
+    blake2b_g(v[2], v[7], v[8], v[13], m[sigma[12]], m[sigma[13]]);
+    blake2b_g(v[3], v[4], v[9], v[14], m[sigma[14]], m[sigma[15]]);
+}
+
+template<size_t ...rounds>
+inline void blake2b_rounds(uint64_t (&v)[16], const uint64_t (&m)[16], std::index_sequence<rounds...>)
+{
+    (blake2b_round<rounds>(v, m), ...);
+}
+
+//Keyed BLAKE2b of an input of exactly inlen bytes, at most one block, already loaded as message words, starting
+//from the keyed state. The compression of the final block is all that is left, with its rounds fully unrolled.
+template<size_t inlen>
+inline void blake2b_fixed(const uint64_t (&keyed)[8], const uint64_t (&m)[16], uint64_t (&h)[8])
+{
+    static_assert(inlen > 0 and inlen <= 128, "Fixed-size scalar BLAKE2b takes a single block of input");
+    uint64_t v[16];
+    for (size_t word=0; word < 8; word++) {
+        v[word] = keyed[word];
+        v[word + 8] = blake2b_iv[word];
+    }
+    v[12] ^= 128 + inlen;
+    v[14] = ~v[14];
+    blake2b_rounds(v, m, std::make_index_sequence<12>());
+    for (size_t word=0; word < 8; word++) {
+        h[word] = keyed[word] ^ v[word] ^ v[word + 8];
+    }
+}
+
+//Run a hashlen byte value times through the keyed BLAKE2b, as a wots chain does. The value stays in message words
+//from one step to the next, as the digest words of a step are the message words of the next.
+template<uint8_t hashlen>
+void blake2b_chain(const uint64_t (&keyed)[8], unsigned char *value, size_t times)
+{
+    constexpr size_t words = (hashlen + 7) / 8;
+    constexpr uint64_t last_word_mask = hashlen % 8 == 0 ? ~static_cast<uint64_t>(0) :
+                                        (static_cast<uint64_t>(1) << (8 * (hashlen % 8))) - 1;
+    uint64_t m[16][1];
+    blake2b_load_block<1>(m, 0, value, hashlen);
+    uint64_t block[16];
+    for (size_t word=0; word < 16; word++) {
+        block[word] = m[word][0];
+    }
+    uint64_t h[8];
+    for (size_t step=0; step < times; step++) {
+        blake2b_fixed<hashlen>(keyed, block, h);
+        for (size_t word=0; word < words; word++) {
+            block[word] = h[word];
+        }
+        block[words - 1] &= last_word_mask;
+    }
+    for (size_t index=0; index < hashlen; index++) {
+        value[index] = static_cast<unsigned char>(block[index / 8] >> (8 * (index % 8)));
+    }
+}
+
+//Keyed BLAKE2b of two concatenated hashlen byte node hashes.
+template<uint8_t hashlen>
+void blake2b_node(const uint64_t (&keyed)[8], const unsigned char *left, const unsigned char *right, unsigned char *out)
+{
+    uint64_t block[16] = {};
+    for (size_t index=0; index < hashlen; index++) {
+        block[index / 8] |= static_cast<uint64_t>(left[index]) << (8 * (index % 8));
+        block[(hashlen + index) / 8] |= static_cast<uint64_t>(right[index]) << (8 * ((hashlen + index) % 8));
+    }
+    uint64_t h[8];
+    blake2b_fixed<2 * hashlen>(keyed, block, h);
+    for (size_t index=0; index < hashlen; index++) {
+        out[index] = static_cast<unsigned char>(h[index / 8] >> (8 * (index % 8)));
+    }
+}
+
+//A hash key, the salt of a signing key, together with the BLAKE2b state after its key block for the fixed-size
+//hashing code.
+template<uint8_t hashlen>
+struct hash_key {
+    hash_key(const std::string &key): salt(key), keyed()
     {
-        m_salt = salt;
+        blake2b_keyed_state<hashlen>(salt, keyed);
     }
-    friend signing_key<hashlen, wotsbits, merkleheight>;
-    friend signature<hashlen, wotsbits, merkleheight>;
-private:
-    // Standard constructor using an existing salt.
-    primative(std::string &salt): m_salt(salt) {}
-    //Alternative constructor. Generates a random salt.
-    //primative(GENERATE): m_salt(make_seed()) {}
-    std::string m_salt;
+    std::string salt;
+    uint64_t keyed[8];
 };
 
-//A private key is a collection of subkeys that together can create a one-time-signature for
-// a single transaction/message digest.
-template<uint8_t hashlen, int subkey_count, uint8_t wotsbits, uint8_t merkleheight, uint32_t pubkey_size>
-struct private_key {
-    //Hash length must be 16 up to 64 bytes long.
-    static_assert(hashlen > 15, "Hash size should be at least 128 bits (16 bytes).");
-    static_assert(hashlen < 65,  "Hash size of more then 512 bits is not supported");
-    //The number of bits used for wots encoding must be 3 upto 16 bits.
-    static_assert(wotsbits < 17, "Wots chains longer than 64k hash operations (wotsbits>16) are not supported");
-    static_assert(wotsbits > 3, "A wots chain should be at least 16 hash operations long (wotsbits > 1)");
-    //The height of a singe merkle-tree must be 3 up to 16 levels.
-    static_assert(merkleheight < 17, "A single merkle tree should not be more than 16 levels high");
-    static_assert(merkleheight > 2, "A single merkle tree should be at least two levels high. A value between 8 and 10 is recomended");
-    static_assert(39 * wotsbits >= hashlen * 8, "Wotsbits and hashlen must not combine into signing keys of more than 39 subkeys each");
-    // A tiny chunk of a one-time (wots) signing key, able to sign a chunk of 'wotsbits' bits with.
-    struct subkey {
-        //constructor, takes hashing primative, a seed, the one-time-signature index and the
-        // chunk sub-index and created the chunk private for both direction wots chains.
-        subkey(primative<hashlen, wotsbits, merkleheight> &hashprimative,
-               subkey_index_generator<hashlen> entropy,
-               size_t index,
-               size_t subindex,
-               std::string restore=""):
-            m_index(index),
-            m_subindex(subindex),
-            m_hashprimative(hashprimative),
-            m_private(), m_public(restore)
-        {
-	    for (bool side : { false, true }) {
-		std::string secret = entropy(side);
-                m_private.push_back(secret);
-            }
+//Plain scalar BLAKE2b of an input of any length, with an optional key and an optional 16 byte salt and
+//personalization, the full parameter block of crypto_generichash_blake2b_salt_personal.
+template<uint8_t outlen>
+void blake2b_reference(const unsigned char *key, size_t keylen,
+                       const unsigned char *salt, const unsigned char *personal,
+                       const unsigned char *in, size_t inlen, unsigned char *out)
+{
+    uint64_t h[8][1];
+    uint64_t m[16][1];
+    for (size_t word=0; word < 8; word++) {
+        h[word][0] = blake2b_iv[word];
+    }
+    h[0][0] ^= 0x01010000ull ^ (static_cast<uint64_t>(keylen) << 8) ^ outlen;
+    for (size_t index=0; index < 16; index++) {
+        if (salt != nullptr) {
+            h[4 + index / 8][0] ^= static_cast<uint64_t>(salt[index]) << (8 * (index % 8));
+        }
+        if (personal != nullptr) {
+            h[6 + index / 8][0] ^= static_cast<uint64_t>(personal[index]) << (8 * (index % 8));
+        }
+    }
+    uint64_t t = 0;
+    if (keylen > 0) {
+        blake2b_load_block<1>(m, 0, key, keylen);
+        t = 128;
+        blake2b_compress<1>(h, m, t, inlen == 0);
+    }
+    size_t offset = 0;
+    for (; inlen - offset > 128; offset += 128) {
+        blake2b_load_block<1>(m, 0, in + offset, 128);
+        t += 128;
+        blake2b_compress<1>(h, m, t, false);
+    }
+    if (inlen > 0 or keylen == 0) {
+        blake2b_load_block<1>(m, 0, in + offset, inlen - offset);
+        t += inlen - offset;
+        blake2b_compress<1>(h, m, t, true);
+    }
+    for (size_t index=0; index < outlen; index++) {
+        out[index] = static_cast<unsigned char>(h[index / 8][0] >> (8 * (index % 8)));
+    }
+}
+
+//The multi-lane kernels use GCC/clang vector extensions, compiled for AVX2 or AVX-512 per function, so a binary
+//built for plain x86-64 still carries them and picks them at runtime.
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SPQ_SIGS_VECTOR_KERNELS 1
+typedef uint64_t blake2b_u64x4 __attribute__((vector_size(32)));
+typedef uint64_t blake2b_u64x8 __attribute__((vector_size(64)));
+
+//BLAKE2b G function on a vector of lanes, one independent hash per lane.
+template<typename vec>
+__attribute__((always_inline)) inline void blake2b_vector_g(vec &a, vec &b, vec &c, vec &d, const vec &x, const vec &y)
+{
+    a += b + x;
+    d ^= a;
+    d = (d >> 32) | (d << 32);
+    c += d;
+    b ^= c;
+    b = (b >> 24) | (b << 40);
+    a += b + y;
+    d ^= a;
+    d = (d >> 16) | (d << 48);
+    c += d;
+    b ^= c;
+    b = (b >> 63) | (b << 1);
+}
+
+template<typename vec, size_t round>
+__attribute__((always_inline)) inline void blake2b_vector_round(vec (&v)[16], const vec (&m)[16])
+{
+    constexpr const uint8_t *sigma = blake2b_sigma[round];
+    blake2b_vector_g<vec>(v[0], v[4], v[8], v[12], m[sigma[0]], m[sigma[1]]);
+    blake2b_vector_g<vec>(v[1], v[5], v[9], v[13], m[sigma[2]], m[sigma[3]]);
+    blake2b_vector_g<vec>(v[2], v[6], v[10], v[14], m[sigma[4]], m[sigma[5]]);
+    blake2b_vector_g<vec>(v[3], v[7], v[11], v[15], m[sigma[6]], m[sigma[7]]);
+    blake2b_vector_g<vec>(v[0], v[5], v[10], v[15], m[sigma[8]], m[sigma[9]]);
+    blake2b_vector_g<vec>(v[1], v[6], v[11], v[12], m[sigma[10]], m[sigma[11]]);
+    blake2b_vector_g<vec>(v[2], v[7], v[8], v[13], m[sigma[12]], m[sigma[13]]);
+    blake2b_vector_g<vec>(v[3], v[4], v[9], v[14], m[sigma[14]], m[sigma[15]]);
+}
+
+template<typename vec, size_t ...rounds>
+__attribute__((always_inline)) inline void blake2b_vector_rounds(vec (&v)[16], const vec (&m)[16], std::index_sequence<rounds...>)
+{
+    (blake2b_vector_round<vec, rounds>(v, m), ...);
+}
+
+//The vector counterpart of blake2b_fixed, a single block of exactly inlen bytes per lane.
+template<typename vec, size_t inlen>
+__attribute__((always_inline)) inline void blake2b_vector_fixed(const uint64_t (&keyed)[8], const vec (&m)[16], vec (&h)[8])
+{
+    static_assert(inlen > 0 and inlen <= 128, "Fixed-size vector BLAKE2b takes a single block of input");
+    vec v[16];
+    for (size_t word=0; word < 8; word++) {
+        v[word] = vec{} + keyed[word];
+        v[word + 8] = vec{} + blake2b_iv[word];
+    }
+    v[12] ^= static_cast<uint64_t>(128 + inlen);
+    v[14] = ~v[14];
+    blake2b_vector_rounds<vec>(v, m, std::make_index_sequence<12>());
+    for (size_t word=0; word < 8; word++) {
+        h[word] = (vec{} + keyed[word]) ^ v[word] ^ v[word + 8];
+    }
+}
+
+//Load lanes inputs of inlen bytes each, back to back, as lane-minor message words.
+template<typename vec, size_t lanes, size_t inlen>
+__attribute__((always_inline)) inline void blake2b_vector_load(vec (&m)[16], const unsigned char *in)
+{
+    for (size_t word=0; word < 16; word++) {
+        m[word] = vec{};
+    }
+    for (size_t lane=0; lane < lanes; lane++) {
+        for (size_t index=0; index < inlen; index++) {
+            m[index / 8][lane] |= static_cast<uint64_t>(in[lane * inlen + index]) << (8 * (index % 8));
+        }
+    }
+}
+
+//Store the hashlen byte digests of all lanes back to back.
+template<typename vec, size_t lanes, uint8_t hashlen, size_t count>
+__attribute__((always_inline)) inline void blake2b_vector_store(const vec (&h)[count], unsigned char *out)
+{
+    for (size_t lane=0; lane < lanes; lane++) {
+        for (size_t index=0; index < hashlen; index++) {
+            out[lane * hashlen + index] = static_cast<unsigned char>(h[index / 8][lane] >> (8 * (index % 8)));
+        }
+    }
+}
+
+//The vector counterpart of blake2b_chain, lanes wots chains of the same length side by side.
+template<typename vec, size_t lanes, uint8_t hashlen>
+__attribute__((always_inline)) inline void blake2b_vector_chains(const uint64_t (&keyed)[8], unsigned char *values, size_t times)
+{
+    constexpr size_t words = (hashlen + 7) / 8;
+    constexpr uint64_t last_word_mask = hashlen % 8 == 0 ? ~static_cast<uint64_t>(0) :
+                                        (static_cast<uint64_t>(1) << (8 * (hashlen % 8))) - 1;
+    vec m[16];
+    blake2b_vector_load<vec, lanes, hashlen>(m, values);
+    vec h[8];
+    for (size_t step=0; step < times; step++) {
+        blake2b_vector_fixed<vec, hashlen>(keyed, m, h);
+        for (size_t word=0; word < words; word++) {
+            m[word] = h[word];
+        }
+        m[words - 1] &= last_word_mask;
+    }
+    blake2b_vector_store<vec, lanes, hashlen>(m, values);
+}
+
+//Keyed BLAKE2b of lanes inputs of exactly inlen bytes each, at most one block, side by side.
+template<typename vec, size_t lanes, uint8_t hashlen, size_t inlen>
+__attribute__((always_inline)) inline void blake2b_vector_nodes(const uint64_t (&keyed)[8], const unsigned char *in, unsigned char *out)
+{
+    vec m[16];
+    blake2b_vector_load<vec, lanes, inlen>(m, in);
+    vec h[8];
+    blake2b_vector_fixed<vec, inlen>(keyed, m, h);
+    blake2b_vector_store<vec, lanes, hashlen>(h, out);
+}
+
+//Four lanes of 64 bit words in the 256 bit AVX2 registers.
+struct avx2_kernel {
+    static constexpr size_t lanes = 4;
+    template<uint8_t hashlen>
+    __attribute__((target("avx2"))) static void chains(const uint64_t (&keyed)[8], unsigned char *values, size_t times)
+    {
+        blake2b_vector_chains<blake2b_u64x4, lanes, hashlen>(keyed, values, times);
+    }
+    template<uint8_t hashlen, size_t inlen>
+    __attribute__((target("avx2"))) static void nodes(const uint64_t (&keyed)[8], const unsigned char *in, unsigned char *out)
+    {
+        blake2b_vector_nodes<blake2b_u64x4, lanes, hashlen, inlen>(keyed, in, out);
+    }
+};
+
+//Eight lanes of 64 bit words in the 512 bit AVX-512 registers, with native 64 bit rotations.
+struct avx512_kernel {
+    static constexpr size_t lanes = 8;
+    template<uint8_t hashlen>
+    __attribute__((target("avx512f"))) static void chains(const uint64_t (&keyed)[8], unsigned char *values, size_t times)
+    {
+        blake2b_vector_chains<blake2b_u64x8, lanes, hashlen>(keyed, values, times);
+    }
+    template<uint8_t hashlen, size_t inlen>
+    __attribute__((target("avx512f"))) static void nodes(const uint64_t (&keyed)[8], const unsigned char *in, unsigned char *out)
+    {
+        blake2b_vector_nodes<blake2b_u64x8, lanes, hashlen, inlen>(keyed, in, out);
+    }
+};
+#else
+//No vector kernels on this platform, the AVX backends report themselves unsupported and run the scalar code.
+struct avx2_kernel {
+    static constexpr size_t lanes = 1;
+    template<uint8_t hashlen>
+    static void chains(const uint64_t (&keyed)[8], unsigned char *values, size_t times)
+    {
+        blake2b_chain<hashlen>(keyed, values, times);
+    }
+    template<uint8_t hashlen, size_t inlen>
+    static void nodes(const uint64_t (&keyed)[8], const unsigned char *in, unsigned char *out)
+    {
+        blake2b_keyed_lanes<hashlen, inlen, 1>(keyed, in, out);
+    }
+};
+typedef avx2_kernel avx512_kernel;
+#endif
+}
+
+//Hash backends, the hashing policy of signing_key, signature and master_key. Every backend computes the very same
+//BLAKE2b hashes, so keys and signatures never depend on the backend, only the speed does. All of them provide:
+//  hash<hashlen>(key, in, inlen, out)             keyed hash of any input, message digests.
+//  chain<hashlen>(key, value, times)              a single wots chain, as used in validation.
+//  chains<hashlen>(key, values, count, times)     count wots chains of equal length, back to back, key generation.
+//  nodes<hashlen, inlen>(key, in, count, out)     count keyed hashes of inlen bytes each, merkle tree levels.
+//  derive<hashlen>(master, index, context, out)   crypto_kdf_derive_from_key, the master_key derivation.
+//Hashing all through libsodium.
+struct libsodium_backend {
+    static const char *name()
+    {
+        return "libsodium";
+    }
+    static bool supported()
+    {
+        return true;
+    }
+    template<uint8_t hashlen>
+    static void hash(const non_api::hash_key<hashlen> &key, const unsigned char *in, size_t inlen, unsigned char *out)
+    {
+        crypto_generichash_blake2b(out, hashlen, in, inlen, reinterpret_cast<const unsigned char *>(key.salt.c_str()), hashlen);
+    }
+    template<uint8_t hashlen>
+    static void chain(const non_api::hash_key<hashlen> &key, unsigned char *value, size_t times)
+    {
+        for (size_t index=0; index < times; index++) {
+            crypto_generichash_blake2b(value, hashlen, value, hashlen, reinterpret_cast<const unsigned char *>(key.salt.c_str()), hashlen);
+        }
+    }
+    template<uint8_t hashlen>
+    static void chains(const non_api::hash_key<hashlen> &key, unsigned char *values, size_t count, size_t times)
+    {
+        for (size_t index=0; index < count; index++) {
+            chain<hashlen>(key, values + index * hashlen, times);
+        }
+    }
+    template<uint8_t hashlen, size_t inlen>
+    static void nodes(const non_api::hash_key<hashlen> &key, const unsigned char *in, size_t count, unsigned char *out)
+    {
+        for (size_t index=0; index < count; index++) {
+            hash<hashlen>(key, in + index * inlen, inlen, out + index * hashlen);
+        }
+    }
+    template<uint8_t hashlen>
+    static void derive(const unsigned char *master, uint64_t index, const char *context, unsigned char *out)
+    {
+        crypto_kdf_derive_from_key(out, hashlen, index, context, master);
+    }
+};
+
+//Hashing all through the scalar BLAKE2b code of this file, fixed-size hashes as a single unrolled compression.
+struct reference_backend {
+    static const char *name()
+    {
+        return "reference";
+    }
+    static bool supported()
+    {
+        return true;
+    }
+    template<uint8_t hashlen>
+    static void hash(const non_api::hash_key<hashlen> &key, const unsigned char *in, size_t inlen, unsigned char *out)
+    {
+        non_api::blake2b_reference<hashlen>(reinterpret_cast<const unsigned char *>(key.salt.c_str()), hashlen,
+                                            nullptr, nullptr, in, inlen, out);
+    }
+    template<uint8_t hashlen>
+    static void chain(const non_api::hash_key<hashlen> &key, unsigned char *value, size_t times)
+    {
+        non_api::blake2b_chain<hashlen>(key.keyed, value, times);
+    }
+    template<uint8_t hashlen>
+    static void chains(const non_api::hash_key<hashlen> &key, unsigned char *values, size_t count, size_t times)
+    {
+        for (size_t index=0; index < count; index++) {
+            non_api::blake2b_chain<hashlen>(key.keyed, values + index * hashlen, times);
+        }
+    }
+    template<uint8_t hashlen, size_t inlen>
+    static void nodes(const non_api::hash_key<hashlen> &key, const unsigned char *in, size_t count, unsigned char *out)
+    {
+        for (size_t index=0; index < count; index++) {
+            if constexpr (inlen == 2 * hashlen) {
+                non_api::blake2b_node<hashlen>(key.keyed, in + index * inlen, in + index * inlen + hashlen, out + index * hashlen);
+            }
+            else {
+                non_api::blake2b_keyed_lanes<hashlen, inlen, 1>(key.keyed, in + index * inlen, out + index * hashlen);
+            }
+        }
+    }
+    template<uint8_t hashlen>
+    static void derive(const unsigned char *master, uint64_t index, const char *context, unsigned char *out)
+    {
+        //The key derivation of libsodium is BLAKE2b keyed with the master key, the little endian index as salt and
+        //the context as personalization, of an empty input.
+        unsigned char salt[16] = {};
+        unsigned char personal[16] = {};
+        for (size_t byte=0; byte < 8; byte++) {
+            salt[byte] = static_cast<unsigned char>(index >> (8 * byte));
+        }
+        std::memcpy(personal, context, crypto_kdf_CONTEXTBYTES);
+        non_api::blake2b_reference<hashlen>(master, crypto_kdf_KEYBYTES, salt, personal, nullptr, 0, out);
+    }
+};
+
+namespace non_api {
+//Runs batches of chains and node levels through a multi-lane kernel, kernel::lanes hashes at a time, leaving the
+//remainder and all single hashes to the scalar code.
+template<typename kernel>
+struct multi_lane_backend {
+    template<uint8_t hashlen>
+    static void hash(const hash_key<hashlen> &key, const unsigned char *in, size_t inlen, unsigned char *out)
+    {
+        libsodium_backend::hash<hashlen>(key, in, inlen, out);
+    }
+    template<uint8_t hashlen>
+    static void chain(const hash_key<hashlen> &key, unsigned char *value, size_t times)
+    {
+        reference_backend::chain<hashlen>(key, value, times);
+    }
+    template<uint8_t hashlen>
+    static void chains(const hash_key<hashlen> &key, unsigned char *values, size_t count, size_t times)
+    {
+        size_t index = 0;
+        for (; count - index >= kernel::lanes; index += kernel::lanes) {
+            kernel::template chains<hashlen>(key.keyed, values + index * hashlen, times);
+        }
+        reference_backend::chains<hashlen>(key, values + index * hashlen, count - index, times);
+    }
+    template<uint8_t hashlen, size_t inlen>
+    static void nodes(const hash_key<hashlen> &key, const unsigned char *in, size_t count, unsigned char *out)
+    {
+        size_t index = 0;
+        if constexpr (inlen <= 128) {
+            for (; count - index >= kernel::lanes; index += kernel::lanes) {
+                kernel::template nodes<hashlen, inlen>(key.keyed, in + index * inlen, out + index * hashlen);
+            }
+        }
+        reference_backend::nodes<hashlen, inlen>(key, in + index * inlen, count - index, out + index * hashlen);
+    }
+    template<uint8_t hashlen>
+    static void derive(const unsigned char *master, uint64_t index, const char *context, unsigned char *out)
+    {
+        libsodium_backend::derive<hashlen>(master, index, context, out);
+    }
+};
+}
+
+//Four chains or nodes at a time in AVX2 registers. Only usable where supported() says so.
+struct avx2_backend: non_api::multi_lane_backend<non_api::avx2_kernel> {
+    static const char *name()
+    {
+        return "avx2";
+    }
+    static bool supported()
+    {
+#ifdef SPQ_SIGS_VECTOR_KERNELS
+        return __builtin_cpu_supports("avx2");
+#else
+        return false;
+#endif
+    }
+};
+
+//Eight chains or nodes at a time in AVX-512 registers. Only usable where supported() says so.
+struct avx512_backend: non_api::multi_lane_backend<non_api::avx512_kernel> {
+    static const char *name()
+    {
+        return "avx512";
+    }
+    static bool supported()
+    {
+#ifdef SPQ_SIGS_VECTOR_KERNELS
+        return __builtin_cpu_supports("avx512f");
+#else
+        return false;
+#endif
+    }
+};
+
+namespace non_api {
+//Known answer check of a backend against libsodium, for chains and node levels of a hash length, with a number of
+//hashes that is no multiple of the vector lanes so the scalar remainder gets checked too.
+template<typename backend, uint8_t hashlen>
+bool backend_matches_libsodium()
+{
+    constexpr size_t count = 19;
+    std::string salt(hashlen, '\0');
+    std::string input(4 * count * hashlen, '\0');
+    for (size_t index=0; index < salt.size(); index++) {
+        salt[index] = static_cast<char>(7 * index + 1);
+    }
+    for (size_t index=0; index < input.size(); index++) {
+        input[index] = static_cast<char>(13 * index + 5);
+    }
+    hash_key<hashlen> key(salt);
+    std::string expected(input);
+    std::string actual(input);
+    libsodium_backend::chains<hashlen>(key, reinterpret_cast<unsigned char *>(expected.data()), count, 3);
+    backend::template chains<hashlen>(key, reinterpret_cast<unsigned char *>(actual.data()), count, 3);
+    if (expected != actual) {
+        return false;
+    }
+    const unsigned char *in = reinterpret_cast<const unsigned char *>(input.data());
+    std::string expected_nodes(count * hashlen, '\0');
+    std::string actual_nodes(count * hashlen, '\0');
+    libsodium_backend::nodes<hashlen, 2 * hashlen>(key, in, count, reinterpret_cast<unsigned char *>(expected_nodes.data()));
+    backend::template nodes<hashlen, 2 * hashlen>(key, in, count, reinterpret_cast<unsigned char *>(actual_nodes.data()));
+    if (expected_nodes != actual_nodes) {
+        return false;
+    }
+    libsodium_backend::nodes<hashlen, 4 * hashlen>(key, in, count, reinterpret_cast<unsigned char *>(expected_nodes.data()));
+    backend::template nodes<hashlen, 4 * hashlen>(key, in, count, reinterpret_cast<unsigned char *>(actual_nodes.data()));
+    return expected_nodes == actual_nodes;
+}
+
+template<typename backend>
+bool backend_self_check()
+{
+    return backend::supported() and
+           backend_matches_libsodium<backend, 16>() and
+           backend_matches_libsodium<backend, 24>() and
+           backend_matches_libsodium<backend, 27>() and
+           backend_matches_libsodium<backend, 64>();
+}
+}
+
+//The default backend. Picks the fastest multi-lane kernel the CPU supports, and that passes its known answer
+//check, once on first use, falling back to the scalar reference code. Single hashes go to libsodium, single chains
+//to the scalar code.
+struct dispatched_backend {
+    static const char *name()
+    {
+        switch (kernel()) {
+            case choice::avx512:
+                return avx512_backend::name();
+            case choice::avx2:
+                return avx2_backend::name();
+            case choice::reference:
+            default:
+                return reference_backend::name();
+        }
+    }
+    static bool supported()
+    {
+        return true;
+    }
+    template<uint8_t hashlen>
+    static void hash(const non_api::hash_key<hashlen> &key, const unsigned char *in, size_t inlen, unsigned char *out)
+    {
+        libsodium_backend::hash<hashlen>(key, in, inlen, out);
+    }
+    template<uint8_t hashlen>
+    static void chain(const non_api::hash_key<hashlen> &key, unsigned char *value, size_t times)
+    {
+        reference_backend::chain<hashlen>(key, value, times);
+    }
+    template<uint8_t hashlen>
+    static void chains(const non_api::hash_key<hashlen> &key, unsigned char *values, size_t count, size_t times)
+    {
+        switch (kernel()) {
+            case choice::avx512:
+                return avx512_backend::chains<hashlen>(key, values, count, times);
+            case choice::avx2:
+                return avx2_backend::chains<hashlen>(key, values, count, times);
+            case choice::reference:
+            default:
+                return reference_backend::chains<hashlen>(key, values, count, times);
+        }
+    }
+    template<uint8_t hashlen, size_t inlen>
+    static void nodes(const non_api::hash_key<hashlen> &key, const unsigned char *in, size_t count, unsigned char *out)
+    {
+        switch (kernel()) {
+            case choice::avx512:
+                return avx512_backend::nodes<hashlen, inlen>(key, in, count, out);
+            case choice::avx2:
+                return avx2_backend::nodes<hashlen, inlen>(key, in, count, out);
+            case choice::reference:
+            default:
+                return reference_backend::nodes<hashlen, inlen>(key, in, count, out);
+        }
+    }
+    template<uint8_t hashlen>
+    static void derive(const unsigned char *master, uint64_t index, const char *context, unsigned char *out)
+    {
+        libsodium_backend::derive<hashlen>(master, index, context, out);
+    }
+private:
+    enum class choice { reference, avx2, avx512 };
+    static choice kernel()
+    {
+        static const choice chosen = non_api::backend_self_check<avx512_backend>() ? choice::avx512 :
+                                     non_api::backend_self_check<avx2_backend>() ? choice::avx2 : choice::reference;
+        return chosen;
+    }
+};
+
+namespace non_api {
+// Hashing primative for 'hashlen' long digests, with a little extra. The hashing primative runs on its hash backend.
+template<uint8_t hashlen, uint8_t wotsbits, uint8_t merkleheight, typename backend=dispatched_backend>
+struct primative {
+    //Hash length must be 16 up to 64 bytes long.
+    static_assert(hashlen > 15, "Hash size should be at least 128 bits (16 bytes).");
+    static_assert(hashlen < 65,  "Hash size of more then 512 bits is not supported");
+    //The number of bits used for wots encoding must be 3 upto 16 bits.
+    static_assert(wotsbits < 17, "Wots chains longer than 64k hash operations (wotsbits>16) are not supported");
+    static_assert(wotsbits > 3, "A wots chain should be at least 16 hash operations long (wotsbits > 1)");
+    //The height of a singe merkle-tree must be 3 up to 32 levels, 16 when kept in memory.
+    static_assert(merkleheight < 33, "A single merkle tree should not be more than 32 levels high");
+    static_assert(merkleheight > 2, "A single merkle tree should be at least two levels high. A value between 8 and 10 is recomended");
+    static_assert(39 * wotsbits >= hashlen * 8, "Wotsbits and hashlen must not combine into signing keys of more than 39 subkeys each");
+    // Virtual distructor
+    virtual ~primative() {}
+    //Hash the input with the salt and return the digest.
+    std::string operator()(const std::string &input)
+    {
+        unsigned char output[hashlen];
+        backend::template hash<hashlen>(m_key, reinterpret_cast<const unsigned char *>(input.c_str()), input.length(), output);
+        return std::string(reinterpret_cast<const char *>(output), hashlen);
+    };
+    //Hash the input with the salt 'times' times. This is used for wots chains. Chain steps always hash exactly
+    //hashlen bytes, so they skip the generic libsodium state machine and cost a single compression each.
+    std::string operator()(const std::string &input, size_t times)
+    {
+        unsigned char output[hashlen];
+        std::memcpy(output, input.c_str(), hashlen);
+        backend::template chain<hashlen>(m_key, output, times);
+        return std::string(reinterpret_cast<const char *>(output), hashlen);
+    };
+    //Hash two inputs with salts and return the digest. Node hashes are always 2 * hashlen bytes, one compression.
+    std::string operator()(const std::string &input, const std::string &input2)
+    {
+        unsigned char block[2 * hashlen];
+        unsigned char output[hashlen];
+        std::memcpy(block, input.c_str(), hashlen);
+        std::memcpy(block + hashlen, input2.c_str(), hashlen);
+        backend::template nodes<hashlen, 2 * hashlen>(m_key, block, 1, output);
+        return std::string(reinterpret_cast<const char *>(output), hashlen);
+    };
+    //Run every hashlen byte value in values 'times' times through the hash, a batch of equal length wots chains
+    //that the backend may run side by side.
+    void chains(std::string &values, size_t times)
+    {
+        backend::template chains<hashlen>(m_key, reinterpret_cast<unsigned char *>(values.data()), values.size() / hashlen, times);
+    }
+    //Hash count runs of arity node hashes, back to back in children, into count parent node hashes, back to back in
+    //parents, the same as hashing each run with the salt as a single input. Whole tree levels at a time go to the
+    //backend, that may hash a number of parents side by side.
+    template<size_t arity>
+    void hash_nodes(const unsigned char *children, size_t count, unsigned char *parents)
+    {
+        backend::template nodes<hashlen, arity * hashlen>(m_key, children, count, parents);
+    }
+    //Convert the seed, together with the index of the full-message-signing-key, the sub-index
+    // of the wotsbits chunk of bits to sign, and the bit indicating the left or right wots chain
+    // for these indices, into the secret key for signing wotsbits bits with.
+    //std::string seed_to_secret(std::string &seed, uint64_t master_index)
+    //{
+        //unsigned char unsalted[hashlen];
+        //unsigned char output[hashlen];
+        //std::string sidec = (side) ? "R" : "L";
+        //std::string designator=std::to_string(index) + sidec + std::to_string(subindex);
+        //crypto_generichash_blake2b(unsalted,
+        //                           hashlen,
+        //                           reinterpret_cast<const unsigned char *>(designator.c_str()),
+        //                           designator.length(),
+        //                           reinterpret_cast<const unsigned char *>(seed.c_str()),
+        //                           hashlen);
+        //crypto_generichash_blake2b(output,
+        //                           hashlen,
+        //                           unsalted,
+        //                           hashlen,
+        //                           reinterpret_cast<const unsigned char *>(m_salt.c_str()),
+        //                           hashlen);
+        //return std::string(reinterpret_cast<const char *>(output), hashlen);
+	//FIXME: use libsodium key derivation.
+//	auto ind = master_index;
+//	ind++;
+//	return seed;
+  //  };
+    //Retreive the salt for serialization purposes and later usage.
+    std::string get_salt()
+    {
+        return m_key.salt;
+    }
+    void refresh(std::string &salt)
+    {
+        m_key = hash_key<hashlen>(salt);
+    }
+    template<uint8_t, uint8_t, uint8_t, typename, uint8_t, typename> friend struct spqsigs::signing_key;
+    template<uint8_t, uint8_t, uint8_t, typename, uint8_t, typename> friend struct spqsigs::signature;
+    friend mapped_signing_key<hashlen, wotsbits, merkleheight>;
+private:
+    // Standard constructor using an existing salt.
+    primative(std::string &salt): m_key(salt) {}
+    //Alternative constructor. Generates a random salt.
+    //primative(GENERATE): m_salt(make_seed()) {}
+    hash_key<hashlen> m_key;
+};
+
+//A private key is a collection of subkeys that together can create a one-time-signature for
+// a single transaction/message digest.
+template<uint8_t hashlen, int subkey_count, uint8_t wotsbits, uint8_t merkleheight, uint32_t pubkey_size, typename ots=dual_chain,
+         typename backend=dispatched_backend>
+struct private_key {
+    //Hash length must be 16 up to 64 bytes long.
+    static_assert(hashlen > 15, "Hash size should be at least 128 bits (16 bytes).");
+    static_assert(hashlen < 65,  "Hash size of more then 512 bits is not supported");
+    //The number of bits used for wots encoding must be 3 upto 16 bits.
+    static_assert(wotsbits < 17, "Wots chains longer than 64k hash operations (wotsbits>16) are not supported");
+    static_assert(wotsbits > 3, "A wots chain should be at least 16 hash operations long (wotsbits > 1)");
+    //The height of a singe merkle-tree must be 3 up to 32 levels, 16 when kept in memory.
+    static_assert(merkleheight < 33, "A single merkle tree should not be more than 32 levels high");
+    static_assert(merkleheight > 2, "A single merkle tree should be at least two levels high. A value between 8 and 10 is recomended");
+    static_assert(39 * wotsbits >= hashlen * 8, "Wotsbits and hashlen must not combine into signing keys of more than 39 subkeys each");
+    // A tiny chunk of a one-time (wots) signing key, able to sign a chunk of 'wotsbits' bits with.
+    struct subkey {
+        //constructor, takes hashing primative, a seed, the one-time-signature index and the
+        // chunk sub-index and created the chunk private for both direction wots chains.
+        subkey(primative<hashlen, wotsbits, merkleheight, backend> &hashprimative,
+               subkey_index_generator<hashlen> entropy,
+               size_t index,
+               size_t subindex,
+               std::string restore="",
+               bool side=false):
+            m_index(index),
+            m_subindex(subindex),
+            m_hashprimative(hashprimative),
+            m_private(), m_public(restore)
+        {
+            if constexpr (ots::single_chain) {
+                //A single chain takes just one of the two secrets set aside for a subkey.
+                m_private.push_back(entropy(side));
+            }
+            else {
+	        for (bool side2 : { false, true }) {
+		    std::string secret = entropy(side2);
+                    m_private.push_back(secret);
+                }
+            }
         };
         // virtual destructor
         virtual ~subkey() {};
@@ -508,6 +1539,9 @@ struct private_key {
         // right private key a largeish number of times (2^wotsbits times)
         std::string pubkey()
         {
+            if (m_public == "" and ots::single_chain) {
+                m_public = m_hashprimative(m_private[0], (1<<wotsbits) - 1);
+            }
             if (m_public == "") {
                 std::string privkey_1 = m_hashprimative(m_private[0], 1<<wotsbits);
                 std::string privkey_2 = m_hashprimative(m_private[1], 1<<wotsbits);
@@ -519,12 +1553,32 @@ struct private_key {
         // encoded into an unsigned integer.
         std::string operator [](uint32_t index)
         {
+            if constexpr (ots::single_chain) {
+                return m_hashprimative(m_private[0], index);
+            }
             return m_hashprimative(m_private[0], index) + m_hashprimative(m_private[1], (1<<wotsbits) - index -1);
         }
+        //The starts of the chains to hash for the public key, empty once it is known.
+        std::string chain_starts()
+        {
+            if (m_public != "") {
+                return "";
+            }
+            if constexpr (ots::single_chain) {
+                return m_private[0];
+            }
+            return m_private[0] + m_private[1];
+        }
+        //Set the public key from the hashed chain ends, with the node hash of both chain ends already done for
+        //dual chains.
+        void set_pubkey(const std::string &pubkey)
+        {
+            m_public = pubkey;
+        }
     private:
         size_t m_index;
         size_t m_subindex;
-        primative<hashlen, wotsbits, merkleheight> &m_hashprimative; // The core hashing primative
+        primative<hashlen, wotsbits, merkleheight, backend> &m_hashprimative; // The core hashing primative
         std::vector<std::string> m_private;  // The private key as generated at construction.
         std::string m_public;                // The public key, calculated lazy, on demand.
     };
@@ -533,6 +1587,31 @@ struct private_key {
     //Get the pubkey for the single-use private key.
     std::string pubkey()
     {
+        //Hash the chains of all subkeys in one batch, so the hash backend can run them side by side.
+        constexpr size_t chains_per_subkey = ots::single_chain ? 1 : 2;
+        constexpr size_t chain_length = ots::single_chain ? (1<<wotsbits) - 1 : 1<<wotsbits;
+        std::vector<size_t> pending;
+        std::string chains;
+        for (size_t index=0; index < m_subkeys.size(); index++) {
+            std::string starts = m_subkeys[index].chain_starts();
+            if (starts != "") {
+                pending.push_back(index);
+                chains += starts;
+            }
+        }
+        if (not pending.empty()) {
+            m_hashprimative.chains(chains, chain_length);
+            std::string pubkeys(chains);
+            if constexpr (chains_per_subkey == 2) {
+                pubkeys.resize(pending.size() * hashlen);
+                m_hashprimative.template hash_nodes<2>(reinterpret_cast<const unsigned char *>(chains.data()),
+                                                       pending.size(),
+                                                       reinterpret_cast<unsigned char *>(pubkeys.data()));
+            }
+            for (size_t index=0; index < pending.size(); index++) {
+                m_subkeys[pending[index]].set_pubkey(pubkeys.substr(index * hashlen, hashlen));
+            }
+        }
         std::string rval("");
         //Compose by concattenating the pubkey for all the sub keys.
         std::for_each(std::begin(m_subkeys), std::end(m_subkeys), [&rval, this](subkey &value) {
@@ -545,6 +1624,9 @@ struct private_key {
     {
         //Convert the digest to a list of numbers that we shall sign with the sub keys for this private key.
         auto numlist = digest_to_numlist<hashlen, wotsbits>(digest);
+        if constexpr (ots::single_chain) {
+            append_checksum<hashlen, wotsbits>(numlist);
+        }
         std::string rval;
         size_t nl_len = numlist.size();
         //Concattenate all the subkey based signatures into one large signing key.
@@ -554,27 +1636,37 @@ struct private_key {
         return rval;
     };
     //Only private_keys should invoke the constructor
-    friend private_keys<hashlen, merkleheight, wotsbits, pubkey_size>;
+    friend private_keys<hashlen, merkleheight, wotsbits, pubkey_size, ots, backend>;
+    //The out-of-core signing key creates its private keys one at a time.
+    friend mapped_signing_key<hashlen, wotsbits, merkleheight>;
 private:
     //Private constructor, should only get invoked by private_keys
-    private_key(primative<hashlen, wotsbits, merkleheight> &hashprimative,
+    private_key(primative<hashlen, wotsbits, merkleheight, backend> &hashprimative,
                 wots_index_generator<hashlen, wotsbits> entropy,
                 size_t index,
                 std::string &recovery,
-		uint64_t master_index): m_subkeys(), m_master_index(master_index)
+		uint64_t master_index): m_hashprimative(hashprimative), m_subkeys(), m_master_index(master_index)
     {
         auto FIXME = recovery;
-        //Compose from its sub-keys.
+        //Compose from its sub-keys. Checksum subkeys use the secrets left unused by the single chains of the
+        //digest subkeys.
+        constexpr uint16_t digest_subkeys = (hashlen * 8 + wotsbits -1) / wotsbits;
         for(uint16_t subindex=0; subindex < subkey_count; subindex++) {
-            m_subkeys.push_back(subkey(hashprimative, entropy[subindex], index, subindex));
+            if (subindex < digest_subkeys) {
+                m_subkeys.push_back(subkey(hashprimative, entropy[subindex], index, subindex));
+            }
+            else {
+                m_subkeys.push_back(subkey(hashprimative, entropy[static_cast<uint16_t>(subindex - digest_subkeys)], index, subindex, "", true));
+            }
         }
     };
+    primative<hashlen, wotsbits, merkleheight, backend> &m_hashprimative;
     std::vector<subkey> m_subkeys;
     uint64_t m_master_index;
 };
 
 // Collection of all one-time signing keys belonging with a signing key
-template<uint8_t hashlen,  uint8_t merkleheight, uint8_t wotsbits, uint32_t pubkey_size>
+template<uint8_t hashlen,  uint8_t merkleheight, uint8_t wotsbits, uint32_t pubkey_size, typename ots, typename backend>
 struct private_keys {
     //Hash length must be 16 up to 64 bytes long.
     static_assert(hashlen > 15, "Hash size should be at least 128 bits (16 bytes).");
@@ -587,21 +1679,22 @@ struct private_keys {
     static_assert(merkleheight > 2, "A single merkle tree should be at least two levels high. A value between 8 and 10 is recomended");
     static_assert(39 * wotsbits >= hashlen * 8, "Wotsbits and hashlen must not combine into signing keys of more than 39 subkeys each");
     static constexpr uint32_t subkey_count =  (hashlen * 8 + wotsbits -1) / wotsbits;
+    typedef private_key<hashlen, determine_ots_subkeys<ots, hashlen, wotsbits>(), wotsbits, merkleheight, pubkey_size, ots, backend> private_key_type;
     // Virtual destructor
     virtual ~private_keys() {};
     //Square bracket operator used to access specific private key.
-    private_key<hashlen, (hashlen*8 + wotsbits -1)/wotsbits,wotsbits, merkleheight, pubkey_size> &operator [](uint32_t index)
+    private_key_type &operator [](uint32_t index)
     {
         return this->m_keys[index];
     };
-    void refresh(primative<hashlen, wotsbits, merkleheight> &hashprimative, non_api::unique_index_generator<hashlen, wotsbits, merkleheight> entropy, uint64_t master_index)
+    void refresh(primative<hashlen, wotsbits, merkleheight, backend> &hashprimative, non_api::unique_index_generator<hashlen, wotsbits, merkleheight> entropy, uint64_t master_index)
     {
         m_master_index = master_index;
-        std::vector<private_key<hashlen,(hashlen * 8 + wotsbits -1) / wotsbits, wotsbits, merkleheight, pubkey_size>>  empty;
+        std::vector<private_key_type>  empty;
         m_keys.swap(empty);
-        for (uint16_t index=0; index < pubkey_size; index++) {
+        for (uint32_t index=0; index < pubkey_size; index++) {
             m_keys.push_back(
-                private_key<hashlen, subkey_count, wotsbits, merkleheight, pubkey_size>(hashprimative,
+                private_key_type(hashprimative,
                         entropy[index],
                         index,
                         m_empty,
@@ -617,32 +1710,285 @@ struct private_keys {
         return rval;
     }
     //Only signing_key should invoke the constructor for private_keys
-    friend signing_key<hashlen, wotsbits, merkleheight>;
+    template<uint8_t, uint8_t, uint8_t, typename, uint8_t, typename> friend struct spqsigs::signing_key;
 private:
     //Private constructor, only to be called from signing_key
-    private_keys(primative<hashlen, wotsbits, merkleheight> &hashprimative,
+    private_keys(primative<hashlen, wotsbits, merkleheight, backend> &hashprimative,
 		 non_api::unique_index_generator<hashlen, wotsbits, merkleheight> entropy,
 		 std::string &recovery,
                  uint64_t master_index):
         m_keys(), m_empty(), m_master_index(master_index)
     {
         // Construct from multiple private_key's
-        for (uint16_t index=0; index < pubkey_size; index++) {
+        for (uint32_t index=0; index < pubkey_size; index++) {
             m_keys.push_back(
-                private_key<hashlen, subkey_count, wotsbits, merkleheight, pubkey_size>(hashprimative,
+                private_key_type(hashprimative,
                         entropy[index],
                         index,
                         recovery,
 			m_master_index + 2 * index * subkey_count));
         }
     };
-    std::vector<private_key<hashlen,(hashlen * 8 + wotsbits -1) / wotsbits, wotsbits, merkleheight, pubkey_size>>  m_keys;
+    std::vector<private_key_type>  m_keys;
     std::string m_empty;
     uint64_t m_master_index;
 };
+
+//Memory mapping of a file. Either read/write of a given size, the file getting created or grown if needed, or
+//read-only of an existing file as a whole.
+struct mapped_file {
+    //Map an existing file read-only.
+    mapped_file(const std::string &path): m_fd(-1), m_size(0), m_data(nullptr)
+    {
+        m_fd = ::open(path.c_str(), O_RDONLY);
+        struct stat info;
+        if (m_fd < 0 or ::fstat(m_fd, &info) != 0) {
+            if (m_fd >= 0) {
+                ::close(m_fd);
+            }
+            throw std::runtime_error("Unable to open file for mapping: " + path);
+        }
+        m_size = static_cast<size_t>(info.st_size);
+        if (m_size > 0) {
+            void *data = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+            if (data == MAP_FAILED) {
+                ::close(m_fd);
+                throw std::runtime_error("Unable to map file: " + path);
+            }
+            ::madvise(data, m_size, MADV_SEQUENTIAL);
+            m_data = static_cast<uint8_t *>(data);
+        }
+    }
+    //Map a file read/write, creating or growing it to size bytes.
+    mapped_file(const std::string &path, size_t size): m_fd(-1), m_size(size), m_data(nullptr)
+    {
+        m_fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0600);
+        if (m_fd < 0) {
+            throw std::runtime_error("Unable to open file for mapping: " + path);
+        }
+        struct stat info;
+        if (::fstat(m_fd, &info) != 0 or
+            (static_cast<size_t>(info.st_size) < size and ::ftruncate(m_fd, static_cast<off_t>(size)) != 0)) {
+            ::close(m_fd);
+            throw std::runtime_error("Unable to size file for mapping: " + path);
+        }
+        void *data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+        if (data == MAP_FAILED) {
+            ::close(m_fd);
+            throw std::runtime_error("Unable to map file: " + path);
+        }
+        m_data = static_cast<uint8_t *>(data);
+    }
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+    virtual ~mapped_file()
+    {
+        if (m_data != nullptr) {
+            ::munmap(m_data, m_size);
+        }
+        ::close(m_fd);
+    }
+    uint8_t *data()
+    {
+        return m_data;
+    }
+    size_t size()
+    {
+        return m_size;
+    }
+    //The mapped file content as a string view.
+    std::string_view view()
+    {
+        return std::string_view(reinterpret_cast<const char *>(m_data), m_size);
+    }
+    //Flush the mapping to disk.
+    void sync()
+    {
+        ::msync(m_data, m_size, MS_SYNC);
+    }
+    //Hint that the mapping will be read in random order rather than sequentially.
+    void advise_random()
+    {
+        if (m_data != nullptr) {
+            ::madvise(m_data, m_size, MADV_RANDOM);
+        }
+    }
+private:
+    int m_fd;
+    size_t m_size;
+    uint8_t *m_data;
+};
 }
-// Public API signing_key
-template<uint8_t hashlen, uint8_t wotsbits, uint8_t merkleheight>
+// Public API incremental message hasher. Hashes a message of arbitrary size in chunks, using the salt of the signing key
+// (or signature) it was obtained from, and produces the same digest as hashing the whole message in one go would.
+template<uint8_t hashlen>
+struct message_hasher {
+    //Hash length must be 16 up to 64 bytes long.
+    static_assert(hashlen > 15, "Hash size should be at least 128 bits (16 bytes).");
+    static_assert(hashlen < 65,  "Hash size of more then 512 bits is not supported");
+    message_hasher(const std::string &salt): m_state(), m_finished(false)
+    {
+        crypto_generichash_blake2b_init(&m_state,
+                                        reinterpret_cast<const unsigned char *>(salt.c_str()),
+                                        hashlen,
+                                        hashlen);
+    }
+    virtual ~message_hasher() {}
+    //Feed the next chunk of the message.
+    message_hasher &update(std::string_view chunk)
+    {
+        if (m_finished) {
+            throw std::logic_error("Message hasher already finished.");
+        }
+        crypto_generichash_blake2b_update(&m_state,
+                                          reinterpret_cast<const unsigned char *>(chunk.data()),
+                                          chunk.size());
+        return *this;
+    }
+    //Get the message digest, for use with sign_digest or digest-mode validate.
+    std::string finish()
+    {
+        if (m_finished) {
+            throw std::logic_error("Message hasher already finished.");
+        }
+        unsigned char output[hashlen];
+        crypto_generichash_blake2b_final(&m_state, output, hashlen);
+        m_finished = true;
+        return std::string(reinterpret_cast<const char *>(output), hashlen);
+    }
+private:
+    crypto_generichash_blake2b_state m_state;
+    bool m_finished;
+};
+
+// Public API resumable key generation checkpoint. Holds, for every merkle tree being generated (keyed by its salt), the
+// leaf node hashes completed so far. Files don't belong in the library API, persisting is left to the callback. Every
+// time a subtree of checkpoint_height levels has been completed, it gets invoked with append set and just the leaves
+// completed since it was last invoked, to go at the end of what was persisted before. Once a whole tree is completed
+// its leaves get dropped, and the callback gets invoked without append and the whole checkpoint, to replace what was
+// persisted before. So persisting takes time linear in the tree size, and the checkpoint stays as small as a tree.
+template<uint8_t hashlen>
+struct keygen_checkpoint {
+    //Hash length must be 16 up to 64 bytes long.
+    static_assert(hashlen > 15, "Hash size should be at least 128 bits (16 bytes).");
+    static_assert(hashlen < 65,  "Hash size of more then 512 bits is not supported");
+    keygen_checkpoint(std::function<void(const std::string &, bool)> persist,
+                      uint8_t checkpoint_height=4,
+                      std::string serialized=""):
+        m_persist(persist), m_checkpoint_height(checkpoint_height), m_leaves(), m_persisted()
+    {
+        //Each record: the tree salt, the index of its first leaf and a leaf count, both 32 bit in network order, and
+        //the leaf node hashes. Leaves a tree already has are skipped, so a record appended again after a failed
+        //persist does no harm. A run interrupted while appending may leave a truncated last record, its complete
+        //leaves are kept.
+        size_t offset = 0;
+        while (serialized.size() - offset >= hashlen + 8) {
+            std::string salt = serialized.substr(offset, hashlen);
+            uint32_t first;
+            uint32_t count;
+            std::memcpy(&first, serialized.c_str() + offset + hashlen, 4);
+            std::memcpy(&count, serialized.c_str() + offset + hashlen + 4, 4);
+            first = ntohl(first);
+            count = static_cast<uint32_t>(std::min<size_t>(ntohl(count), (serialized.size() - offset - hashlen - 8) / hashlen));
+            offset += hashlen + 8;
+            std::vector<std::string> &leaves = m_leaves[salt];
+            for (uint32_t index=0; index < count; index++) {
+                if (first + index == leaves.size()) {
+                    leaves.push_back(serialized.substr(offset, hashlen));
+                }
+                offset += hashlen;
+            }
+        }
+        for (auto &tree : m_leaves) {
+            m_persisted[tree.first] = tree.second.size();
+        }
+    }
+    virtual ~keygen_checkpoint() {}
+    //Serialize the checkpoint for persisting.
+    operator std::string() const
+    {
+        std::string rval;
+        for (auto &tree : m_leaves) {
+            append_record(rval, tree.first, tree.second, 0);
+        }
+        return rval;
+    }
+    //Get the number of leaf node hashes already completed for the tree with the given salt.
+    size_t completed(const std::string &salt) const
+    {
+        auto found = m_leaves.find(salt);
+        if (found == m_leaves.end()) {
+            return 0;
+        }
+        return found->second.size();
+    }
+    //Get a completed leaf node hash.
+    std::string leaf(const std::string &salt, size_t index) const
+    {
+        return m_leaves.at(salt).at(index);
+    }
+    //Record a newly completed leaf node hash. Leaves get completed in order.
+    void record(const std::string &salt, size_t index, const std::string &leaf)
+    {
+        std::vector<std::string> &leaves = m_leaves[salt];
+        if (index == leaves.size()) {
+            leaves.push_back(leaf);
+        }
+    }
+    //Invoked for every completed subtree, appends the leaves completed since the last time the checkpoint got
+    //persisted if the subtree is checkpoint_height levels high.
+    void subtree_completed(uint8_t height)
+    {
+        if (height != m_checkpoint_height or not m_persist) {
+            return;
+        }
+        std::string appended;
+        for (auto &tree : m_leaves) {
+            append_record(appended, tree.first, tree.second, m_persisted[tree.first]);
+        }
+        if (not appended.empty()) {
+            m_persist(appended, true);
+            for (auto &tree : m_leaves) {
+                m_persisted[tree.first] = tree.second.size();
+            }
+        }
+    }
+    //Invoked when a whole tree is completed, drops its leaves and always persists the whole, compacted checkpoint.
+    void tree_completed(const std::string &salt)
+    {
+        m_leaves.erase(salt);
+        m_persisted.erase(salt);
+        if (m_persist) {
+            m_persist(*this, false);
+            for (auto &tree : m_leaves) {
+                m_persisted[tree.first] = tree.second.size();
+            }
+        }
+    }
+private:
+    //Serialize the leaves of a tree from leaf first on as a record, if there are any.
+    static void append_record(std::string &out, const std::string &salt, const std::vector<std::string> &leaves, size_t first)
+    {
+        if (first >= leaves.size()) {
+            return;
+        }
+        uint32_t header[2] = {htonl(static_cast<uint32_t>(first)), htonl(static_cast<uint32_t>(leaves.size() - first))};
+        out += salt + std::string(reinterpret_cast<const char *>(header), 8);
+        for (size_t index=first; index < leaves.size(); index++) {
+            out += leaves[index];
+        }
+    }
+    std::function<void(const std::string &, bool)> m_persist;
+    uint8_t m_checkpoint_height;
+    std::map<std::string, std::vector<std::string>> m_leaves;
+    //Number of leaves of every tree the persisted checkpoint holds.
+    std::map<std::string, size_t> m_persisted;
+};
+
+// Public API signing_key, the ots policy picks the one-time signature scheme, dual_chain or checksum_chain. With an
+// arity of 4 or 8, every merkle tree node hashes that many children in a single call, taking 2 or 3 signature index
+// bits per level. The tree gets fewer levels and fewer node hashes to verify, at the cost of a longer auth path.
+template<uint8_t hashlen, uint8_t wotsbits, uint8_t merkleheight, typename ots, uint8_t arity, typename backend>
 struct signing_key {
     //Hash length must be 16 up to 64 bytes long.
     static_assert(hashlen > 15, "Hash size should be at least 128 bits (16 bytes).");
@@ -654,36 +2000,52 @@ struct signing_key {
     static_assert(merkleheight < 17, "A single merkle tree should not be more than 16 levels high");
     static_assert(merkleheight > 2, "A single merkle tree should be at least two levels high. A value between 8 and 10 is recomended");
     static_assert(39 * wotsbits >= hashlen * 8, "Wotsbits and hashlen must not combine into signing keys of more than 39 subkeys each");
+    //The arity must be a power of two, 2 up to 16, and its index bits must divide the tree height.
+    static_assert(arity > 1 and arity < 17 and (arity & (arity - 1)) == 0, "Merkle tree arity should be 2, 4, 8 or 16");
+    static_assert(merkleheight % non_api::determine_arity_bits<arity>() == 0, "Merkle tree height must be a multiple of the index bits per level of its arity");
     // The merkle-tree that maps a larger collection of single use private/public keys, to a single merkle-root public key.
     // Also used in encoding signatures.
     struct merkle_tree {
+        //Index bits per level, number of levels below the root and number of nodes of the tree.
+        static constexpr uint8_t arity_bits = non_api::determine_arity_bits<arity>();
+        static constexpr size_t depth = merkleheight / arity_bits;
+        static constexpr size_t level_start(size_t level)
+        {
+            return ((static_cast<size_t>(1) << (level * arity_bits)) - 1) / (arity - 1);
+        }
+        static constexpr size_t node_count = level_start(depth + 1);
         //Merkle-tree constructor
-        merkle_tree(non_api::primative<hashlen, wotsbits, merkleheight> & hashfunction,
+        merkle_tree(non_api::primative<hashlen, wotsbits, merkleheight, backend> & hashfunction,
                     non_api::private_keys<hashlen,
                     merkleheight,
                     wotsbits,
-                    static_cast<unsigned short>(1) << merkleheight > &privkey): m_hashfunction(hashfunction),
+                    static_cast<unsigned short>(1) << merkleheight, ots, backend> &privkey): m_hashfunction(hashfunction),
             m_private_keys(privkey),
-            m_merkle_tree()
+            m_nodes()
         {
         };
         //Virtual destructor
         virtual ~merkle_tree() {};
-
+        //Populate the tree resuming from, and updating, a keygen checkpoint. Leaves completed in an earlier run
+        //are taken from the checkpoint instead of being recalculated from their wots keys.
+        void populate(keygen_checkpoint<hashlen> &checkpoint)
+        {
+            this->populate(&checkpoint);
+            checkpoint.tree_completed(m_hashfunction.get_salt());
+        }
         void refresh()
         {
-            m_merkle_tree.clear();
-            this->populate<merkleheight>(0, "");
+            this->populate();
         }
         //Get the merkle-root, what is the same as the signing_key public key.
         std::string pubkey()
         {
             //Populate the tree if it hasn't already been.
-            if ( m_merkle_tree.find("") == m_merkle_tree.end() ) {
-                this->populate<merkleheight>(0, "");
+            if (m_nodes.empty()) {
+                this->populate();
             }
             //Return the merkle root
-            return m_merkle_tree[""];
+            return this->node(0);
         };
         //Square bracket operator is used to get the merkle-tree signature-header for a given signing key index number.
         //The merkle-tree signature-header contains those merkle tree node hashes needed to get from the wots signature
@@ -691,57 +2053,82 @@ struct signing_key {
         std::string operator [](uint32_t signing_key_index)
         {
             //Populate if needed.
-            if ( m_merkle_tree.find("") == m_merkle_tree.end() ) {
-                this->populate<merkleheight>(0, "");
+            if (m_nodes.empty()) {
+                this->populate();
             }
-            //Convert the signing key index into a vector of booleans
-            std::vector<bool> index_bits = non_api::as_bits<merkleheight>(signing_key_index);
             std::string rval;
-            // For each depth in the tree extract one node.
-            for (uint8_t bindex=0; bindex < merkleheight; bindex++) {
-                std::string key;
-                //For each bit of a given depth, except the last, pick use the input designation
-                for (uint8_t index=0; index<bindex; index++) {
-                    key += index_bits[index] ? std::string("1") : std::string("0");
+            size_t parent = 0;
+            // For each depth in the tree extract the siblings of the node on the path, in child order.
+            for (size_t level=1; level <= depth; level++) {
+                uint32_t child = (signing_key_index >> (merkleheight - level * arity_bits)) & (arity - 1);
+                size_t first = parent * arity + 1;
+                for (uint32_t sibling=0; sibling < arity; sibling++) {
+                    if (sibling != child) {
+                        rval += this->node(first + sibling);
+                    }
                 }
-                //For the last bit, get the oposing node.
-                key += index_bits[bindex] ? std::string("0") : std::string("1");
-                rval += m_merkle_tree[key];
+                //Follow the path one level down.
+                parent = first + child;
             }
             return rval;
         };
     private:
-        //Populate the merkle tree by populating the public keys for all the private keys of the signing key.
-        //Populating is initiated at merkleheight height, and works its way down.
-        template<uint8_t remaining_height>
-        std::string populate(uint32_t start, std::string prefix)
+        std::string node(size_t index)
         {
-            if constexpr (remaining_height != 0) {
-                //Polulate the left branch and get the top node hash
-                std::string left = this->populate<remaining_height-1>(start,prefix + "0");
-                //Populate the right branch and get the top node hash
-                std::string right = this->populate<remaining_height-1>(start + (1 << (remaining_height - 1)),
-                                    prefix + "1");
-                //Set the node hash value at this level.
-                m_merkle_tree[prefix] = m_hashfunction(left, right);
+            return m_nodes.substr(index * hashlen, hashlen);
+        }
+        //Populate the merkle tree level by level. First the leaves, the salted hashes of the public keys of all the
+        //private keys of the signing key, then every level above in one go, from the bottom up.
+        void populate(keygen_checkpoint<hashlen> *checkpoint=nullptr)
+        {
+            m_nodes.assign(node_count * hashlen, '\0');
+            std::string salt = m_hashfunction.get_salt();
+            constexpr size_t first_leaf = level_start(depth);
+            for (uint32_t start=0; start < (static_cast<uint32_t>(1) << merkleheight); start++) {
+                std::string leaf;
+                if (checkpoint != nullptr and start < checkpoint->completed(salt)) {
+                    //Leaf-node completed in an earlier, interrupted, key generation run.
+                    leaf = checkpoint->leaf(salt, start);
+                }
+                else {
+                    //Leaf-node, the salted hash of the  wots pubkey.
+                    std::string pkey = m_private_keys[start].pubkey();
+                    leaf =  m_hashfunction(pkey);
+                    if (checkpoint != nullptr) {
+                        checkpoint->record(salt, start, leaf);
+                    }
+                }
+                m_nodes.replace((first_leaf + start) * hashlen, hashlen, leaf);
+                //Report the subtrees this leaf completes.
+                for (uint8_t height=arity_bits; checkpoint != nullptr and height <= merkleheight; height += arity_bits) {
+                    if (((start + 1) & ((static_cast<uint32_t>(1) << height) - 1)) == 0) {
+                        checkpoint->subtree_completed(height);
+                    }
+                }
             }
-            else {
-                //Leaf-node, the salted hash of the  wots pubkey.
-                std::string pkey = m_private_keys[start].pubkey();
-                m_merkle_tree[prefix] =  m_hashfunction(pkey);
+            unsigned char *nodes = reinterpret_cast<unsigned char *>(m_nodes.data());
+            for (size_t level=depth; level > 0; level--) {
+                size_t first = level_start(level - 1);
+                m_hashfunction.template hash_nodes<arity>(nodes + level_start(level) * hashlen,
+                                                          static_cast<size_t>(1) << ((level - 1) * arity_bits),
+                                                          nodes + first * hashlen);
             }
-            return m_merkle_tree[prefix];
         }
-        non_api::primative<hashlen, wotsbits, merkleheight> &m_hashfunction;
+        non_api::primative<hashlen, wotsbits, merkleheight, backend> &m_hashfunction;
         non_api::private_keys<hashlen,
                 merkleheight,
                 wotsbits,
-                static_cast<unsigned short>(1) << merkleheight > &m_private_keys;
-        std::map<std::string, std::string> m_merkle_tree;
+                static_cast<unsigned short>(1) << merkleheight, ots, backend> &m_private_keys;
+        //The nodes in level order, root first, the children of node n being arity * n + 1 up to arity * n + arity.
+        std::string m_nodes;
     };
-    signing_key(non_api::unique_index_generator<hashlen, wotsbits, merkleheight> entropy):
+    //Constructor, optionaly takes the index of the next signature, for restoring a partially used key, and a keygen
+    //checkpoint to resume key generation from.
+    signing_key(non_api::unique_index_generator<hashlen, wotsbits, merkleheight> entropy,
+                uint64_t next_index=0,
+                keygen_checkpoint<hashlen> *checkpoint=nullptr):
 	m_entropy(entropy),
-	m_next_index(0),
+	m_next_index(next_index),
 	m_salt(entropy),
         m_hashfunction(m_salt),
         m_empty(),
@@ -749,8 +2136,13 @@ struct signing_key {
         m_privkeys(m_hashfunction, entropy, m_empty, m_master_index),
         m_merkle_tree(m_hashfunction, m_privkeys)
     {
-        //Get pubkey as a way to populate.
-        this->m_merkle_tree.pubkey();
+        if (checkpoint != nullptr) {
+            this->m_merkle_tree.populate(*checkpoint);
+        }
+        else {
+            //Get pubkey as a way to populate.
+            this->m_merkle_tree.pubkey();
+        }
     };
     //Make a new key when current one is exhausted
     void refresh(non_api::unique_index_generator<hashlen, wotsbits, merkleheight> entropy)
@@ -765,100 +2157,317 @@ struct signing_key {
     //Sign a hashlength bytes long digest.
     std::string sign_digest(std::string digest)
     {
-        assert(digest.length() == hashlen);
+        if (digest.length() != hashlen) {
+            throw std::invalid_argument("Digest to sign must be hashlen bytes long.");
+        }
         //Throw an exception when key is already fully exhausted
         if (this->m_next_index >= (1 << merkleheight)) {
             throw signingkey_exhausted();
         }
         //Get the signature index in network order.
-        uint16_t ndx = htons(this->m_next_index);
-        std::string ndxs = std::string(reinterpret_cast<const char *>(&ndx), 2);
+        std::string ndxs = non_api::encode_signature_index(this->m_next_index);
         //Compose the signature of its parts.
         std::string rval = this->m_merkle_tree.pubkey() + //The signing key's pubkey
                            this->m_hashfunction.get_salt() +         //The signing key's salt
                            ndxs +                                    //The signature wots priv/pubkey index
-                           this->m_merkle_tree[m_next_index] +       //The merkle-tree header, a collection of merkle tree
+                           this->m_merkle_tree[static_cast<uint32_t>(m_next_index)] + //The merkle-tree header, a collection of merkle tree
 			                                             // nodes needed to get from wots signatures to pubkey.
-                           this->m_privkeys[m_next_index][digest];   //The collection of wots signatures.
+                           this->m_privkeys[static_cast<uint32_t>(m_next_index)][digest]; //The collection of wots signatures.
+        this->m_next_index++;
+        return rval;
+    };
+    //Sign an arbitrary length message
+    std::string sign_message(const std::string &message)
+    {
+        //Take the hash of the message.
+        std::string digest = m_hashfunction(message);
+        //Sign the hash
+        return this->sign_digest(digest);
+    };
+    //Get an incremental hasher for a message to sign, salted for this key.
+    message_hasher<hashlen> hasher()
+    {
+        return message_hasher<hashlen>(m_hashfunction.get_salt());
+    }
+    //Check if all one-time keys of this key have been used.
+    bool exhausted()
+    {
+        return m_next_index >= (static_cast<uint64_t>(1) << merkleheight);
+    }
+    //Future API call for serializing the signing key.
+    std::tuple<std::string,  uint64_t, std::string>  get_state()
+    {
+        return std::make_tuple(m_hashfunction.get_salt(), m_next_index,  m_privkeys.pubkey());
+    }
+    uint64_t get_next_index()
+    {
+        return m_next_index;
+    }
+    std::string pubkey()
+    {
+        return m_merkle_tree.pubkey();
+    }
+    //Virtual destructor
+    virtual ~signing_key() {}
+private:
+    non_api::unique_index_generator<hashlen, wotsbits, merkleheight> m_entropy;
+    uint64_t m_next_index;
+    std::string m_salt;
+    non_api::primative<hashlen, wotsbits, merkleheight, backend> m_hashfunction;
+    std::string m_empty;
+    uint64_t m_master_index;
+    non_api::private_keys<hashlen, merkleheight, wotsbits, static_cast<unsigned short>(1) << merkleheight, ots, backend> m_privkeys;
+    merkle_tree m_merkle_tree;
+};
+
+// Public API out-of-core signing key. Rather than keeping the merkle tree and all one-time private keys in memory,
+// the tree nodes live in a memory mapped node file, built level by level, and one-time private keys are derived only
+// when needed. Memory use is bounded and signing reads merkleheight nodes from the file, so trees can grow up to 32
+// levels, beyond the 16 of an in-memory signing_key. Signatures are identical to those of a signing_key made from the
+// same private key, and validate with signature<> of the same height.
+template<uint8_t hashlen, uint8_t wotsbits, uint8_t merkleheight>
+struct mapped_signing_key {
+    //Hash length must be 16 up to 64 bytes long.
+    static_assert(hashlen > 15, "Hash size should be at least 128 bits (16 bytes).");
+    static_assert(hashlen < 65,  "Hash size of more then 512 bits is not supported");
+    //The number of bits used for wots encoding must be 3 upto 16 bits.
+    static_assert(wotsbits < 17, "Wots chains longer than 64k hash operations (wotsbits>16) are not supported");
+    static_assert(wotsbits > 3, "A wots chain should be at least 16 hash operations long (wotsbits > 1)");
+    //The height of a singe merkle-tree must be 3 up to 32 levels, the node file lifting the in-memory limit of 16.
+    static_assert(merkleheight < 33, "A single merkle tree should not be more than 32 levels high");
+    static_assert(merkleheight > 2, "A single merkle tree should be at least two levels high. A value between 8 and 10 is recomended");
+    static_assert(39 * wotsbits >= hashlen * 8, "Wotsbits and hashlen must not combine into signing keys of more than 39 subkeys each");
+    static constexpr uint32_t subkey_count =  (hashlen * 8 + wotsbits -1) / wotsbits;
+    //Node file header: magic, merkleheight, completed levels, padding, completed leaves (64 bit network order) and
+    //the salt.
+    static constexpr size_t header_size = 24 + hashlen;
+    //The nodes are stored in level order, root first, the children of node n being 2n+1 and 2n+2.
+    static constexpr uint64_t leaf_count = static_cast<uint64_t>(1) << merkleheight;
+    static constexpr uint64_t node_count = 2 * leaf_count - 1;
+    //The whole node file gets mapped, so it must fit the address space as well as a file offset.
+    static_assert(node_count <= (static_cast<uint64_t>(PTRDIFF_MAX) - header_size) / hashlen, "The node file of this merkle tree does not fit in the address space");
+    static constexpr size_t file_size = header_size + hashlen * static_cast<size_t>(node_count);
+    //Open or create the node file for the key, building (or continuing to build) the tree if needed.
+    mapped_signing_key(std::string private_key, std::string node_file_path, uint64_t next_index=0):
+        m_master_key(private_key),
+        m_entropy(m_master_key, 0),
+        m_next_index(next_index),
+        m_salt(m_entropy),
+        m_hashfunction(m_salt),
+        m_empty(),
+        m_nodes(node_file_path, file_size)
+    {
+        uint8_t *header = m_nodes.data();
+        if (std::memcmp(header, "spq-nod2", 8) != 0 or
+            header[8] != merkleheight or
+            header[9] > merkleheight + 1 or
+            this->leaves_done() > leaf_count or
+            std::memcmp(header + 24, m_salt.c_str(), hashlen) != 0) {
+            //New, stale or corrupt node file, start from scratch.
+            std::memset(header, 0, header_size);
+            std::memcpy(header, "spq-nod2", 8);
+            header[8] = merkleheight;
+            std::memcpy(header + 24, m_salt.c_str(), hashlen);
+        }
+        this->build();
+    }
+    virtual ~mapped_signing_key() {}
+    //Sign a hashlength bytes long digest.
+    std::string sign_digest(std::string digest)
+    {
+        if (digest.length() != hashlen) {
+            throw std::invalid_argument("Digest to sign must be hashlen bytes long.");
+        }
+        //Throw an exception when key is already fully exhausted
+        if (this->m_next_index >= leaf_count) {
+            throw signingkey_exhausted();
+        }
+        //Get the signature index in network order.
+        std::string ndxs = non_api::encode_signature_index(this->m_next_index);
+        //The one-time private key gets derived just for this signature.
+        auto privkey = this->private_key(static_cast<uint32_t>(m_next_index));
+        std::string rval = this->pubkey() + m_salt + ndxs + this->auth_path(static_cast<uint32_t>(m_next_index)) + privkey[digest];
         this->m_next_index++;
         return rval;
-    };
+    }
     //Sign an arbitrary length message
-    std::string sign_message(std::string &message)
+    std::string sign_message(const std::string &message)
     {
-        //Take the hash of the message.
         std::string digest = m_hashfunction(message);
-        //Sign the hash
         return this->sign_digest(digest);
-    };
-    //Future API call for serializing the signing key.
-    std::tuple<std::string,  uint16_t, std::string>  get_state()
+    }
+    //Get an incremental hasher for a message to sign, salted for this key.
+    message_hasher<hashlen> hasher()
     {
-        return std::make_tuple(m_hashfunction.get_salt(), m_next_index,  m_privkeys.pubkey());
+        return message_hasher<hashlen>(m_salt);
     }
-    uint16_t get_next_index()
+    uint64_t get_next_index()
     {
         return m_next_index;
     }
     std::string pubkey()
     {
-        return m_merkle_tree.pubkey();
+        return this->node(0);
+    }
+    //Create a fresh private key for a mapped signing key.
+    static std::string new_private_key() {
+        return non_api::master_key<hashlen>();
     }
-    //Virtual destructor
-    virtual ~signing_key() {}
 private:
+    //The pubkey_size of a private key only matters to private_keys, that a mapped key does not use.
+    typedef non_api::private_key<hashlen, subkey_count, wotsbits, merkleheight, 0> private_key_type;
+    private_key_type private_key(uint32_t index)
+    {
+        return private_key_type(m_hashfunction, m_entropy[index], index, m_empty,
+                                static_cast<uint64_t>(m_entropy) + 1 + 2 * static_cast<uint64_t>(index) * subkey_count);
+    }
+    std::string node(size_t index)
+    {
+        if (index >= node_count) {
+            throw std::out_of_range("invalid merkle tree node index");
+        }
+        return std::string(reinterpret_cast<const char *>(m_nodes.data() + header_size + hashlen * index), hashlen);
+    }
+    void set_node(size_t index, const std::string &value)
+    {
+        if (index >= node_count) {
+            throw std::out_of_range("invalid merkle tree node index");
+        }
+        std::memcpy(m_nodes.data() + header_size + hashlen * index, value.c_str(), hashlen);
+    }
+    //The number of leaves built so far, as recorded in the node file header.
+    uint64_t leaves_done()
+    {
+        uint64_t rval = 0;
+        for (size_t index=0; index < 8; index++) {
+            rval = (rval << 8) | m_nodes.data()[16 + index];
+        }
+        return rval;
+    }
+    void set_leaves_done(uint64_t done)
+    {
+        for (size_t index=0; index < 8; index++) {
+            m_nodes.data()[16 + index] = static_cast<uint8_t>(done >> (8 * (7 - index)));
+        }
+    }
+    //The merkle-tree signature-header, the sibling node at every depth, from the top down.
+    std::string auth_path(uint32_t signing_key_index)
+    {
+        std::string rval;
+        for (uint8_t depth=1; depth <= merkleheight; depth++) {
+            size_t sibling = (signing_key_index >> (merkleheight - depth)) ^ 1;
+            rval += this->node((static_cast<size_t>(1) << depth) - 1 + sibling);
+        }
+        return rval;
+    }
+    //Build the tree level by level, leaves first, resuming where an earlier build was interrupted.
+    void build()
+    {
+        uint8_t *header = m_nodes.data();
+        constexpr size_t first_leaf = static_cast<size_t>(leaf_count) - 1;
+        for (uint64_t index = this->leaves_done(); index < leaf_count; index++) {
+            std::string pkey = this->private_key(static_cast<uint32_t>(index)).pubkey();
+            this->set_node(first_leaf + static_cast<size_t>(index), m_hashfunction(pkey));
+            this->set_leaves_done(index + 1);
+        }
+        if (header[9] == 0) {
+            header[9] = 1;
+        }
+        //Level 'levels done' counts from the leaves up, the leaves themselves being the first.
+        for (uint8_t level = header[9]; level <= merkleheight; level++) {
+            uint8_t depth = static_cast<uint8_t>(merkleheight - level);
+            size_t first = (static_cast<size_t>(1) << depth) - 1;
+            uint8_t *nodes = m_nodes.data() + header_size;
+            m_hashfunction.template hash_nodes<2>(nodes + hashlen * (2 * first + 1),
+                                                  static_cast<size_t>(1) << depth,
+                                                  nodes + hashlen * first);
+            header[9] = static_cast<uint8_t>(level + 1);
+        }
+        m_nodes.sync();
+    }
+    non_api::master_key<hashlen> m_master_key;
     non_api::unique_index_generator<hashlen, wotsbits, merkleheight> m_entropy;
-    uint16_t m_next_index;
+    uint64_t m_next_index;
     std::string m_salt;
     non_api::primative<hashlen, wotsbits, merkleheight> m_hashfunction;
     std::string m_empty;
-    uint64_t m_master_index;
-    non_api::private_keys<hashlen, merkleheight, wotsbits, static_cast<unsigned short>(1) << merkleheight > m_privkeys;
-    merkle_tree m_merkle_tree;
+    non_api::mapped_file m_nodes;
 };
 
 // The multi-tree variant of the signing key. First for three and more merkle trees.
-template<uint8_t hashlen, uint8_t wotsbits, uint8_t merkleheight, uint8_t merkleheight2, uint8_t ...Args>
+template<uint8_t hashlen, uint64_t wotsbits, uint8_t merkleheight, uint8_t merkleheight2, uint8_t ...Args>
 struct multi_signing_key {
     //Hash length must be 16 up to 64 bytes long.
     static_assert(hashlen > 15, "Hash size should be at least 128 bits (16 bytes).");
     static_assert(hashlen < 65,  "Hash size of more then 512 bits is not supported");
     //The number of bits used for wots encoding must be 3 upto 16 bits.
-    static_assert(wotsbits < 17, "Wots chains longer than 64k hash operations (wotsbits>16) are not supported");
-    static_assert(wotsbits > 3, "A wots chain should be at least 16 hash operations long (wotsbits > 1)");
+    static_assert(non_api::level_wotsbits(wotsbits) < 17, "Wots chains longer than 64k hash operations (wotsbits>16) are not supported");
+    static_assert(non_api::level_wotsbits(wotsbits) > 3, "A wots chain should be at least 16 hash operations long (wotsbits > 1)");
     //The height of a singe merkle-tree must be 3 up to 16 levels.
     static_assert(merkleheight < 17, "A single merkle tree should not be more than 16 levels high");
     static_assert(merkleheight > 2, "A single merkle tree should be at least two levels high. A value between 8 and 10 is recomended");
     static_assert(merkleheight2 < 17, "A single merkle tree should not be more than 16 levels high");
     static_assert(merkleheight2 > 2, "A single merkle tree should be at least two levels high. A value between 8 and 10 is recomended");
-    static_assert(39 * wotsbits >= hashlen * 8, "Wotsbits and hashlen must not combine into signing keys of more than 39 subkeys each");
-    multi_signing_key(bool assume_peer_caching, non_api::unique_index_generator<hashlen, wotsbits, merkleheight, merkleheight2, Args...> entropy):
+    static_assert(39 * non_api::level_wotsbits(wotsbits) >= hashlen * 8, "Wotsbits and hashlen must not combine into signing keys of more than 39 subkeys each");
+    //A per-level wotsbits specification needs one entry per merkle tree, no more and no less.
+    static_assert(non_api::wotsbits_levels_match(wotsbits, 2 + sizeof...(Args)), "Per-level wotsbits must list the wotsbits of every merkle tree, and of no more");
+    //The whole stack must be addressable with a 64 bit signature index and a 64 bit key derivation index.
+    static_assert(non_api::determine_signature_index_bits<merkleheight, merkleheight2, Args...>() <= 64, "The merkle trees of a key must not add up to more than 64 levels");
+    static_assert(non_api::determine_saturated_keycount<hashlen, wotsbits, merkleheight, merkleheight2, Args...>() < UINT64_MAX, "The key index space of a key must fit in 64 bits");
+    //Constructor, optionaly takes a global signature index for fast-forwarding a restored key to that position.
+    //Only the trees on the path to the signature index get generated, one tree per level. An optional keygen
+    //checkpoint makes generating these trees resumable.
+    multi_signing_key(bool assume_peer_caching,
+                      non_api::unique_index_generator<hashlen, wotsbits, merkleheight, merkleheight2, Args...> entropy,
+                      uint64_t signature_index=0,
+                      keygen_checkpoint<hashlen> *checkpoint=nullptr):
 	m_entropy(entropy),
-	m_child_index(0),
-	m_root_key(entropy.cast()),
-        m_signing_key(assume_peer_caching, entropy(m_child_index)),
+	m_child_index(non_api::determine_child_index<merkleheight, merkleheight2, Args...>(signature_index)),
+	m_root_key(entropy.cast(), m_child_index, checkpoint),
+        m_signing_key(assume_peer_caching,
+                      entropy(m_child_index),
+                      non_api::determine_index_within_child<merkleheight2, Args...>(signature_index),
+                      checkpoint),
         m_signing_key_signature(m_root_key.sign_digest(m_signing_key.pubkey())),
         m_assume_peer_caching(assume_peer_caching) {
 	}
-    std::pair<std::string, std::vector<std::pair<std::string, std::string>>> sign_message(std::string &message)
+    std::pair<std::string, std::vector<std::pair<std::string, std::string>>> sign_message(const std::string &message)
+    {
+        return this->sign_digest(this->hasher().update(message).finish());
+    }
+    //Sign a digest. The digest must come from a hasher obtained from this key after the previous signature was made,
+    //as the next signature may be made by a fresh bottom-level key with a different salt.
+    std::pair<std::string, std::vector<std::pair<std::string, std::string>>> sign_digest(const std::string &digest)
+    {
+        //Checked before prepare, so a bad digest can't roll over to a fresh bottom-level key.
+        if (digest.length() != hashlen) {
+            throw std::invalid_argument("Digest to sign must be hashlen bytes long.");
+        }
+        this->prepare();
+        auto rval = m_signing_key.sign_digest(digest);
+        rval.second.push_back(std::make_pair(m_signing_key.pubkey(), m_signing_key_signature));
+        return rval;
+    }
+    //Get an incremental hasher for the next message to sign, salted for the bottom-level key that will sign it.
+    message_hasher<hashlen> hasher()
+    {
+        this->prepare();
+        return m_signing_key.hasher();
+    }
+    //Make sure the next signature can be made without switching keys, refreshing exhausted levels if needed.
+    void prepare()
     {
         try {
-            auto rval = m_signing_key.sign_message(message);
-            rval.second.push_back(std::make_pair(m_signing_key.pubkey(), m_signing_key_signature));
-            return rval;
+            m_signing_key.prepare();
         }
         catch  (const spqsigs::signingkey_exhausted&) {
-            m_signing_key.refresh();
-            m_signing_key_signature = m_root_key.sign_digest(m_signing_key.pubkey());
-            auto rval = m_signing_key.sign_message(message);
-            rval.second.push_back(std::make_pair(m_signing_key.pubkey(), m_signing_key_signature));
-            return rval;
+            this->refresh();
         }
     }
-    std::vector<std::pair<std::tuple<std::string, uint16_t, std::string>, std::string>> get_state()
+    std::vector<std::pair<std::tuple<std::string, uint64_t, std::string>, std::string>> get_state()
     {
         auto rval = m_signing_key.get_state();
-        rval.push_back(std::pair<std::tuple<std::string, uint16_t, std::string>, std::string>(m_root_key.get_state(), m_signing_key_signature));
+        rval.push_back(std::pair<std::tuple<std::string, uint64_t, std::string>, std::string>(m_root_key.get_state(), m_signing_key_signature));
         return rval;
     }
 
@@ -866,83 +2475,129 @@ struct multi_signing_key {
     {
         return m_root_key.pubkey();
     }
+    //Get the global index of the next signature, usable for fast-forward restoring the key later on.
+    uint64_t get_next_index()
+    {
+        return (static_cast<uint64_t>(m_child_index) << non_api::determine_signature_index_bits<merkleheight2, Args...>()) +
+               m_signing_key.get_next_index();
+    }
     void refresh()
     {
+        //Running out of child keys means this level is exhausted too.
+        if (m_child_index + 1 >= (static_cast<uint64_t>(1) << merkleheight)) {
+            throw signingkey_exhausted();
+        }
 	m_child_index++;
 	m_signing_key.refresh(m_entropy(m_child_index));
 	m_signing_key_signature = m_root_key.sign_digest(m_signing_key.pubkey());
     }
-    void refresh(non_api::unique_index_generator<hashlen, wotsbits, merkleheight2, Args...> new_entropy)
+    void refresh(non_api::unique_index_generator<hashlen, wotsbits, merkleheight, merkleheight2, Args...> new_entropy)
     {   
 	m_entropy = new_entropy;
 	m_child_index = 0;
-        m_root_key.refresh(new_entropy);
+        m_root_key.refresh(new_entropy.cast());
         m_signing_key.refresh(m_entropy(m_child_index));
         m_signing_key_signature = m_root_key.sign_digest(m_signing_key.pubkey());
     }
     virtual ~multi_signing_key() {}
 private:
     non_api::unique_index_generator<hashlen, wotsbits, merkleheight, merkleheight2, Args...> m_entropy;
-    uint16_t m_child_index;
-    signing_key<hashlen, wotsbits, merkleheight> m_root_key;
-    multi_signing_key<hashlen, wotsbits, merkleheight2, Args...> m_signing_key;
+    uint64_t m_child_index;
+    signing_key<hashlen, non_api::level_wotsbits(wotsbits), merkleheight, non_api::level_ots<wotsbits>> m_root_key;
+    multi_signing_key<hashlen, non_api::lower_wotsbits(wotsbits, 1 + sizeof...(Args)), merkleheight2, Args...> m_signing_key;
     std::string m_signing_key_signature;
     bool m_assume_peer_caching;
 };
 
 // The multi-tree variant of the signing key. This one is for two merkle trees to close of the stack.
-template<uint8_t hashlen, uint8_t wotsbits, uint8_t merkleheight, uint8_t merkleheight2>
+template<uint8_t hashlen, uint64_t wotsbits, uint8_t merkleheight, uint8_t merkleheight2>
 struct multi_signing_key<hashlen, wotsbits, merkleheight, merkleheight2> {
     //Hash length must be 16 up to 64 bytes long.
     static_assert(hashlen > 15, "Hash size should be at least 128 bits (16 bytes).");
     static_assert(hashlen < 65,  "Hash size of more then 512 bits is not supported");
     //The number of bits used for wots encoding must be 3 upto 16 bits.
-    static_assert(wotsbits < 17, "Wots chains longer than 64k hash operations (wotsbits>16) are not supported");
-    static_assert(wotsbits > 3, "A wots chain should be at least 16 hash operations long (wotsbits > 1)");
+    static_assert(non_api::level_wotsbits(wotsbits) < 17, "Wots chains longer than 64k hash operations (wotsbits>16) are not supported");
+    static_assert(non_api::level_wotsbits(wotsbits) > 3, "A wots chain should be at least 16 hash operations long (wotsbits > 1)");
     //The height of a singe merkle-tree must be 3 up to 16 levels.
     static_assert(merkleheight < 17, "A single merkle tree should not be more than 16 levels high");
     static_assert(merkleheight > 2, "A single merkle tree should be at least two levels high. A value between 8 and 10 is recomended");
     static_assert(merkleheight2 < 17, "A single merkle tree should not be more than 16 levels high");
     static_assert(merkleheight2 > 2, "A single merkle tree should be at least two levels high. A value between 8 and 10 is recomended");
-    static_assert(39 * wotsbits >= hashlen * 8, "Wotsbits and hashlen must not combine into signing keys of more than 39 subkeys each");
-    multi_signing_key(bool assume_peer_caching, non_api::unique_index_generator<hashlen, wotsbits, merkleheight, merkleheight2> entropy) :
+    static_assert(39 * non_api::level_wotsbits(wotsbits) >= hashlen * 8, "Wotsbits and hashlen must not combine into signing keys of more than 39 subkeys each");
+    //A per-level wotsbits specification needs one entry per merkle tree, no more and no less.
+    static_assert(non_api::wotsbits_levels_match(wotsbits, 2), "Per-level wotsbits must list the wotsbits of every merkle tree, and of no more");
+    //The whole stack must be addressable with a 64 bit signature index and a 64 bit key derivation index.
+    static_assert(non_api::determine_signature_index_bits<merkleheight, merkleheight2>() <= 64, "The merkle trees of a key must not add up to more than 64 levels");
+    static_assert(non_api::determine_saturated_keycount<hashlen, wotsbits, merkleheight, merkleheight2>() < UINT64_MAX, "The key index space of a key must fit in 64 bits");
+    //Constructor, optionaly takes a global signature index for fast-forwarding a restored key to that position,
+    //and a keygen checkpoint to make generating the trees resumable.
+    multi_signing_key(bool assume_peer_caching,
+                      non_api::unique_index_generator<hashlen, wotsbits, merkleheight, merkleheight2> entropy,
+                      uint64_t signature_index=0,
+                      keygen_checkpoint<hashlen> *checkpoint=nullptr) :
 	m_entropy(entropy),
 	m_cast(entropy.cast()),
-	m_child_index(0),
-        m_root_key(m_cast),
-        m_signing_key(entropy(m_child_index)),
+	m_child_index(non_api::determine_child_index<merkleheight, merkleheight2>(signature_index)),
+        m_root_key(m_cast, m_child_index, checkpoint),
+        m_signing_key(entropy(m_child_index),
+                      non_api::determine_index_within_child<merkleheight2>(signature_index),
+                      checkpoint),
         m_signing_key_signature(m_root_key.sign_digest(m_signing_key.pubkey())),
         m_assume_peer_caching(assume_peer_caching) {
 	}
-    std::pair<std::string, std::vector<std::pair<std::string, std::string>>> sign_message(std::string &message)
+    std::pair<std::string, std::vector<std::pair<std::string, std::string>>> sign_message(const std::string &message)
     {
-        std::string signature;
-        try {
-            signature = m_signing_key.sign_message(message);
-        }
-        catch  (const spqsigs::signingkey_exhausted&) {
-            m_child_index++;
-            m_signing_key.refresh(m_entropy(m_child_index));
-            m_signing_key_signature = m_root_key.sign_digest(m_signing_key.pubkey());
-            signature = m_signing_key.sign_message(message);
+        return this->sign_digest(this->hasher().update(message).finish());
+    }
+    //Sign a digest. The digest must come from a hasher obtained from this key after the previous signature was made,
+    //as the next signature may be made by a fresh bottom-level key with a different salt.
+    std::pair<std::string, std::vector<std::pair<std::string, std::string>>> sign_digest(const std::string &digest)
+    {
+        //Checked before prepare, so a bad digest can't roll over to a fresh bottom-level key.
+        if (digest.length() != hashlen) {
+            throw std::invalid_argument("Digest to sign must be hashlen bytes long.");
         }
+        this->prepare();
+        std::string signature = m_signing_key.sign_digest(digest);
         std::vector<std::pair<std::string, std::string>> rval;
         rval.push_back(std::make_pair(m_signing_key.pubkey(), m_signing_key_signature));
         return std::make_pair(signature,rval);
     }
-    std::vector<std::pair<std::tuple<std::string, uint16_t, std::string>, std::string>> get_state()
+    //Get an incremental hasher for the next message to sign, salted for the bottom-level key that will sign it.
+    message_hasher<hashlen> hasher()
+    {
+        this->prepare();
+        return m_signing_key.hasher();
+    }
+    //Make sure the next signature can be made without switching keys, refreshing the bottom-level key if needed.
+    void prepare()
     {
-        std::vector<std::pair<std::tuple<std::string, uint16_t, std::string>, std::string>> rval;
-        rval.push_back(std::pair<std::tuple<std::string, uint16_t, std::string>, std::string>(m_signing_key.get_state(), std::string("")));
-        rval.push_back(std::pair<std::tuple<std::string, uint16_t, std::string>, std::string>(m_root_key.get_state(), m_signing_key_signature));
+        if (m_signing_key.exhausted()) {
+            this->refresh();
+        }
+    }
+    std::vector<std::pair<std::tuple<std::string, uint64_t, std::string>, std::string>> get_state()
+    {
+        std::vector<std::pair<std::tuple<std::string, uint64_t, std::string>, std::string>> rval;
+        rval.push_back(std::pair<std::tuple<std::string, uint64_t, std::string>, std::string>(m_signing_key.get_state(), std::string("")));
+        rval.push_back(std::pair<std::tuple<std::string, uint64_t, std::string>, std::string>(m_root_key.get_state(), m_signing_key_signature));
         return rval;
     }
     std::string pubkey()
     {
         return m_root_key.pubkey();
     }
+    //Get the global index of the next signature, usable for fast-forward restoring the key later on.
+    uint64_t get_next_index()
+    {
+        return (static_cast<uint64_t>(m_child_index) << merkleheight2) + m_signing_key.get_next_index();
+    }
     void refresh()
     {
+        //Running out of child keys means this level is exhausted too.
+        if (m_child_index + 1 >= (static_cast<uint64_t>(1) << merkleheight)) {
+            throw signingkey_exhausted();
+        }
 	m_child_index++;
 	m_signing_key.refresh(m_entropy(m_child_index));
 	m_signing_key_signature = m_root_key.sign_digest(m_signing_key.pubkey());
@@ -961,161 +2616,683 @@ struct multi_signing_key<hashlen, wotsbits, merkleheight, merkleheight2> {
     virtual ~multi_signing_key() {}
 private:
     non_api::unique_index_generator<hashlen, wotsbits, merkleheight, merkleheight2> m_entropy;
-    non_api::unique_index_generator<hashlen, wotsbits, merkleheight> m_cast;
-    uint16_t m_child_index;
-    signing_key<hashlen, wotsbits, merkleheight> m_root_key;
-    signing_key<hashlen, wotsbits, merkleheight2> m_signing_key;
+    non_api::unique_index_generator<hashlen, non_api::level_wotsbits(wotsbits), merkleheight> m_cast;
+    uint64_t m_child_index;
+    signing_key<hashlen, non_api::level_wotsbits(wotsbits), merkleheight, non_api::level_ots<wotsbits>> m_root_key;
+    signing_key<hashlen, non_api::lower_wotsbits(wotsbits, 1), merkleheight2, non_api::level_ots<wotsbits>> m_signing_key;
     std::string m_signing_key_signature;
     bool m_assume_peer_caching;
 };
 
 // Work In Progress
-template<uint8_t hashlen, uint8_t ...Args> 
+template<uint8_t hashlen, uint64_t wotsbits, uint8_t ...Args>
 struct spq_signing_key {
         spq_signing_key(bool assume_peer_caching=false): m_master_key(), m_entropy(m_master_key), m_multi_key(assume_peer_caching, m_entropy) {}
 	spq_signing_key(std::string private_key, bool assume_peer_caching): m_master_key(private_key), m_entropy(m_master_key), m_multi_key(assume_peer_caching, m_entropy) {}
-        std::pair<std::string, std::vector<std::pair<std::string, std::string>>> sign_message(std::string &message) {
+        //Restore a key from its private key and the global index of the next signature to make. Only the trees on the
+        //path to that index get generated, so restoring takes one tree per level no matter how far the key has progressed.
+	spq_signing_key(std::string private_key, bool assume_peer_caching, uint64_t signature_index):
+            m_master_key(private_key),
+            m_entropy(m_master_key),
+            m_multi_key(assume_peer_caching, m_entropy, signature_index) {}
+        //Resumable key generation. The checkpoint is updated as trees get generated and, after an interrupted run,
+        //lets a new run continue from the last completed subtree. The private key must be persisted up front.
+	spq_signing_key(std::string private_key, bool assume_peer_caching, uint64_t signature_index, keygen_checkpoint<hashlen> &checkpoint):
+            m_master_key(private_key),
+            m_entropy(m_master_key),
+            m_multi_key(assume_peer_caching, m_entropy, signature_index, &checkpoint) {}
+        //Create a fresh private key without generating any trees yet, for use with resumable key generation.
+        static std::string new_private_key() {
+            return non_api::master_key<hashlen>();
+        }
+        std::pair<std::string, std::vector<std::pair<std::string, std::string>>> sign_message(const std::string &message) {
             return m_multi_key.sign_message(message);
 	}
+        //Sign a digest obtained from hasher(), for messages that are too large to keep in memory.
+        std::pair<std::string, std::vector<std::pair<std::string, std::string>>> sign_digest(const std::string &digest) {
+            return m_multi_key.sign_digest(digest);
+	}
+        //Get an incremental hasher for the next message to sign.
+        message_hasher<hashlen> hasher() {
+            return m_multi_key.hasher();
+	}
 	std::string public_key() {
 	    return m_multi_key.pubkey();
 	}
 	std::string private_key() {
             return m_master_key;
 	}
+        //Get the global index of the next signature, to be persisted for later fast-forward restoring.
+        uint64_t get_next_index() {
+            return m_multi_key.get_next_index();
+        }
     private:
         non_api::master_key<hashlen> m_master_key;
-	non_api::unique_index_generator<hashlen, Args...> m_entropy;
-	multi_signing_key<hashlen, Args...> m_multi_key;
+	non_api::unique_index_generator<hashlen, wotsbits, Args...> m_entropy;
+	multi_signing_key<hashlen, wotsbits, Args...> m_multi_key;
+};
+
+//Public-API signature
+//Verifier-side cache of merkle tree nodes already proven to lie on a valid path to a tree's pubkey, for verifying
+//many signatures from the same trees. A signature whose recomputed path meets a proven node can stop climbing
+//there, and one whose auth path contradicts a proven node is rejected before any WOTS chain gets completed. Nodes
+//are kept per tree pubkey, for a bounded number of trees, the oldest tree getting dropped first.
+template<uint8_t hashlen, uint8_t merkleheight>
+struct merkle_node_cache {
+    merkle_node_cache(size_t max_trees=16): m_mutex(), m_trees(), m_order(), m_max_trees(max_trees == 0 ? 1 : max_trees) {}
+    //Look up the proven node at height (in signature index bits, zero for leaves) and position within that height.
+    bool get(const std::string &pubkey, unsigned int height, uint64_t position, std::string &node)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto tree = m_trees.find(pubkey);
+        if (tree == m_trees.end()) {
+            return false;
+        }
+        auto found = tree->second.find(node_key(height, position));
+        if (found == tree->second.end()) {
+            return false;
+        }
+        node = found->second;
+        return true;
+    }
+    //Record proven nodes as (height, position, node) tuples.
+    void put(const std::string &pubkey, const std::vector<std::tuple<unsigned int, uint64_t, std::string>> &nodes)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_trees.count(pubkey) == 0) {
+            if (m_order.size() >= m_max_trees) {
+                m_trees.erase(m_order.front());
+                m_order.erase(m_order.begin());
+            }
+            m_order.push_back(pubkey);
+        }
+        auto &tree = m_trees[pubkey];
+        for (auto &node : nodes) {
+            tree[node_key(std::get<0>(node), std::get<1>(node))] = std::get<2>(node);
+        }
+    }
+private:
+    //Heap-style node number, the root being one.
+    static uint64_t node_key(unsigned int height, uint64_t position)
+    {
+        return (1ull << (merkleheight - height)) | position;
+    }
+    std::mutex m_mutex;
+    std::map<std::string, std::unordered_map<uint64_t, std::string>> m_trees;
+    std::vector<std::string> m_order;
+    size_t m_max_trees;
+};
+
+template<uint8_t hashlen, uint8_t wotsbits, uint8_t merkleheight, typename ots, uint8_t arity, typename backend>
+struct signature {
+    //Hash length must be 16 up to 64 bytes long.
+    static_assert(hashlen > 15, "Hash size should be at least 128 bits (16 bytes).");
+    static_assert(hashlen < 65,  "Hash size of more then 512 bits is not supported");
+    //The number of bits used for wots encoding must be 3 upto 16 bits.
+    static_assert(wotsbits < 17, "Wots chains longer than 64k hash operations (wotsbits>16) are not supported");
+    static_assert(wotsbits > 3, "A wots chain should be at least 16 hash operations long (wotsbits > 1)");
+    //The height of a singe merkle-tree must be 3 up to 32 levels, 16 when kept in memory.
+    static_assert(merkleheight < 33, "A single merkle tree should not be more than 32 levels high");
+    static_assert(merkleheight > 2, "A single merkle tree should be at least two levels high. A value between 8 and 10 is recomended");
+    static_assert(39 * wotsbits >= hashlen * 8, "Wotsbits and hashlen must not combine into signing keys of more than 39 subkeys each");
+    //The arity must be a power of two, 2 up to 16, and its index bits must divide the tree height.
+    static_assert(arity > 1 and arity < 17 and (arity & (arity - 1)) == 0, "Merkle tree arity should be 2, 4, 8 or 16");
+    static_assert(merkleheight % non_api::determine_arity_bits<arity>() == 0, "Merkle tree height must be a multiple of the index bits per level of its arity");
+    //Index bits per merkle tree level, number of levels and number of auth-path nodes.
+    static constexpr uint8_t arity_bits = non_api::determine_arity_bits<arity>();
+    static constexpr size_t depth = merkleheight / arity_bits;
+    static constexpr size_t auth_path_nodes = non_api::determine_auth_path_nodes<merkleheight, arity>();
+    signature(std::string_view sigstring): m_pubkey(), m_salt(), m_index(0), m_merkle_tree_header(), m_signature_body()
+    {
+        constexpr int subkey_count = non_api::determine_ots_subkeys<ots, hashlen, wotsbits>();
+        constexpr int chains = ots::single_chain ? 1 : 2;
+        constexpr size_t ib = non_api::signature_index_bytes;
+        constexpr size_t nodes = auth_path_nodes;
+        constexpr size_t expected_length = ib + hashlen * (2 + nodes + non_api::determine_ots_chain_values<ots, hashlen, wotsbits>());
+        // * check signature length
+        if (sigstring.length() != expected_length) {
+            throw std::invalid_argument("Wrong signature size. *1");
+        }
+        // * get pubkey, salt, index, mt-header and wots-body and store them till validate gets invoked
+        m_pubkey = std::string(sigstring.data(), hashlen);
+        m_salt = std::string(sigstring.data()+hashlen, hashlen);
+        m_index = non_api::decode_signature_index(sigstring.data()+hashlen*2);
+        //The auth path comes root first, store it leaf first, keeping the siblings of a level in child order.
+        for (size_t level=depth; level > 0; level--) {
+            for (size_t sibling=0; sibling < arity - 1; sibling++) {
+                size_t index = (level - 1) * (arity - 1) + sibling;
+                m_merkle_tree_header.push_back(std::string(sigstring.data()+hashlen*(2+index)+ib, hashlen));
+            }
+        }
+        for (int index=0; index < subkey_count; index++) {
+            std::vector<std::string> newval;
+            for (int direction=0; direction<chains; direction++) {
+                newval.push_back(std::string(sigstring.data()+ib + hashlen * (2 + nodes + chains * index + direction),
+                                             hashlen));
+            }
+            m_signature_body.push_back(newval);
+        }
+    }
+    //Number of hash operations a validation may take, the chains, the leaf and the auth path, plus one for hashing
+    //a message that isn't a digest yet.
+    static constexpr uint64_t validation_cost(bool is_digest=true)
+    {
+        constexpr uint64_t subkey_count = non_api::determine_ots_subkeys<ots, hashlen, wotsbits>();
+        constexpr uint64_t per_subkey = ots::single_chain ? (1ull << wotsbits) - 1 : (1ull << wotsbits) + 2;
+        return subkey_count * per_subkey + 1 + depth + (is_digest ? 0 : 1);
+    }
+    //Structural checks that need no hashing at all.
+    bool well_formed()
+    {
+        return m_index < (1ull << merkleheight);
+    }
+    //Every check that needs no hashing runs first, so junk gets rejected for free. If hash_budget is given, the
+    //validation is refused with hash_budget_exceeded before any hashing when it could take more hash operations than
+    //the budget has left, else its cost is taken from the budget.
+    bool validate(const std::string &message,
+                  bool is_digest=false,
+                  merkle_node_cache<hashlen, merkleheight> *node_cache=nullptr,
+                  uint64_t *hash_budget=nullptr)
+    {
+        if (not well_formed() or (is_digest and message.size() != hashlen)) {
+            return false;
+        }
+        uint64_t leaf = m_index;
+        // * reject right away if the auth path contradicts nodes already proven for this tree
+        std::string known;
+        if (node_cache != nullptr) {
+            for (size_t level=0; level < depth; level++) {
+                unsigned int height = static_cast<unsigned int>(level * arity_bits);
+                for (uint64_t sibling=0; sibling < arity - 1; sibling++) {
+                    if (node_cache->get(m_pubkey, height, sibling_position(leaf >> height, sibling), known) and
+                        known != m_merkle_tree_header[level * (arity - 1) + sibling]) {
+                        return false;
+                    }
+                }
+            }
+        }
+        if (hash_budget != nullptr) {
+            if (*hash_budget < validation_cost(is_digest)) {
+                throw hash_budget_exceeded();
+            }
+            *hash_budget -= validation_cost(is_digest);
+        }
+        // * get the message digest
+        non_api::primative<hashlen, wotsbits, merkleheight, backend> hashfunction(m_salt);
+        std::string digest = message;
+        if (is_digest == false) {
+            digest = hashfunction(message);
+        }
+        //Convert the digest to a list of numbers, the same list used for signing.
+        auto numlist = non_api::digest_to_numlist<hashlen, wotsbits>(digest);
+        if constexpr (ots::single_chain) {
+            non_api::append_checksum<hashlen, wotsbits>(numlist);
+        }
+        // * complete the wots chains and calculate what should be the WOTS pubkey for this index.
+        std::string big_ots_pubkey("");
+        for (size_t index=0; index < numlist.size(); index++) {
+            auto signature_chunk = m_signature_body[index];
+            int chunk_num = numlist[index];
+            if constexpr (ots::single_chain) {
+                big_ots_pubkey += hashfunction(signature_chunk[0], (1 << wotsbits) - 1 - chunk_num);
+                continue;
+            }
+            //Complete wots chains
+            std::string pk1 = hashfunction(signature_chunk[0], (1 << wotsbits) - chunk_num);
+            std::string pk2 = hashfunction(signature_chunk[1], chunk_num + 1);
+            //Combine left and right into one pubkey and append that to the big WOTS pubkey reconstruction.
+            big_ots_pubkey += hashfunction(pk1, pk2);
+        }
+        //Take the salted hash of the large WOTS pubkey reconstruction
+        std::string calculated_pubkey = hashfunction(big_ots_pubkey);
+        std::vector<std::tuple<unsigned int, uint64_t, std::string>> path;
+        //Reconstruct what should be the pubkey from the previous hash and the merkle-tree header nodes.
+        for (size_t level=0; level < depth; level++) {
+            unsigned int height = static_cast<unsigned int>(level * arity_bits);
+            uint64_t position = leaf >> height;
+            const std::string *siblings = &m_merkle_tree_header[level * (arity - 1)];
+            if (node_cache != nullptr) {
+                //Meeting a proven node settles it, one way or the other.
+                if (node_cache->get(m_pubkey, height, position, known)) {
+                    if (known != calculated_pubkey) {
+                        return false;
+                    }
+                    node_cache->put(m_pubkey, path);
+                    return true;
+                }
+                path.emplace_back(height, position, calculated_pubkey);
+                for (uint64_t sibling=0; sibling < arity - 1; sibling++) {
+                    path.emplace_back(height, sibling_position(position, sibling), siblings[sibling]);
+                }
+            }
+            uint64_t child = position & (arity - 1);
+            if constexpr (arity != 2) {
+                //Put the node on the path in between its siblings and hash all children in one go.
+                std::string children;
+                for (uint64_t sibling=0; sibling < arity - 1; sibling++) {
+                    if (sibling == child) {
+                        children += calculated_pubkey;
+                    }
+                    children += siblings[sibling];
+                }
+                if (child == arity - 1) {
+                    children += calculated_pubkey;
+                }
+                calculated_pubkey = hashfunction(children);
+            }
+            else if  (child == 1) {
+                calculated_pubkey = hashfunction(siblings[0], calculated_pubkey);
+            }
+            else {
+                calculated_pubkey = hashfunction(calculated_pubkey, siblings[0]);
+            }
+        }
+        //If everything is irie, the pubkey and the reconstructed pubkey should be the same.
+        if (calculated_pubkey != m_pubkey) {
+            return false;
+        }
+        if (node_cache != nullptr) {
+            node_cache->put(m_pubkey, path);
+        }
+        return true;
+    }
+    //Get an incremental hasher for the message, salted for the signing key, for use with digest-mode validate.
+    message_hasher<hashlen> hasher()
+    {
+        return message_hasher<hashlen>(m_salt);
+    }
+    //Get the current index, this is the statefull part of the signing key.
+    uint64_t get_index()
+    {
+        return m_index;
+    }
+    //Get the public key of the signing key.
+    std::string get_pubkey()
+    {
+        return m_pubkey;
+    }
+    //Get the value of the salt string for this signing key.
+    std::string get_pubkey_salt()
+    {
+        return m_salt;
+    }
+private:
+    //Position of the given sibling of the node at position, siblings counted in child order skipping the node itself.
+    static uint64_t sibling_position(uint64_t position, uint64_t sibling)
+    {
+        uint64_t child = position & (arity - 1);
+        return (position - child) + (sibling < child ? sibling : sibling + 1);
+    }
+    std::string m_pubkey;
+    std::string m_salt;
+    uint64_t m_index;
+    std::vector<std::string> m_merkle_tree_header;
+    std::vector<std::vector<std::string>> m_signature_body;
+};
+
+
+//Something that remembers (parent pubkey, child pubkey) pairs whose intermediate-level signature has been
+//verified, so a verifier that sees signatures from many subtrees pays for every intermediate-level signature only
+//once. The pair stands on its own, whatever the root it chains up to, so one such store can serve any number of
+//verifiers and threads.
+struct verified_pairs {
+    virtual bool contains(std::string_view parent, std::string_view child) = 0;
+    virtual void insert(std::string_view parent, std::string_view child) = 0;
+    virtual ~verified_pairs() {}
+};
+
+//In-process bounded cache of verified pairs, evicting with the CLOCK algorithm.
+template<uint8_t hashlen>
+struct verified_pair_cache: public verified_pairs {
+    verified_pair_cache(size_t capacity=1024): m_mutex(), m_index(), m_slots(), m_hand(0), m_capacity(capacity)
+    {
+        if (capacity == 0) {
+            throw std::invalid_argument("A verified pair cache needs a capacity of at least one.");
+        }
+        m_index.reserve(capacity);
+    }
+    bool contains(std::string_view parent, std::string_view child) override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto found = m_index.find(key(parent, child));
+        if (found == m_index.end()) {
+            return false;
+        }
+        m_slots[found->second].second = true;
+        return true;
+    }
+    void insert(std::string_view parent, std::string_view child) override
+    {
+        std::string pair = key(parent, child);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_index.count(pair) > 0) {
+            return;
+        }
+        if (m_slots.size() < m_capacity) {
+            m_index[pair] = m_slots.size();
+            m_slots.emplace_back(pair, false);
+            return;
+        }
+        //Sweep, giving recently used pairs a second chance.
+        while (m_slots[m_hand].second) {
+            m_slots[m_hand].second = false;
+            m_hand = (m_hand + 1) % m_capacity;
+        }
+        m_index.erase(m_slots[m_hand].first);
+        m_index[pair] = m_hand;
+        m_slots[m_hand] = std::make_pair(pair, false);
+        m_hand = (m_hand + 1) % m_capacity;
+    }
+    size_t size()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_slots.size();
+    }
+private:
+    static std::string key(std::string_view parent, std::string_view child)
+    {
+        std::string rval(parent);
+        rval.append(child);
+        return rval;
+    }
+    std::mutex m_mutex;
+    std::unordered_map<std::string, size_t> m_index;
+    std::vector<std::pair<std::string, bool>> m_slots;
+    size_t m_hand;
+    size_t m_capacity;
+};
+
+//Verified pairs shared by all processes on a host through a POSIX shared memory segment, so a pair verified by
+//one verifier process saves the work in all others. The segment holds a lock-free open-addressing table of
+//64-bit SipHash (crypto_shorthash) values of the pairs, keyed with a random key kept in the segment, so outsiders
+//can't aim for hash collisions. When all slots within probing distance are taken a new pair replaces the first
+//one. Whoever creates the segment initializes it, other processes wait for that to finish. If the creator died
+//before publishing the table, the first process to notice takes over its initialization.
+struct shared_pair_table: public verified_pairs {
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "Shared pair table needs lock-free 64-bit atomics");
+    static constexpr size_t header_size = 64;
+    static constexpr size_t max_probe = 16;
+    //Open or create the named segment (for example "/spqsigs-pairs") with room for capacity pair hashes.
+    shared_pair_table(const std::string &name, size_t capacity=1 << 20): m_size(0), m_data(nullptr), m_mask(0), m_slots(nullptr)
+    {
+        size_t slots = 1;
+        while (slots < capacity) {
+            slots <<= 1;
+        }
+        m_size = header_size + slots * sizeof(uint64_t);
+        bool created = true;
+        int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0 and errno == EEXIST) {
+            created = false;
+            fd = ::shm_open(name.c_str(), O_RDWR, 0600);
+        }
+        if (fd < 0) {
+            throw std::runtime_error("Unable to open shared memory segment " + name);
+        }
+        if (created) {
+            if (::ftruncate(fd, static_cast<off_t>(m_size)) != 0) {
+                ::close(fd);
+                throw std::runtime_error("Unable to size shared memory segment " + name);
+            }
+        }
+        else {
+            //Wait for the creator to size the segment, then use its capacity. A creator that died before sizing it
+            //leaves an empty segment, that gets our capacity instead.
+            struct stat info;
+            int tries = 0;
+            while (::fstat(fd, &info) == 0 and info.st_size == 0 and tries++ < 1000) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            if (info.st_size == 0 and (::ftruncate(fd, static_cast<off_t>(m_size)) != 0 or ::fstat(fd, &info) != 0)) {
+                ::close(fd);
+                throw std::runtime_error("Unable to size shared memory segment " + name);
+            }
+            if (info.st_size < static_cast<off_t>(header_size + sizeof(uint64_t))) {
+                ::close(fd);
+                throw std::runtime_error("Shared memory segment " + name + " is not a pair table");
+            }
+            m_size = static_cast<size_t>(info.st_size);
+        }
+        void *data = ::mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED) {
+            throw std::runtime_error("Unable to map shared memory segment " + name);
+        }
+        m_data = static_cast<uint8_t *>(data);
+        m_slots = reinterpret_cast<std::atomic<uint64_t> *>(m_data + header_size);
+        m_mask = (m_size - header_size) / sizeof(uint64_t) - 1;
+        std::atomic<uint64_t> *magic = reinterpret_cast<std::atomic<uint64_t> *>(m_data);
+        //The process initializing the table, zero until claimed.
+        std::atomic<uint64_t> *owner = reinterpret_cast<std::atomic<uint64_t> *>(m_data + 8);
+        if (created) {
+            owner->store(static_cast<uint64_t>(::getpid()), std::memory_order_relaxed);
+            this->initialize();
+        }
+        else {
+            for (int round=0; magic->load(std::memory_order_acquire) != magic_value(); round++) {
+                int tries = 0;
+                while (magic->load(std::memory_order_acquire) != magic_value() and tries++ < 1000) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+                if (magic->load(std::memory_order_acquire) == magic_value()) {
+                    break;
+                }
+                //Not published in time. Take over when nobody claimed the initialization or its claimer is gone.
+                uint64_t claimed = owner->load(std::memory_order_acquire);
+                bool gone = claimed == 0 or (::kill(static_cast<pid_t>(claimed), 0) != 0 and errno == ESRCH);
+                if (gone and owner->compare_exchange_strong(claimed, static_cast<uint64_t>(::getpid()), std::memory_order_acq_rel)) {
+                    this->initialize();
+                    break;
+                }
+                if (round == 4) {
+                    ::munmap(m_data, m_size);
+                    throw std::runtime_error("Shared memory segment " + name + " is not a pair table");
+                }
+            }
+            if (((m_mask + 1) & m_mask) != 0) {
+                ::munmap(m_data, m_size);
+                throw std::runtime_error("Shared memory segment " + name + " is not a pair table");
+            }
+        }
+    }
+    shared_pair_table(const shared_pair_table&) = delete;
+    shared_pair_table& operator=(const shared_pair_table&) = delete;
+    virtual ~shared_pair_table()
+    {
+        ::munmap(m_data, m_size);
+    }
+    //Remove the named segment, processes that have it open keep using it.
+    static void remove(const std::string &name)
+    {
+        ::shm_unlink(name.c_str());
+    }
+    bool contains(std::string_view parent, std::string_view child) override
+    {
+        uint64_t hash = pair_hash(parent, child);
+        for (size_t probe=0; probe < max_probe; probe++) {
+            uint64_t found = m_slots[(hash + probe) & m_mask].load(std::memory_order_acquire);
+            if (found == hash) {
+                return true;
+            }
+            if (found == 0) {
+                return false;
+            }
+        }
+        return false;
+    }
+    void insert(std::string_view parent, std::string_view child) override
+    {
+        uint64_t hash = pair_hash(parent, child);
+        for (size_t probe=0; probe < max_probe; probe++) {
+            std::atomic<uint64_t> &slot = m_slots[(hash + probe) & m_mask];
+            uint64_t expected = 0;
+            if (slot.compare_exchange_strong(expected, hash, std::memory_order_acq_rel) or expected == hash) {
+                return;
+            }
+        }
+        m_slots[hash & m_mask].store(hash, std::memory_order_release);
+    }
+private:
+    static uint64_t magic_value()
+    {
+        uint64_t rval;
+        std::memcpy(&rval, "spq-pair", 8);
+        return rval;
+    }
+    //Start from an empty table with a fresh key, publishing the magic marks the table ready.
+    void initialize()
+    {
+        for (size_t slot=0; slot <= m_mask; slot++) {
+            m_slots[slot].store(0, std::memory_order_relaxed);
+        }
+        crypto_shorthash_keygen(m_data + 16);
+        reinterpret_cast<std::atomic<uint64_t> *>(m_data)->store(magic_value(), std::memory_order_release);
+    }
+    uint64_t pair_hash(std::string_view parent, std::string_view child)
+    {
+        std::string pair(parent);
+        pair.append(child);
+        unsigned char out[crypto_shorthash_BYTES];
+        crypto_shorthash(out, reinterpret_cast<const unsigned char *>(pair.data()), pair.size(), m_data + 16);
+        uint64_t rval;
+        std::memcpy(&rval, out, sizeof(rval));
+        //Zero marks an empty slot.
+        return rval == 0 ? 1 : rval;
+    }
+    size_t m_size;
+    uint8_t *m_data;
+    size_t m_mask;
+    std::atomic<uint64_t> *m_slots;
 };
 
-//Public-API signature
-template<uint8_t hashlen, uint8_t wotsbits, uint8_t merkleheight>
-struct signature {
-    //Hash length must be 16 up to 64 bytes long.
-    static_assert(hashlen > 15, "Hash size should be at least 128 bits (16 bytes).");
-    static_assert(hashlen < 65,  "Hash size of more then 512 bits is not supported");
-    //The number of bits used for wots encoding must be 3 upto 16 bits.
-    static_assert(wotsbits < 17, "Wots chains longer than 64k hash operations (wotsbits>16) are not supported");
-    static_assert(wotsbits > 3, "A wots chain should be at least 16 hash operations long (wotsbits > 1)");
-    //The height of a singe merkle-tree must be 3 up to 16 levels.
-    static_assert(merkleheight < 17, "A single merkle tree should not be more than 16 levels high");
-    static_assert(merkleheight > 2, "A single merkle tree should be at least two levels high. A value between 8 and 10 is recomended");
-    static_assert(39 * wotsbits >= hashlen * 8, "Wotsbits and hashlen must not combine into signing keys of more than 39 subkeys each");
-    signature(std::string sigstring): m_pubkey(), m_salt(), m_index(0), m_mt_bits(),m_merkle_tree_header(), m_signature_body()
+//Bounded cache of signatures that have been verified, so a (message, signature) pair that arrives again costs one
+//short hash and one lookup instead of a full validation. Entries are 64-bit SipHash (crypto_shorthash) values of
+//the root pubkey the signature was verified against, the serialized signature and the message digest, keyed with
+//a random per-cache key. Evicts with the CLOCK algorithm, and counts hits, misses and evictions for tuning.
+template<uint8_t hashlen>
+struct verified_signature_cache {
+    verified_signature_cache(size_t capacity=65536):
+        m_mutex(), m_index(), m_slots(), m_hand(0), m_capacity(capacity), m_hits(0), m_misses(0), m_evictions(0)
     {
-        constexpr int subkey_count = (hashlen * 8 + wotsbits -1) / wotsbits;
-        constexpr size_t expected_length = 2 + hashlen * (2 + merkleheight + 2 * subkey_count);
-        // * check signature length
-        if (sigstring.length() != expected_length) {
-            throw std::invalid_argument("Wrong signature size. *1");
+        if (capacity == 0) {
+            throw std::invalid_argument("A verified signature cache needs a capacity of at least one.");
         }
-        // * get pubkey, salt, index, mt-header and wots-body and store them till validate gets invoked
-        m_pubkey = std::string(sigstring.c_str(), hashlen);
-        m_salt = std::string(sigstring.c_str()+hashlen, hashlen);
-        std::string s_index = std::string(sigstring.c_str()+hashlen*2, 2);
-        const unsigned char * us_index = reinterpret_cast<const unsigned char *>(s_index.c_str());
-        m_index = (us_index[0] << 8) + us_index[1];
-        m_mt_bits = non_api::as_bits<merkleheight>(m_index);
-        std::reverse(m_mt_bits.begin(), m_mt_bits.end());
-        for (int index=0; index < merkleheight; index++) {
-            m_merkle_tree_header.push_back(std::string(sigstring.c_str()+hashlen*(2+index)+2, hashlen));
-        }
-        std::reverse(m_merkle_tree_header.begin(), m_merkle_tree_header.end());
-        for (int index=0; index < subkey_count; index++) {
-            std::vector<std::string> newval;
-            for (int direction=0; direction<2; direction++) {
-                newval.push_back(std::string(sigstring.c_str()+2 + hashlen * (2 + merkleheight + 2 * index + direction),
-                                             hashlen));
-            }
-            m_signature_body.push_back(newval);
+        crypto_shorthash_keygen(m_key);
+        m_index.reserve(capacity);
+    }
+    bool contains(std::string_view root_pubkey, std::string_view serialized, std::string_view digest)
+    {
+        uint64_t hash = signature_hash(root_pubkey, serialized, digest);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto found = m_index.find(hash);
+        if (found == m_index.end()) {
+            m_misses++;
+            return false;
         }
+        m_slots[found->second].second = true;
+        m_hits++;
+        return true;
     }
-    bool validate(std::string message, bool is_digest=false)
+    void insert(std::string_view root_pubkey, std::string_view serialized, std::string_view digest)
     {
-        // * get the message digest
-        non_api::primative<hashlen, wotsbits, merkleheight> hashfunction(m_salt);
-        std::string digest = message;
-        if (is_digest == false) {
-            digest = hashfunction(message);
+        uint64_t hash = signature_hash(root_pubkey, serialized, digest);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_index.count(hash) > 0) {
+            return;
         }
-        //Convert the digest to a list of numbers, the same list used for signing.
-        auto numlist = non_api::digest_to_numlist<hashlen, wotsbits>(digest);
-        // * complete the wots chains and calculate what should be the WOTS pubkey for this index.
-        std::string big_ots_pubkey("");
-        for (size_t index=0; index < numlist.size(); index++) {
-            auto signature_chunk = m_signature_body[index];
-            int chunk_num = numlist[index];
-            //Complete wots chains
-            std::string pk1 = hashfunction(signature_chunk[0], (1 << wotsbits) - chunk_num);
-            std::string pk2 = hashfunction(signature_chunk[1], chunk_num + 1);
-            //Combine left and right into one pubkey and append that to the big WOTS pubkey reconstruction.
-            big_ots_pubkey += hashfunction(pk1, pk2);
+        if (m_slots.size() < m_capacity) {
+            m_index[hash] = m_slots.size();
+            m_slots.emplace_back(hash, false);
+            return;
         }
-        //Take the salted hash of the large WOTS pubkey reconstruction
-        std::string calculated_pubkey = hashfunction(big_ots_pubkey);
-        //Reconstruct what should be the pubkey from the previous hash and the merkle-tree header nodes.
-        for (size_t index=0; index < m_mt_bits.size(); index++) {
-            if  (m_mt_bits[index]) {
-                calculated_pubkey = hashfunction(m_merkle_tree_header[index], calculated_pubkey);
-            }
-            else {
-                calculated_pubkey = hashfunction(calculated_pubkey, m_merkle_tree_header[index]);
-            }
+        //Sweep, giving recently hit signatures a second chance.
+        while (m_slots[m_hand].second) {
+            m_slots[m_hand].second = false;
+            m_hand = (m_hand + 1) % m_capacity;
         }
-        //If everything is irie, the pubkey and the reconstructed pubkey should be the same.
-        return calculated_pubkey == m_pubkey;
+        m_index.erase(m_slots[m_hand].first);
+        m_index[hash] = m_hand;
+        m_slots[m_hand] = std::make_pair(hash, false);
+        m_hand = (m_hand + 1) % m_capacity;
+        m_evictions++;
     }
-    //Get the current index, this is the statefull part of the signing key.
-    uint32_t get_index()
+    uint64_t hits()
     {
-        return m_index;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_hits;
     }
-    //Get the public key of the signing key.
-    std::string get_pubkey()
+    uint64_t misses()
     {
-        return m_pubkey;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_misses;
     }
-    //Get the value of the salt string for this signing key.
-    std::string get_pubkey_salt()
+    uint64_t evictions()
     {
-        return m_salt;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_evictions;
+    }
+    size_t size()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_slots.size();
     }
 private:
-    std::string m_pubkey;
-    std::string m_salt;
-    uint32_t m_index;
-    std::vector<bool> m_mt_bits;
-    std::vector<std::string> m_merkle_tree_header;
-    std::vector<std::vector<std::string>> m_signature_body;
+    uint64_t signature_hash(std::string_view root_pubkey, std::string_view serialized, std::string_view digest)
+    {
+        std::string input(root_pubkey);
+        input.append(digest);
+        input.append(serialized);
+        unsigned char out[crypto_shorthash_BYTES];
+        crypto_shorthash(out, reinterpret_cast<const unsigned char *>(input.data()), input.size(), m_key);
+        uint64_t rval;
+        std::memcpy(&rval, out, sizeof(rval));
+        return rval;
+    }
+    std::mutex m_mutex;
+    std::unordered_map<uint64_t, size_t> m_index;
+    std::vector<std::pair<uint64_t, bool>> m_slots;
+    size_t m_hand;
+    size_t m_capacity;
+    unsigned char m_key[crypto_shorthash_KEYBYTES];
+    uint64_t m_hits;
+    uint64_t m_misses;
+    uint64_t m_evictions;
 };
 
-
-template<uint8_t hashlen, uint8_t wotsbits, uint8_t merkleheight, uint8_t merkleheight2, uint8_t ...Args>
+template<uint8_t hashlen, uint64_t wotsbits, uint8_t merkleheight, uint8_t merkleheight2, uint8_t ...Args>
 struct multi_signature {
     //Hash length must be 16 up to 64 bytes long.
     static_assert(hashlen > 15, "Hash size should be at least 128 bits (16 bytes).");
     static_assert(hashlen < 65,  "Hash size of more then 512 bits is not supported");
     //The number of bits used for wots encoding must be 3 upto 16 bits.
-    static_assert(wotsbits < 17, "Wots chains longer than 64k hash operations (wotsbits>16) are not supported");
-    static_assert(wotsbits > 3, "A wots chain should be at least 16 hash operations long (wotsbits > 1)");
+    static_assert(non_api::level_wotsbits(wotsbits) < 17, "Wots chains longer than 64k hash operations (wotsbits>16) are not supported");
+    static_assert(non_api::level_wotsbits(wotsbits) > 3, "A wots chain should be at least 16 hash operations long (wotsbits > 1)");
     //The height of a singe merkle-tree must be 3 up to 16 levels.
     static_assert(merkleheight < 17, "A single merkle tree should not be more than 16 levels high");
     static_assert(merkleheight > 2, "A single merkle tree should be at least two levels high. A value between 8 and 10 is recomended");
     static_assert(merkleheight2 < 17, "A single merkle tree should not be more than 16 levels high");
     static_assert(merkleheight2 > 2, "A single merkle tree should be at least two levels high. A value between 8 and 10 is recomended");
-    static_assert(39 * wotsbits >= hashlen * 8, "Wotsbits and hashlen must not combine into signing keys of more than 39 subkeys each");
-    multi_signature(std::pair<std::string, std::vector<std::pair<std::string, std::string>>> &sig,
+    static_assert(39 * non_api::level_wotsbits(wotsbits) >= hashlen * 8, "Wotsbits and hashlen must not combine into signing keys of more than 39 subkeys each");
+    //A per-level wotsbits specification needs one entry per merkle tree, no more and no less.
+    static_assert(non_api::wotsbits_levels_match(wotsbits, 2 + sizeof...(Args)), "Per-level wotsbits must list the wotsbits of every merkle tree, and of no more");
+    //Same, consulting and filling a cache of verified intermediate-level signatures.
+    template<typename parts_type>
+    multi_signature(parts_type &sig, std::vector<std::string> &last_known, verified_pairs &cache):
+        multi_signature(sig, last_known, 0, &cache) {}
+    //Takes the signature either as strings, as signed and expanded, or as views as returned by view_deserializer.
+    template<typename parts_type>
+    multi_signature(parts_type &sig,
                     std::vector<std::string> &last_known,
-                    int treedepth=0):
+                    int treedepth=0,
+                    verified_pairs *cache=nullptr):
         m_level_ok(true),
         m_cached(true),
-        m_signature(sig),
         m_index(0),
         m_last_known(last_known),
         m_treedepth(treedepth),
-        m_deeper_signature(sig, last_known, treedepth + 1),
-        m_pubkey(), m_salt()
+        m_deeper_signature(sig, last_known, treedepth + 1, cache),
+        m_pubkey(), m_salt(),
+        m_pending(), m_pending_child(), m_cache(cache)
     {
         auto tree_count = treedepth +  sizeof...(Args) + 2;
         auto my_index = tree_count - treedepth - 2;
@@ -1123,33 +3300,47 @@ struct multi_signature {
         auto found = sig.second[my_index].first;
         if (found != expected) {
             m_cached = false;
-            signature<hashlen, wotsbits, merkleheight> pubkey_signature(sig.second[my_index].second);
-            m_level_ok = pubkey_signature.validate(found, true);
-            if (m_level_ok) {
-                if (pubkey_signature.get_pubkey() != last_known[my_index + 1]) {
-                    if (my_index < tree_count - 2) {
-                        if (pubkey_signature.get_pubkey() != sig.second[my_index + 1].first) {
-                            m_level_ok = false;
-                        }
-                    }
-                    else {
-                        m_level_ok = false;
-                    }
-                }
-                else {
-                    m_pubkey = pubkey_signature.get_pubkey();
-                    m_salt = pubkey_signature.get_pubkey_salt();
-                }
+            auto pubkey_signature = std::make_unique<signature<hashlen, non_api::level_wotsbits(wotsbits), merkleheight, non_api::level_ots<wotsbits>>>(sig.second[my_index].second);
+            //Only the cheap checks here, the parent has to chain up to a known key before any WOTS chain gets hashed.
+            m_level_ok = check_level(*pubkey_signature, last_known, sig, my_index, tree_count);
+            if (m_level_ok and not (cache != nullptr and cache->contains(pubkey_signature->get_pubkey(), found))) {
+                m_pending = std::move(pubkey_signature);
+                m_pending_child = std::string(found);
             }
         }
     }
-    bool validate(std::string message)
+    //Validation fails before any hashing if any level failed its cheap checks. If hash_budget is given, validation
+    //is refused with hash_budget_exceeded before any hashing when all levels together could take more hash
+    //operations than the budget has left.
+    bool validate(const std::string &message, bool is_digest=false, uint64_t *hash_budget=nullptr)
+    {
+        if (not consistent()) {
+            return false;
+        }
+        if (hash_budget != nullptr and *hash_budget < validation_cost(is_digest)) {
+            throw hash_budget_exceeded();
+        }
+        return verify_level(hash_budget) and m_deeper_signature.validate(message, is_digest, hash_budget);
+    }
+    //True if no level has failed the checks that need no hashing.
+    bool consistent()
+    {
+        return m_level_ok and m_deeper_signature.consistent();
+    }
+    //Number of hash operations validating all levels still left to verify may take.
+    uint64_t validation_cost(bool is_digest=false)
+    {
+        return (m_pending ? signature<hashlen, non_api::level_wotsbits(wotsbits), merkleheight, non_api::level_ots<wotsbits>>::validation_cost() : 0) +
+               m_deeper_signature.validation_cost(is_digest);
+    }
+    //Get an incremental hasher for the message, salted for the bottom-level signing key.
+    message_hasher<hashlen> hasher()
     {
-        return m_level_ok  and m_deeper_signature.validate(message);
+        return m_deeper_signature.hasher();
     }
-    std::vector<uint32_t> get_index()
+    std::vector<uint64_t> get_index()
     {
-        std::vector<uint32_t> rval = m_deeper_signature.get_index();
+        std::vector<uint64_t> rval = m_deeper_signature.get_index();
         if (m_cached == false) {
             rval.insert(rval.begin(), m_index);
         }
@@ -1171,84 +3362,143 @@ struct multi_signature {
         }
         return rval;
     }
+    multi_signature(const multi_signature&) = delete;
+    multi_signature& operator=(const multi_signature&) = delete;
     virtual ~multi_signature() {}
 private:
     bool m_level_ok;
     bool m_cached;
-    std::pair<std::string, std::vector<std::pair<std::string, std::string>>> m_signature;
-    uint16_t m_index;
+    uint64_t m_index;
     std::vector<std::string> &m_last_known;
     int m_treedepth;
-    multi_signature<hashlen, wotsbits, merkleheight2, Args...> m_deeper_signature;
+    multi_signature<hashlen, non_api::lower_wotsbits(wotsbits, 1 + sizeof...(Args)), merkleheight2, Args...> m_deeper_signature;
     std::string m_pubkey;
     std::string m_salt;
+    std::unique_ptr<signature<hashlen, non_api::level_wotsbits(wotsbits), merkleheight, non_api::level_ots<wotsbits>>> m_pending;
+    std::string m_pending_child;
+    verified_pairs *m_cache;
+    template<typename parts_type>
+    bool check_level(signature<hashlen, non_api::level_wotsbits(wotsbits), merkleheight, non_api::level_ots<wotsbits>> &pubkey_signature,
+                     std::vector<std::string> &last_known,
+                     parts_type &sig,
+                     size_t my_index,
+                     size_t tree_count)
+    {
+        if (not pubkey_signature.well_formed()) {
+            return false;
+        }
+        if (pubkey_signature.get_pubkey() != last_known[my_index + 1]) {
+            return my_index < tree_count - 2 and pubkey_signature.get_pubkey() == sig.second[my_index + 1].first;
+        }
+        m_pubkey = pubkey_signature.get_pubkey();
+        m_salt = pubkey_signature.get_pubkey_salt();
+        return true;
+    }
+    //WOTS-verify the pending intermediate-level signature, if any.
+    bool verify_level(uint64_t *hash_budget)
+    {
+        if (m_pending) {
+            m_level_ok = m_pending->validate(m_pending_child, true, nullptr, hash_budget);
+            if (m_level_ok and m_cache != nullptr) {
+                m_cache->insert(m_pending->get_pubkey(), m_pending_child);
+            }
+            m_pending.reset();
+        }
+        return m_level_ok;
+    }
 };
 
-template<uint8_t hashlen, uint8_t wotsbits, uint8_t merkleheight, uint8_t merkleheight2>
+template<uint8_t hashlen, uint64_t wotsbits, uint8_t merkleheight, uint8_t merkleheight2>
 struct multi_signature<hashlen, wotsbits, merkleheight, merkleheight2> {
     //Hash length must be 16 up to 64 bytes long.
     static_assert(hashlen > 15, "Hash size should be at least 128 bits (16 bytes).");
     static_assert(hashlen < 65,  "Hash size of more then 512 bits is not supported");
     //The number of bits used for wots encoding must be 3 upto 16 bits.
-    static_assert(wotsbits < 17, "Wots chains longer than 64k hash operations (wotsbits>16) are not supported");
-    static_assert(wotsbits > 3, "A wots chain should be at least 16 hash operations long (wotsbits > 1)");
+    static_assert(non_api::level_wotsbits(wotsbits) < 17, "Wots chains longer than 64k hash operations (wotsbits>16) are not supported");
+    static_assert(non_api::level_wotsbits(wotsbits) > 3, "A wots chain should be at least 16 hash operations long (wotsbits > 1)");
     //The height of a singe merkle-tree must be 3 up to 16 levels.
     static_assert(merkleheight < 17, "A single merkle tree should not be more than 16 levels high");
     static_assert(merkleheight > 2, "A single merkle tree should be at least two levels high. A value between 8 and 10 is recomended");
     static_assert(merkleheight2 < 17, "A single merkle tree should not be more than 16 levels high");
     static_assert(merkleheight2 > 2, "A single merkle tree should be at least two levels high. A value between 8 and 10 is recomended");
-    static_assert(39 * wotsbits >= hashlen * 8, "Wotsbits and hashlen must not combine into signing keys of more than 39 subkeys each");
-    multi_signature(std::pair<std::string, std::vector<std::pair<std::string, std::string>>> &sig,
+    static_assert(39 * non_api::level_wotsbits(wotsbits) >= hashlen * 8, "Wotsbits and hashlen must not combine into signing keys of more than 39 subkeys each");
+    //A per-level wotsbits specification needs one entry per merkle tree, no more and no less.
+    static_assert(non_api::wotsbits_levels_match(wotsbits, 2), "Per-level wotsbits must list the wotsbits of every merkle tree, and of no more");
+    //Same, consulting and filling a cache of verified intermediate-level signatures.
+    template<typename parts_type>
+    multi_signature(parts_type &sig, std::vector<std::string> &last_known, verified_pairs &cache):
+        multi_signature(sig, last_known, 0, &cache) {}
+    //Takes the signature either as strings, as signed and expanded, or as views as returned by view_deserializer.
+    template<typename parts_type>
+    multi_signature(parts_type &sig,
                     std::vector<std::string> &last_known,
-                    int treedepth=0):
+                    int treedepth=0,
+                    verified_pairs *cache=nullptr):
         m_level_ok(true),
         m_cached(true),
         m_message_signature(sig.first),
         m_index(0),
         m_last_known(last_known),
         m_treedepth(treedepth),
-        m_pubkey(), m_salt()
+        m_pubkey(), m_salt(),
+        m_pending(), m_cache(cache)
     {
         auto tree_count = treedepth  + 2;
         auto my_index = tree_count - treedepth - 2;
         auto expected = last_known[my_index];
         auto found = sig.second[my_index].first;
-        if (found != expected) {
+        if (not m_message_signature.well_formed() or m_message_signature.get_pubkey() != found) {
+            m_level_ok = false;
+        }
+        else if (found != expected) {
             m_cached = false;
-            std::string signature_string(sig.second[my_index].second);
-            signature<hashlen, wotsbits, merkleheight> pubkey_signature(signature_string);
-            m_level_ok = pubkey_signature.validate(m_message_signature.get_pubkey(), true);
-            if (m_level_ok) {
-                if (pubkey_signature.get_pubkey() != last_known[my_index + 1]) {
-                    if (my_index < tree_count - 2) {
-                        if (pubkey_signature.get_pubkey() != sig.second[my_index + 1].first) {
-                            m_level_ok = false;
-                        }
-                    }
-                    else {
-                        m_level_ok = false;
-                    }
-                }
-                else {
-                    m_pubkey = pubkey_signature.get_pubkey();
-                    m_salt = pubkey_signature.get_pubkey_salt();
-                }
+            auto pubkey_signature = std::make_unique<signature<hashlen, non_api::level_wotsbits(wotsbits), merkleheight, non_api::level_ots<wotsbits>>>(sig.second[my_index].second);
+            //Only the cheap checks here, the parent has to chain up to a known key before any WOTS chain gets hashed.
+            m_level_ok = check_level(*pubkey_signature, last_known, sig, my_index, tree_count);
+            if (m_level_ok and not (cache != nullptr and
+                                    cache->contains(pubkey_signature->get_pubkey(), m_message_signature.get_pubkey()))) {
+                m_pending = std::move(pubkey_signature);
             }
         }
     }
-    bool validate(std::string message)
+    //Validation fails before any hashing if any level failed its cheap checks. If hash_budget is given, validation
+    //is refused with hash_budget_exceeded before any hashing when all levels together could take more hash
+    //operations than the budget has left.
+    bool validate(const std::string &message, bool is_digest=false, uint64_t *hash_budget=nullptr)
     {
+        if (not consistent() or (is_digest and message.size() != hashlen)) {
+            return false;
+        }
+        if (hash_budget != nullptr and *hash_budget < validation_cost(is_digest)) {
+            throw hash_budget_exceeded();
+        }
         bool rval = false;
-        if (m_level_ok) {
-            if (m_message_signature.validate(message)) {
+        if (verify_level(hash_budget)) {
+            if (m_message_signature.validate(message, is_digest, nullptr, hash_budget)) {
                 rval = true;
             }
         }
         return  rval;
     }
-    std::vector<uint32_t> get_index()
+    //True if no level has failed the checks that need no hashing.
+    bool consistent()
+    {
+        return m_level_ok;
+    }
+    //Number of hash operations validating all levels still left to verify may take.
+    uint64_t validation_cost(bool is_digest=false)
+    {
+        return (m_pending ? signature<hashlen, non_api::level_wotsbits(wotsbits), merkleheight, non_api::level_ots<wotsbits>>::validation_cost() : 0) +
+               signature<hashlen, non_api::lower_wotsbits(wotsbits, 1), merkleheight2, non_api::level_ots<wotsbits>>::validation_cost(is_digest);
+    }
+    //Get an incremental hasher for the message, salted for the bottom-level signing key.
+    message_hasher<hashlen> hasher()
+    {
+        return m_message_signature.hasher();
+    }
+    std::vector<uint64_t> get_index()
     {
-        std::vector<uint32_t>  rval;
+        std::vector<uint64_t>  rval;
         rval.push_back(m_message_signature.get_index());
         if (m_cached == false) {
             rval.push_back(m_index);
@@ -1273,35 +3523,80 @@ struct multi_signature<hashlen, wotsbits, merkleheight, merkleheight2> {
         }
         return rval;
     }
+    multi_signature(const multi_signature&) = delete;
+    multi_signature& operator=(const multi_signature&) = delete;
     virtual ~multi_signature() {}
 private:
     bool m_level_ok;
     bool m_cached;
-    signature<hashlen, wotsbits, merkleheight2> m_message_signature;
-    uint16_t m_index;
+    signature<hashlen, non_api::lower_wotsbits(wotsbits, 1), merkleheight2, non_api::level_ots<wotsbits>> m_message_signature;
+    uint64_t m_index;
     std::vector<std::string> &m_last_known;
     int m_treedepth;
     std::string m_pubkey;
     std::string m_salt;
+    std::unique_ptr<signature<hashlen, non_api::level_wotsbits(wotsbits), merkleheight, non_api::level_ots<wotsbits>>> m_pending;
+    verified_pairs *m_cache;
+    template<typename parts_type>
+    bool check_level(signature<hashlen, non_api::level_wotsbits(wotsbits), merkleheight, non_api::level_ots<wotsbits>> &pubkey_signature,
+                     std::vector<std::string> &last_known,
+                     parts_type &sig,
+                     size_t my_index,
+                     size_t tree_count)
+    {
+        if (not pubkey_signature.well_formed()) {
+            return false;
+        }
+        if (pubkey_signature.get_pubkey() != last_known[my_index + 1]) {
+            return my_index < tree_count - 2 and pubkey_signature.get_pubkey() == sig.second[my_index + 1].first;
+        }
+        m_pubkey = pubkey_signature.get_pubkey();
+        m_salt = pubkey_signature.get_pubkey_salt();
+        return true;
+    }
+    //WOTS-verify the pending intermediate-level signature, if any.
+    bool verify_level(uint64_t *hash_budget)
+    {
+        if (m_pending) {
+            m_level_ok = m_pending->validate(m_message_signature.get_pubkey(), true, nullptr, hash_budget);
+            if (m_level_ok and m_cache != nullptr) {
+                m_cache->insert(m_pending->get_pubkey(), m_message_signature.get_pubkey());
+            }
+            m_pending.reset();
+        }
+        return m_level_ok;
+    }
 };
 
-template<uint8_t hashlen, uint8_t wotsbits, uint8_t merkleheight, uint8_t merkleheight2, uint8_t ...Args>
+namespace non_api {
+template<uint8_t hashlen, uint64_t wotsbits, uint8_t merkleheight, uint8_t merkleheight2, uint8_t ...Args>
+std::pair<std::string, std::pair<std::string, std::vector<std::pair<std::string, std::string>>>> deserialize_omitted(const std::string &in);
+}
+
+template<uint8_t hashlen, uint64_t wotsbits, uint8_t merkleheight, uint8_t merkleheight2, uint8_t ...Args>
 struct deserializer {
     //Hash length must be 16 up to 64 bytes long.
     static_assert(hashlen > 15, "Hash size should be at least 128 bits (16 bytes).");
     static_assert(hashlen < 65,  "Hash size of more then 512 bits is not supported");
     //The number of bits used for wots encoding must be 3 upto 16 bits.
-    static_assert(wotsbits < 17, "Wots chains longer than 64k hash operations (wotsbits>16) are not supported");
-    static_assert(wotsbits > 3, "A wots chain should be at least 16 hash operations long (wotsbits > 1)");
+    static_assert(non_api::level_wotsbits(wotsbits) < 17, "Wots chains longer than 64k hash operations (wotsbits>16) are not supported");
+    static_assert(non_api::level_wotsbits(wotsbits) > 3, "A wots chain should be at least 16 hash operations long (wotsbits > 1)");
     //The height of a singe merkle-tree must be 3 up to 16 levels.
     static_assert(merkleheight < 17, "A single merkle tree should not be more than 16 levels high");
     static_assert(merkleheight > 2, "A single merkle tree should be at least two levels high. A value between 8 and 10 is recomended");
     static_assert(merkleheight2 < 17, "A single merkle tree should not be more than 16 levels high");
     static_assert(merkleheight2 > 2, "A single merkle tree should be at least two levels high. A value between 8 and 10 is recomended");
-    static_assert(39 * wotsbits >= hashlen * 8, "Wotsbits and hashlen must not combine into signing keys of more than 39 subkeys each");
-    deserializer(): m_deserializer() {}
+    static_assert(39 * non_api::level_wotsbits(wotsbits) >= hashlen * 8, "Wotsbits and hashlen must not combine into signing keys of more than 39 subkeys each");
+    //A per-level wotsbits specification needs one entry per merkle tree, no more and no less.
+    static_assert(non_api::wotsbits_levels_match(wotsbits, 2 + sizeof...(Args)), "Per-level wotsbits must list the wotsbits of every merkle tree, and of no more");
+    //With omit_known, the message signature is expected with known fields omitted, as by a reducer with
+    //omit_known, and is returned as such for the expander to restore.
+    deserializer(bool omit_known=false): m_deserializer(), m_omit_known(omit_known) {}
     std::pair<std::string, std::pair<std::string, std::vector<std::pair<std::string, std::string>>>> operator()(std::string in)
     {
+        if (m_omit_known) {
+            return non_api::deserialize_omitted<hashlen, wotsbits, merkleheight, merkleheight2, Args...>(in);
+        }
         auto rval = m_deserializer(in);
         size_t processed_length = rval.second.first.size();
         for ( auto &i : rval.second.second ) {
@@ -1312,8 +3607,7 @@ struct deserializer {
                 processed_length += i.second.size();
             }
         }
-        constexpr int subkey_count = (hashlen * 8 + wotsbits -1) / wotsbits;
-        constexpr size_t expected_length = 2 + hashlen * (2 + merkleheight + 2 * subkey_count);
+        constexpr size_t expected_length = non_api::signature_length<hashlen, non_api::level_wotsbits(wotsbits), merkleheight, non_api::level_ots<wotsbits>>();
         auto remaining = in.substr(processed_length, in.size() - processed_length);
         if (remaining.size() >= expected_length) {
             auto parent = rval.second.second[rval.second.second.size()-1].second.substr(0,hashlen);
@@ -1325,28 +3619,36 @@ struct deserializer {
         return rval;
     }
 private:
-    deserializer<hashlen, wotsbits, merkleheight2, Args...> m_deserializer;
+    deserializer<hashlen, non_api::lower_wotsbits(wotsbits, 1 + sizeof...(Args)), merkleheight2, Args...> m_deserializer;
+    bool m_omit_known;
 };
 
-template<uint8_t hashlen, uint8_t wotsbits, uint8_t merkleheight, uint8_t merkleheight2>
+template<uint8_t hashlen, uint64_t wotsbits, uint8_t merkleheight, uint8_t merkleheight2>
 struct deserializer<hashlen, wotsbits, merkleheight, merkleheight2> {
     //Hash length must be 16 up to 64 bytes long.
     static_assert(hashlen > 15, "Hash size should be at least 128 bits (16 bytes).");
     static_assert(hashlen < 65,  "Hash size of more then 512 bits is not supported");
     //The number of bits used for wots encoding must be 3 upto 16 bits.
-    static_assert(wotsbits < 17, "Wots chains longer than 64k hash operations (wotsbits>16) are not supported");
-    static_assert(wotsbits > 3, "A wots chain should be at least 16 hash operations long (wotsbits > 1)");
+    static_assert(non_api::level_wotsbits(wotsbits) < 17, "Wots chains longer than 64k hash operations (wotsbits>16) are not supported");
+    static_assert(non_api::level_wotsbits(wotsbits) > 3, "A wots chain should be at least 16 hash operations long (wotsbits > 1)");
     //The height of a singe merkle-tree must be 3 up to 16 levels.
     static_assert(merkleheight < 17, "A single merkle tree should not be more than 16 levels high");
     static_assert(merkleheight > 2, "A single merkle tree should be at least two levels high. A value between 8 and 10 is recomended");
     static_assert(merkleheight2 < 17, "A single merkle tree should not be more than 16 levels high");
     static_assert(merkleheight2 > 2, "A single merkle tree should be at least two levels high. A value between 8 and 10 is recomended");
-    static_assert(39 * wotsbits >= hashlen * 8, "Wotsbits and hashlen must not combine into signing keys of more than 39 subkeys each");
+    static_assert(39 * non_api::level_wotsbits(wotsbits) >= hashlen * 8, "Wotsbits and hashlen must not combine into signing keys of more than 39 subkeys each");
+    //A per-level wotsbits specification needs one entry per merkle tree, no more and no less.
+    static_assert(non_api::wotsbits_levels_match(wotsbits, 2), "Per-level wotsbits must list the wotsbits of every merkle tree, and of no more");
+    //With omit_known, the message signature is expected with known fields omitted, as by a reducer with
+    //omit_known, and is returned as such for the expander to restore.
+    deserializer(bool omit_known=false): m_omit_known(omit_known) {}
     std::pair<std::string, std::pair<std::string, std::vector<std::pair<std::string, std::string>>>> operator()(std::string in)
     {
-        constexpr int subkey_count = (hashlen * 8 + wotsbits -1) / wotsbits;
-        constexpr size_t expected_length2 = 2 + hashlen * (2 + merkleheight + 2 * subkey_count);
-        constexpr size_t expected_length = 2 + hashlen * (2 + merkleheight2 + 2 * subkey_count);
+        if (m_omit_known) {
+            return non_api::deserialize_omitted<hashlen, wotsbits, merkleheight, merkleheight2>(in);
+        }
+        constexpr size_t expected_length2 = non_api::signature_length<hashlen, non_api::level_wotsbits(wotsbits), merkleheight, non_api::level_ots<wotsbits>>();
+        constexpr size_t expected_length = non_api::signature_length<hashlen, non_api::lower_wotsbits(wotsbits, 1), merkleheight2, non_api::level_ots<wotsbits>>();
         constexpr size_t expected_total_length_full = expected_length + expected_length2;
         constexpr size_t expected_total_length_reduced = expected_length + 2 * hashlen;
         auto subin = in.substr(0,expected_total_length_full);
@@ -1387,38 +3689,486 @@ struct deserializer<hashlen, wotsbits, merkleheight, merkleheight2> {
                 throw std::invalid_argument("Wrong signature size (*2).");
             }
         }
-
+
+    }
+private:
+    bool m_omit_known;
+};
+
+namespace non_api {
+//Deserialize a signature whose message signature has known fields omitted. The rest is laid out as usual, so it
+//gets deserialized as usual behind a placeholder for the message signature. The pubkey of the bottom level comes
+//from the message signature, so the expander fills it in once it has restored that.
+template<uint8_t hashlen, uint64_t wotsbits, uint8_t merkleheight, uint8_t merkleheight2, uint8_t ...Args>
+std::pair<std::string, std::pair<std::string, std::vector<std::pair<std::string, std::string>>>> deserialize_omitted(const std::string &in)
+{
+    constexpr uint8_t heights[] = {merkleheight, merkleheight2, Args...};
+    constexpr uint8_t bottom = heights[sizeof...(Args) + 1];
+    constexpr uint8_t bottom_wotsbits = level_wotsbits(wotsbits, sizeof...(Args) + 1);
+    size_t length = omitted_signature_length<hashlen, bottom_wotsbits, bottom, level_ots<wotsbits>>(in);
+    if (length > in.size()) {
+        throw std::invalid_argument("Wrong signature size (*4).");
+    }
+    deserializer<hashlen, wotsbits, merkleheight, merkleheight2, Args...> deserialize;
+    auto rval = deserialize(std::string(signature_length<hashlen, bottom_wotsbits, bottom, level_ots<wotsbits>>(), '\0') + in.substr(length));
+    rval.second.first = in.substr(0, length);
+    return rval;
+}
+}
+
+//Deserializer that doesn't copy. Rather than copying the parts of a serialized signature into strings, it returns
+//views into the caller's buffer. The views remain valid as long as that buffer does. Validation still copies what it
+//keeps: a signature copies its parts into vectors, and multi_signature the pubkeys it checks later.
+template<uint8_t hashlen, uint64_t wotsbits, uint8_t merkleheight, uint8_t merkleheight2, uint8_t ...Args>
+struct view_deserializer {
+    //Hash length must be 16 up to 64 bytes long.
+    static_assert(hashlen > 15, "Hash size should be at least 128 bits (16 bytes).");
+    static_assert(hashlen < 65,  "Hash size of more then 512 bits is not supported");
+    //The number of bits used for wots encoding must be 3 upto 16 bits.
+    static_assert(non_api::level_wotsbits(wotsbits) < 17, "Wots chains longer than 64k hash operations (wotsbits>16) are not supported");
+    static_assert(non_api::level_wotsbits(wotsbits) > 3, "A wots chain should be at least 16 hash operations long (wotsbits > 1)");
+    static_assert(39 * non_api::level_wotsbits(wotsbits) >= hashlen * 8, "Wotsbits and hashlen must not combine into signing keys of more than 39 subkeys each");
+    //A per-level wotsbits specification needs one entry per merkle tree, no more and no less.
+    static_assert(non_api::wotsbits_levels_match(wotsbits, 2 + sizeof...(Args)), "Per-level wotsbits must list the wotsbits of every merkle tree, and of no more");
+    //Number of intermediate-level signatures in a signature.
+    static constexpr size_t levels = 1 + sizeof...(Args);
+    //The parts of a signature: the message signature and, for every level from the bottom up, the pubkey of
+    //the key at that level and its signature by the level above (empty if reduced).
+    typedef std::pair<std::string_view, std::array<std::pair<std::string_view, std::string_view>, levels>> parts_type;
+    //The signature length of every tree, from the top down.
+    static constexpr std::array<size_t, levels + 1> lengths =
+        non_api::signature_lengths<hashlen, wotsbits, merkleheight, merkleheight2, Args...>();
+    //Get the serialized length of a signature with its first 'full' intermediate-level signatures included, the
+    //rest reduced to just their pubkeys.
+    static constexpr size_t serialized_length(size_t full)
+    {
+        size_t rval = lengths[levels];
+        for (size_t level=0; level < full; level++) {
+            rval += lengths[levels - 1 - level];
+        }
+        if (full < levels) {
+            rval += hashlen * (levels - full + 1);
+        }
+        return rval;
+    }
+    //Returns the root pubkey and the signature parts, all as views into the input.
+    std::pair<std::string_view, parts_type> operator()(std::string_view in)
+    {
+        //The serialized lengths strictly grow with the number of full levels, so the length tells them apart.
+        size_t full = 0;
+        while (full <= levels and serialized_length(full) != in.size()) {
+            full++;
+        }
+        if (full > levels) {
+            throw std::invalid_argument("Wrong signature size (*3).");
+        }
+        parts_type rval;
+        rval.first = in.substr(0, lengths[levels]);
+        size_t offset = lengths[levels];
+        for (size_t level=0; level < levels; level++) {
+            if (level < full) {
+                std::string_view below = level == 0 ? rval.first : rval.second[level - 1].second;
+                rval.second[level].first = below.substr(0, hashlen);
+                rval.second[level].second = in.substr(offset, lengths[levels - 1 - level]);
+                offset += lengths[levels - 1 - level];
+            }
+            else {
+                rval.second[level].first = in.substr(offset, hashlen);
+                rval.second[level].second = std::string_view();
+                offset += hashlen;
+            }
+        }
+        std::string_view pubkey = full < levels ? in.substr(offset, hashlen) : rval.second[levels - 1].second.substr(0, hashlen);
+        return std::make_pair(pubkey, rval);
+    }
+};
+
+//Incremental (push) parser for a serialized signature that arrives in chunks. Bytes get copied once into a buffer
+//sized for the largest possible signature, and every level is emitted as a view into that buffer as soon as it is
+//complete, so the message signature can be validated while the rest is still arriving. A full level and a reduced
+//tail are told apart by the first hashlen bytes after a signature: a reduced tail starts by repeating the pubkey of
+//the signature before it, while a full level starts with the pubkey of the key one level up.
+template<uint8_t hashlen, uint64_t wotsbits, uint8_t merkleheight, uint8_t merkleheight2, uint8_t ...Args>
+struct push_parser {
+    typedef view_deserializer<hashlen, wotsbits, merkleheight, merkleheight2, Args...> layout;
+    static constexpr size_t levels = layout::levels;
+    typedef typename layout::parts_type parts_type;
+    //Called with level 0 for the message signature, and with level n for the pubkey of the key at level n-1 and its
+    //signature by the key one level up (empty if reduced).
+    typedef std::function<void(size_t level, std::string_view pubkey, std::string_view signature)> callback_type;
+    push_parser(callback_type on_level = callback_type()):
+        m_on_level(on_level),
+        m_buffer(layout::serialized_length(levels)),
+        m_size(0), m_offset(0), m_expected(layout::lengths[levels]), m_next(0),
+        m_probing(false), m_reduced(false), m_complete(false),
+        m_parts(), m_pubkey()
+    {}
+    //Views handed out earlier become invalid on reset.
+    void reset()
+    {
+        m_size = 0;
+        m_offset = 0;
+        m_expected = layout::lengths[levels];
+        m_next = 0;
+        m_probing = false;
+        m_reduced = false;
+        m_complete = false;
+        m_parts = parts_type();
+        m_pubkey = std::string_view();
+    }
+    //Feed the next chunk, returns the number of bytes consumed. Bytes past the end of the signature are not
+    //consumed, so back to back signatures in one stream can be parsed by calling reset and pushing the remainder.
+    size_t push(std::string_view chunk)
+    {
+        size_t consumed = 0;
+        while (not m_complete and consumed < chunk.size()) {
+            size_t take = std::min(chunk.size() - consumed, m_expected - m_size);
+            std::memcpy(m_buffer.data() + m_size, chunk.data() + consumed, take);
+            m_size += take;
+            consumed += take;
+            if (m_size == m_expected) {
+                advance();
+            }
+        }
+        return consumed;
+    }
+    bool complete() const
+    {
+        return m_complete;
+    }
+    //Number of bytes still needed at least before the next level can complete.
+    size_t wanted() const
+    {
+        return m_complete ? 0 : m_expected - m_size;
+    }
+    //The signature parts parsed so far, levels not yet complete are empty.
+    const parts_type &parts() const
+    {
+        return m_parts;
+    }
+    //The root pubkey, available once complete.
+    std::string_view root_pubkey() const
+    {
+        if (not m_complete) {
+            throw std::logic_error("Signature not completely received yet.");
+        }
+        return m_pubkey;
+    }
+private:
+    void emit(size_t level, std::string_view pubkey, std::string_view signature)
+    {
+        if (m_on_level) {
+            m_on_level(level, pubkey, signature);
+        }
+    }
+    void advance()
+    {
+        std::string_view in(m_buffer.data(), m_size);
+        if (m_next == 0) {
+            m_parts.first = in.substr(0, layout::lengths[levels]);
+            emit(0, m_parts.first.substr(0, hashlen), m_parts.first);
+            m_next = 1;
+            m_offset = m_size;
+            m_expected = m_offset + hashlen;
+            m_probing = true;
+            return;
+        }
+        size_t level = m_next - 1;
+        std::string_view below = level == 0 ? m_parts.first : m_parts.second[level - 1].second;
+        if (m_probing) {
+            m_probing = false;
+            if (in.substr(m_offset, hashlen) == below.substr(0, hashlen)) {
+                m_reduced = true;
+                m_expected = m_offset + hashlen * (levels - level + 1);
+            }
+            else {
+                m_expected = m_offset + layout::lengths[levels - 1 - level];
+            }
+            return;
+        }
+        if (m_reduced) {
+            for (; level < levels; level++) {
+                m_parts.second[level].first = in.substr(m_offset, hashlen);
+                m_parts.second[level].second = std::string_view();
+                m_offset += hashlen;
+                emit(level + 1, m_parts.second[level].first, m_parts.second[level].second);
+            }
+            m_pubkey = in.substr(m_offset, hashlen);
+            m_complete = true;
+            return;
+        }
+        m_parts.second[level].first = below.substr(0, hashlen);
+        m_parts.second[level].second = in.substr(m_offset, m_size - m_offset);
+        emit(level + 1, m_parts.second[level].first, m_parts.second[level].second);
+        m_next++;
+        m_offset = m_size;
+        if (level + 1 == levels) {
+            m_pubkey = m_parts.second[level].second.substr(0, hashlen);
+            m_complete = true;
+        }
+        else {
+            m_expected = m_offset + hashlen;
+            m_probing = true;
+        }
+    }
+    callback_type m_on_level;
+    std::vector<char> m_buffer;
+    size_t m_size;
+    size_t m_offset;
+    size_t m_expected;
+    size_t m_next;
+    bool m_probing;
+    bool m_reduced;
+    bool m_complete;
+    parts_type m_parts;
+    std::string_view m_pubkey;
+};
+
+//Get the exact size of the serialized form of a (possibly reduced) signature.
+template<typename parts_type>
+size_t serialized_size(const parts_type &in, std::string_view pubkey)
+{
+    size_t rval = in.first.size();
+    bool end_reached(false);
+    for ( auto &i : in.second ) {
+        if (end_reached or i.second.size() == 0) {
+            rval += i.first.size();
+            end_reached = true;
+        }
+        else {
+            rval += i.second.size();
+        }
+    }
+    if (end_reached) {
+        rval += pubkey.size();
+    }
+    return rval;
+}
+
+//Serialize a (possibly reduced) signature straight into a caller provided buffer, returns the number of bytes written.
+//Use serialized_size to size the buffer.
+template<typename parts_type>
+size_t serialize(const parts_type &in, std::string_view pubkey, char *buffer, size_t buffer_size)
+{
+    if (buffer_size < serialized_size(in, pubkey)) {
+        throw std::length_error("Buffer too small for serialized signature.");
+    }
+    size_t offset = 0;
+    auto append = [buffer, &offset](std::string_view part) {
+        std::memcpy(buffer + offset, part.data(), part.size());
+        offset += part.size();
+    };
+    append(in.first);
+    bool end_reached(false);
+    for ( auto &i : in.second ) {
+        if (end_reached or i.second.size() == 0) {
+            append(i.first);
+            end_reached = true;
+        }
+        else {
+            append(i.second);
+        }
+    }
+    if (end_reached) {
+        append(pubkey);
+    }
+    return offset;
+}
+
+inline std::string serialize(const std::pair<std::string, std::vector<std::pair<std::string, std::string>>> &in, const std::string &pubkey)
+{
+    std::string rval(serialized_size(in, pubkey), '\0');
+    serialize(in, pubkey, rval.data(), rval.size());
+    return rval;
+}
+
+//Negotiated omission of message signature fields the peer already has. Peers that both agree on it, a reducer and
+//an expander constructed with omit_known for the merkle height of the bottom-level tree and a deserializer
+//constructed with omit_known, leave out the pubkey and salt when the bottom-level tree is the one of the previous
+//signature, and every auth-path node equal to that of the previous signature. On the steady-state wire a signature
+//shrinks to the WOTS body plus the few auth-path nodes that changed.
+struct omit_known {
+    uint8_t merkleheight;
+};
+
+//Reducer, expander and last_known state can be persisted so signers and verifiers can carry on with reduced
+//signatures right after a restart. The format: the magic "spq-stat", a version byte, a type byte ('R' for a
+//reducer, 'E' for an expander, 'L' for a last_known vector) and a network order uint32 entry count, followed by
+//every entry as a network order uint32 length and its bytes. As of version 2, reducer and expander state starts
+//with two entries for omit_known: the merkle height as a single byte (0 if not omitting) and the previous message
+//signature.
+namespace non_api {
+inline std::string encode_frame_length(size_t length)
+{
+    uint32_t encoded = htonl(static_cast<uint32_t>(length));
+    return std::string(reinterpret_cast<const char *>(&encoded), 4);
+}
+inline size_t decode_frame_length(const char *in)
+{
+    uint32_t encoded;
+    std::memcpy(&encoded, in, 4);
+    return ntohl(encoded);
+}
+constexpr char persisted_state_magic[] = "spq-stat";
+constexpr uint8_t persisted_state_version = 2;
+inline std::string encode_state(char type, const std::vector<std::string> &entries)
+{
+    std::string rval(persisted_state_magic, 8);
+    rval += static_cast<char>(persisted_state_version);
+    rval += type;
+    rval += encode_frame_length(entries.size());
+    for (auto &entry : entries) {
+        rval += encode_frame_length(entry.size());
+        rval += entry;
+    }
+    return rval;
+}
+inline std::vector<std::string> decode_state(char type, const std::string &serialized, uint8_t *version=nullptr)
+{
+    if (serialized.size() < 14 or serialized.compare(0, 8, persisted_state_magic, 8) != 0) {
+        throw std::invalid_argument("Not a persisted signature state.");
+    }
+    if (serialized[8] < 1 or static_cast<uint8_t>(serialized[8]) > persisted_state_version) {
+        throw std::invalid_argument("Unsupported persisted signature state version.");
+    }
+    if (serialized[9] != type) {
+        throw std::invalid_argument("Persisted signature state of the wrong type.");
+    }
+    size_t count = decode_frame_length(serialized.data() + 10);
+    size_t offset = 14;
+    std::vector<std::string> rval;
+    for (size_t index=0; index < count; index++) {
+        if (serialized.size() - offset < 4) {
+            throw std::invalid_argument("Corrupt persisted signature state.");
+        }
+        size_t length = decode_frame_length(serialized.data() + offset);
+        offset += 4;
+        if (serialized.size() - offset < length) {
+            throw std::invalid_argument("Corrupt persisted signature state.");
+        }
+        rval.push_back(serialized.substr(offset, length));
+        offset += length;
+    }
+    if (offset != serialized.size()) {
+        throw std::invalid_argument("Corrupt persisted signature state.");
+    }
+    if (version != nullptr) {
+        *version = static_cast<uint8_t>(serialized[8]);
+    }
+    return rval;
+}
+//Split off the omit_known entries of version 2 reducer or expander state.
+inline std::vector<std::string> decode_omission_state(char type,
+                                                      const std::string &serialized,
+                                                      omit_known &omit,
+                                                      std::string &previous)
+{
+    uint8_t version;
+    auto entries = decode_state(type, serialized, &version);
+    if (version > 1) {
+        if (entries.size() < 2 or entries[0].size() != 1) {
+            throw std::invalid_argument("Corrupt persisted signature state.");
+        }
+        omit.merkleheight = static_cast<uint8_t>(entries[0][0]);
+        previous = entries[1];
+        entries.erase(entries.begin(), entries.begin() + 2);
+    }
+    return entries;
+}
+//Leave out the fields of a message signature equal to those of the previous one.
+inline std::string omit_known_fields(std::string_view full, std::string_view previous, size_t hashlen, uint8_t merkleheight)
+{
+    size_t nodes = 2 * hashlen + signature_index_bytes;
+    bool known_tree = previous.size() == full.size() and full.substr(0, 2 * hashlen) == previous.substr(0, 2 * hashlen);
+    std::string rval(full.substr(2 * hashlen, signature_index_bytes));
+    if (known_tree) {
+        rval[0] = static_cast<char>(rval[0] | 0x80);
+    }
+    std::string present;
+    unsigned int mask = 0;
+    for (unsigned int node=0; node < merkleheight; node++) {
+        std::string_view value = full.substr(nodes + node * hashlen, hashlen);
+        if (known_tree and value == previous.substr(nodes + node * hashlen, hashlen)) {
+            mask |= 1u << node;
+        }
+        else {
+            present += value;
+        }
     }
-};
-
-std::string serialize(std::pair<std::string, std::vector<std::pair<std::string, std::string>>> in, std::string pubkey)
+    rval += static_cast<char>(mask >> 8);
+    rval += static_cast<char>(mask & 255);
+    if (not known_tree) {
+        rval += full.substr(0, 2 * hashlen);
+    }
+    rval += present;
+    rval += full.substr(nodes + merkleheight * hashlen);
+    return rval;
+}
+//Put the fields left out by omit_known_fields back in from the previous message signature.
+inline std::string restore_known_fields(std::string_view omitted, std::string_view previous, size_t hashlen, uint8_t merkleheight)
 {
-    std::string rval = in.first;
-    bool end_reached(false);
-    for ( auto &i : in.second ) {
-        if (end_reached) {
-            rval += i.first;
+    if (omitted.size() < omitted_header_bytes) {
+        throw std::invalid_argument("Wrong signature size (*4).");
+    }
+    size_t nodes = 2 * hashlen + signature_index_bytes;
+    const unsigned char *data = reinterpret_cast<const unsigned char *>(omitted.data());
+    bool known_tree = (data[0] & 0x80) != 0;
+    unsigned int mask = (static_cast<unsigned int>(data[signature_index_bytes]) << 8) + data[signature_index_bytes + 1];
+    if ((known_tree or mask != 0) and previous.size() < nodes + merkleheight * hashlen) {
+        throw insufficient_expand_state();
+    }
+    size_t offset = omitted_header_bytes;
+    auto take = [&omitted, &offset](size_t length) {
+        if (omitted.size() - offset < length) {
+            throw std::invalid_argument("Wrong signature size (*4).");
+        }
+        offset += length;
+        return omitted.substr(offset - length, length);
+    };
+    std::string rval(known_tree ? previous.substr(0, 2 * hashlen) : take(2 * hashlen));
+    rval += omitted.substr(0, signature_index_bytes);
+    rval[2 * hashlen] = static_cast<char>(rval[2 * hashlen] & 0x7f);
+    for (unsigned int node=0; node < merkleheight; node++) {
+        if ((mask >> node) & 1) {
+            rval += previous.substr(nodes + node * hashlen, hashlen);
         }
         else {
-            if (i.second == "") {
-                rval += i.first;
-                end_reached = true;
-            }
-            else {
-                rval += i.second;
-            }
+            rval += take(hashlen);
         }
     }
-    if (end_reached) {
-        rval += pubkey;
-    }
+    rval += omitted.substr(offset);
     return rval;
 }
+}
+
+//Serialize a last_known vector for persisting.
+inline std::string serialize_last_known(const std::vector<std::string> &last_known)
+{
+    return non_api::encode_state('L', last_known);
+}
+
+//Restore a persisted last_known vector.
+inline std::vector<std::string> deserialize_last_known(const std::string &serialized)
+{
+    return non_api::decode_state('L', serialized);
+}
 
 struct reducer {
-    reducer(): m_last_time() {}
+    reducer(): m_last_time(), m_omit{0}, m_last_message() {}
+    //Also leave out the message signature fields the peer already has, see omit_known.
+    explicit reducer(omit_known omit): m_last_time(), m_omit(omit), m_last_message() {}
+    //Restore a persisted reducer.
+    explicit reducer(const std::string &serialized): m_last_time(), m_omit{0}, m_last_message()
+    {
+        m_last_time = non_api::decode_omission_state('R', serialized, m_omit, m_last_message);
+    }
     void reduce(std::pair<std::string, std::vector<std::pair<std::string, std::string>>> &in)
     {
+        if (m_omit.merkleheight != 0) {
+            std::string full = in.first;
+            in.first = non_api::omit_known_fields(full, m_last_message, in.second[0].first.size(), m_omit.merkleheight);
+            m_last_message = full;
+        }
         if (m_last_time.size() == 0) {
             for ( auto &i : in.second ) {
                 m_last_time.push_back(i.first);
@@ -1439,32 +4189,64 @@ struct reducer {
             }
         }
     }
+    //Serialize the reducer for persisting.
+    operator std::string() const
+    {
+        std::vector<std::string> entries{std::string(1, static_cast<char>(m_omit.merkleheight)), m_last_message};
+        entries.insert(entries.end(), m_last_time.begin(), m_last_time.end());
+        return non_api::encode_state('R', entries);
+    }
 private:
     std::vector<std::string> m_last_time;
+    omit_known m_omit;
+    std::string m_last_message;
 };
 struct expander {
-    expander(): m_last_time(),m_last_time_keys() {}
-    void expand(std::pair<std::string, std::vector<std::pair<std::string, std::string>>> &in)
+    expander(): m_last_time(),m_last_time_keys(), m_omit{0}, m_last_message() {}
+    //Also put back the message signature fields left out by a reducer with omit_known.
+    explicit expander(omit_known omit): m_last_time(), m_last_time_keys(), m_omit(omit), m_last_message() {}
+    //Restore a persisted expander.
+    explicit expander(const std::string &serialized): m_last_time(), m_last_time_keys(), m_omit{0}, m_last_message()
+    {
+        auto entries = non_api::decode_omission_state('E', serialized, m_omit, m_last_message);
+        if (entries.size() % 2 != 0) {
+            throw std::invalid_argument("Corrupt persisted signature state.");
+        }
+        for (size_t index=0; index < entries.size(); index += 2) {
+            m_last_time.push_back(entries[index]);
+            m_last_time_keys.push_back(entries[index + 1]);
+        }
+    }
+    //Expand a reduced signature, either as strings or as views as returned by view_deserializer. Expanded views
+    //may point into the expander state, they remain valid until the next expand call.
+    template<typename parts_type>
+    void expand(parts_type &in)
     {
+        if (m_omit.merkleheight != 0) {
+            size_t hashlen = in.second[0].first.size();
+            m_last_message = non_api::restore_known_fields(in.first, m_last_message, hashlen, m_omit.merkleheight);
+            in.first = m_last_message;
+            in.second[0].first = std::string_view(m_last_message).substr(0, hashlen);
+        }
         if (m_last_time.size() == 0) {
             for ( auto &i : in.second ) {
-                if (i.second == "") {
+                if (i.second.size() == 0) {
                     throw insufficient_expand_state();
                 }
-                m_last_time.push_back(i.first);
-                m_last_time_keys.push_back(i.second);
+                m_last_time.emplace_back(i.first);
+                m_last_time_keys.emplace_back(i.second);
             }
         }
         else {
             size_t index = 0;
             for ( auto &i : in.second ) {
                 if (i.first == m_last_time[index]) {
-                    if  (i.second == std::string("")) {
+                    if  (i.second.size() == 0) {
                         i.second = m_last_time_keys[index];
                     }
                 }
                 else {
-                    if (i.second == "") {
+                    if (i.second.size() == 0) {
                         throw insufficient_expand_state();
                     }
                     m_last_time[index] = i.first;
@@ -1474,9 +4256,786 @@ struct expander {
             }
         }
     }
+    //Serialize the expander for persisting, pubkey and signature of every level.
+    operator std::string() const
+    {
+        std::vector<std::string> entries{std::string(1, static_cast<char>(m_omit.merkleheight)), m_last_message};
+        for (size_t index=0; index < m_last_time.size(); index++) {
+            entries.push_back(m_last_time[index]);
+            entries.push_back(m_last_time_keys[index]);
+        }
+        return non_api::encode_state('E', entries);
+    }
 private:
     std::vector<std::string> m_last_time;
     std::vector<std::string> m_last_time_keys;
+    omit_known m_omit;
+    std::string m_last_message;
+};
+
+//Append-only, memory-mappable log of serialized signatures. Records are reduced against each other just like
+//with reducer/expander, but every keyframe_interval signatures a keyframe gets written that carries the full
+//expander state and the offsets of the signature records of the interval before it. Any signature can thus be
+//expanded by starting from the nearest keyframe instead of replaying the log from the start.
+//
+//Layout: a header (magic "spq-slog", version, hashlen, levels, one reserved byte, the keyframe interval as a
+//network order uint32 and the root pubkey) followed by frames. Every frame is a network order uint32 payload
+//length, a type byte ('S' for a signature, 'K' for a keyframe), the payload and the payload length once more so
+//the log can be walked backwards from its end. A keyframe payload holds the number of the signature after it, the
+//offset of the previous keyframe (0 if none) and the offsets of the keyframe_interval signature records before it,
+//all 8 bytes big endian, followed by the pubkey and full signature of every intermediate level.
+namespace non_api {
+constexpr size_t signature_log_frame_overhead = 9;
+}
+
+template<uint8_t hashlen, uint64_t wotsbits, uint8_t merkleheight, uint8_t merkleheight2, uint8_t ...Args>
+struct signature_log_writer;
+
+template<uint8_t hashlen, uint64_t wotsbits, uint8_t merkleheight, uint8_t merkleheight2, uint8_t ...Args>
+struct signature_log_reader {
+    typedef view_deserializer<hashlen, wotsbits, merkleheight, merkleheight2, Args...> layout;
+    static constexpr size_t levels = layout::levels;
+    static constexpr size_t header_size = 16 + hashlen;
+    static constexpr size_t state_size()
+    {
+        size_t rval = 0;
+        for (size_t level=0; level < levels; level++) {
+            rval += hashlen + layout::lengths[levels - 1 - level];
+        }
+        return rval;
+    }
+    signature_log_reader(const std::string &path): m_file(path), m_interval(0), m_end(0), m_keyframes(), m_tail()
+    {
+        m_file.advise_random();
+        std::string_view in = m_file.view();
+        if (in.size() < header_size or in.substr(0, 8) != "spq-slog" or in[8] != 1) {
+            throw std::invalid_argument("Not a signature log: " + path);
+        }
+        if (static_cast<uint8_t>(in[9]) != hashlen or static_cast<uint8_t>(in[10]) != levels + 1) {
+            throw std::invalid_argument("Signature log made for different key parameters: " + path);
+        }
+        m_interval = static_cast<uint32_t>(non_api::decode_frame_length(in.data() + 12));
+        if (m_interval == 0) {
+            throw std::invalid_argument("Corrupt signature log header: " + path);
+        }
+        m_end = in.size();
+        if (not walk_back()) {
+            //Torn tail, most likely from a crash while appending. Only use the complete frames.
+            m_end = header_size;
+            while (frame_fits(m_end)) {
+                m_end += non_api::decode_frame_length(in.data() + m_end) + non_api::signature_log_frame_overhead;
+            }
+            walk_back();
+        }
+    }
+    //The number of signatures in the log.
+    uint64_t size() const
+    {
+        return (m_keyframes.size() * m_interval) + m_tail.size();
+    }
+    std::string root_pubkey()
+    {
+        return std::string(m_file.view().substr(16, hashlen));
+    }
+    uint32_t keyframe_interval() const
+    {
+        return m_interval;
+    }
+    //Get signature number 'index', expanded to its full form.
+    std::pair<std::string, std::vector<std::pair<std::string, std::string>>> operator[](uint64_t index)
+    {
+        if (index >= size()) {
+            throw std::out_of_range("Signature index beyond end of signature log.");
+        }
+        uint64_t interval = index / m_interval;
+        expander expand;
+        if (interval > 0) {
+            auto state = keyframe_state(m_keyframes[interval - 1]);
+            expand.expand(state);
+        }
+        layout deserialize;
+        for (uint64_t number = interval * m_interval; number <= index; number++) {
+            std::string_view record = frame_payload(record_offset(number));
+            //Records that omit all intermediate-level signatures don't change the expander state.
+            if (number < index and record.size() == layout::serialized_length(0)) {
+                continue;
+            }
+            auto parts = deserialize(record).second;
+            expand.expand(parts);
+            if (number == index) {
+                std::pair<std::string, std::vector<std::pair<std::string, std::string>>> rval;
+                rval.first = std::string(parts.first);
+                for (auto &level : parts.second) {
+                    rval.second.emplace_back(std::string(level.first), std::string(level.second));
+                }
+                return rval;
+            }
+        }
+        throw std::logic_error("Signature log record not reached.");
+    }
+private:
+    friend struct signature_log_writer<hashlen, wotsbits, merkleheight, merkleheight2, Args...>;
+    //Check that a complete frame starts at offset.
+    bool frame_fits(size_t offset)
+    {
+        std::string_view in = m_file.view();
+        if (offset + non_api::signature_log_frame_overhead > in.size()) {
+            return false;
+        }
+        size_t length = non_api::decode_frame_length(in.data() + offset);
+        return offset + length + non_api::signature_log_frame_overhead <= in.size() and
+               non_api::decode_frame_length(in.data() + offset + 5 + length) == length and
+               (in[offset + 4] == 'S' or in[offset + 4] == 'K');
+    }
+    std::string_view frame_payload(size_t offset)
+    {
+        return m_file.view().substr(offset + 5, non_api::decode_frame_length(m_file.view().data() + offset));
+    }
+    //Walk back from the end to the last keyframe and from there along the keyframe chain, returns false if the
+    //tail of the log is not a sequence of complete frames.
+    bool walk_back()
+    {
+        std::string_view in = m_file.view();
+        m_keyframes.clear();
+        m_tail.clear();
+        size_t offset = m_end;
+        size_t keyframe = 0;
+        while (offset > header_size) {
+            if (offset < header_size + non_api::signature_log_frame_overhead) {
+                return false;
+            }
+            size_t length = non_api::decode_frame_length(in.data() + offset - 4);
+            if (length + non_api::signature_log_frame_overhead > offset - header_size) {
+                return false;
+            }
+            size_t start = offset - length - non_api::signature_log_frame_overhead;
+            if (not frame_fits(start)) {
+                return false;
+            }
+            if (in[start + 4] == 'K') {
+                keyframe = start;
+                break;
+            }
+            m_tail.push_back(start);
+            offset = start;
+        }
+        std::reverse(m_tail.begin(), m_tail.end());
+        while (keyframe != 0) {
+            m_keyframes.push_back(keyframe);
+            keyframe = non_api::decode_signature_index(frame_payload(keyframe).data() + 8);
+        }
+        std::reverse(m_keyframes.begin(), m_keyframes.end());
+        return true;
+    }
+    size_t record_offset(uint64_t number)
+    {
+        uint64_t interval = number / m_interval;
+        uint64_t within = number % m_interval;
+        if (interval < m_keyframes.size()) {
+            //The keyframe after the interval indexes it.
+            return non_api::decode_signature_index(frame_payload(m_keyframes[interval]).data() + 20 + 8 * within);
+        }
+        return m_tail[within];
+    }
+    //The expander state carried by a keyframe, as a signature with an empty message signature.
+    std::pair<std::string_view, std::array<std::pair<std::string_view, std::string_view>, levels>> keyframe_state(size_t offset)
+    {
+        std::string_view payload = frame_payload(offset);
+        size_t position = 20 + 8 * static_cast<size_t>(non_api::decode_frame_length(payload.data() + 16));
+        if (payload.size() != position + state_size()) {
+            throw std::invalid_argument("Corrupt signature log keyframe.");
+        }
+        std::pair<std::string_view, std::array<std::pair<std::string_view, std::string_view>, levels>> rval;
+        for (size_t level=0; level < levels; level++) {
+            rval.second[level].first = payload.substr(position, hashlen);
+            rval.second[level].second = payload.substr(position + hashlen, layout::lengths[levels - 1 - level]);
+            position += hashlen + layout::lengths[levels - 1 - level];
+        }
+        return rval;
+    }
+    non_api::mapped_file m_file;
+    uint32_t m_interval;
+    size_t m_end;
+    std::vector<size_t> m_keyframes;
+    std::vector<size_t> m_tail;
+};
+
+template<uint8_t hashlen, uint64_t wotsbits, uint8_t merkleheight, uint8_t merkleheight2, uint8_t ...Args>
+struct signature_log_writer {
+    typedef signature_log_reader<hashlen, wotsbits, merkleheight, merkleheight2, Args...> reader_type;
+    static constexpr size_t levels = reader_type::levels;
+    //Open a signature log for appending, creating it if needed. An existing log keeps its own keyframe interval, a
+    //torn tail left by a crash gets cut off.
+    signature_log_writer(const std::string &path, const std::string &root_pubkey, uint32_t keyframe_interval=1024):
+        m_fd(-1), m_interval(keyframe_interval), m_root_pubkey(root_pubkey), m_offset(0), m_count(0),
+        m_last_keyframe(0), m_interval_offsets(), m_state(), m_reducer()
+    {
+        if (root_pubkey.size() != hashlen or keyframe_interval == 0) {
+            throw std::invalid_argument("Invalid root pubkey or keyframe interval for signature log.");
+        }
+        struct stat info;
+        if (::stat(path.c_str(), &info) == 0 and info.st_size > 0) {
+            reader_type reader(path);
+            if (reader.root_pubkey() != root_pubkey) {
+                throw std::invalid_argument("Signature log made for a different key: " + path);
+            }
+            m_interval = reader.keyframe_interval();
+            m_offset = reader.m_end;
+            m_count = reader.size();
+            m_last_keyframe = reader.m_keyframes.empty() ? 0 : reader.m_keyframes.back();
+            m_interval_offsets = reader.m_tail;
+            if (m_count > 0) {
+                auto last = reader[m_count - 1];
+                m_state = last.second;
+                //The first reduce only records the state.
+                m_reducer.reduce(last);
+            }
+        }
+        m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT, 0600);
+        if (m_fd < 0 or ::ftruncate(m_fd, static_cast<off_t>(m_offset)) != 0 or
+            ::lseek(m_fd, static_cast<off_t>(m_offset), SEEK_SET) < 0) {
+            if (m_fd >= 0) {
+                ::close(m_fd);
+            }
+            throw std::runtime_error("Unable to open signature log: " + path);
+        }
+        if (m_offset == 0) {
+            std::string header("spq-slog");
+            header += static_cast<char>(1);
+            header += static_cast<char>(hashlen);
+            header += static_cast<char>(levels + 1);
+            header += '\0';
+            header += non_api::encode_frame_length(m_interval);
+            header += root_pubkey;
+            write(header);
+        }
+    }
+    signature_log_writer(const signature_log_writer&) = delete;
+    signature_log_writer& operator=(const signature_log_writer&) = delete;
+    virtual ~signature_log_writer()
+    {
+        ::close(m_fd);
+    }
+    //Append a full signature, as returned by the signing key.
+    void append(std::pair<std::string, std::vector<std::pair<std::string, std::string>>> signature)
+    {
+        if (signature.second.size() != levels) {
+            throw std::invalid_argument("Signature has the wrong number of levels for this signature log.");
+        }
+        if (m_count > 0 and m_count % m_interval == 0) {
+            write_keyframe();
+        }
+        if (m_state.empty()) {
+            m_state = signature.second;
+        }
+        for (size_t level=0; level < levels; level++) {
+            if (signature.second[level].first != m_state[level].first) {
+                m_state[level] = signature.second[level];
+            }
+        }
+        m_reducer.reduce(signature);
+        m_interval_offsets.push_back(m_offset);
+        write_frame('S', serialize(signature, m_root_pubkey));
+        m_count++;
+    }
+    //The number of signatures in the log.
+    uint64_t size() const
+    {
+        return m_count;
+    }
+    //Flush appended records to disk.
+    void sync()
+    {
+        ::fdatasync(m_fd);
+    }
+private:
+    void write_keyframe()
+    {
+        std::string payload = non_api::encode_signature_index(m_count);
+        payload += non_api::encode_signature_index(m_last_keyframe);
+        payload += non_api::encode_frame_length(m_interval_offsets.size());
+        for (auto offset : m_interval_offsets) {
+            payload += non_api::encode_signature_index(offset);
+        }
+        for (auto &level : m_state) {
+            payload += level.first;
+            payload += level.second;
+        }
+        m_last_keyframe = m_offset;
+        m_interval_offsets.clear();
+        write_frame('K', payload);
+    }
+    void write_frame(char type, const std::string &payload)
+    {
+        std::string frame = non_api::encode_frame_length(payload.size());
+        frame += type;
+        frame += payload;
+        frame += non_api::encode_frame_length(payload.size());
+        write(frame);
+    }
+    void write(const std::string &data)
+    {
+        size_t done = 0;
+        while (done < data.size()) {
+            ssize_t written = ::write(m_fd, data.data() + done, data.size() - done);
+            if (written < 0) {
+                throw std::runtime_error("Unable to append to signature log.");
+            }
+            done += static_cast<size_t>(written);
+        }
+        m_offset += data.size();
+    }
+    int m_fd;
+    uint32_t m_interval;
+    std::string m_root_pubkey;
+    size_t m_offset;
+    uint64_t m_count;
+    size_t m_last_keyframe;
+    std::vector<size_t> m_interval_offsets;
+    std::vector<std::pair<std::string, std::string>> m_state;
+    reducer m_reducer;
+};
+
+namespace non_api {
+//Bounded lock-free multi-producer multi-consumer queue, every cell carries a sequence number telling producers
+//and consumers whose turn it is.
+template<typename T>
+struct bounded_queue {
+    bounded_queue(size_t capacity): m_mask(0), m_cells(), m_head(0), m_tail(0)
+    {
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        m_mask = size - 1;
+        m_cells.reset(new cell[size]);
+        for (size_t index=0; index < size; index++) {
+            m_cells[index].sequence.store(index, std::memory_order_relaxed);
+        }
+    }
+    bool try_push(T &&value)
+    {
+        size_t position = m_tail.load(std::memory_order_relaxed);
+        while (true) {
+            cell &target = m_cells[position & m_mask];
+            size_t sequence = target.sequence.load(std::memory_order_acquire);
+            if (sequence == position) {
+                if (m_tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    target.value = std::move(value);
+                    target.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (sequence < position) {
+                return false;
+            }
+            else {
+                position = m_tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+    bool try_pop(T &value)
+    {
+        size_t position = m_head.load(std::memory_order_relaxed);
+        while (true) {
+            cell &target = m_cells[position & m_mask];
+            size_t sequence = target.sequence.load(std::memory_order_acquire);
+            if (sequence == position + 1) {
+                if (m_head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    value = std::move(target.value);
+                    target.sequence.store(position + m_mask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (sequence < position + 1) {
+                return false;
+            }
+            else {
+                position = m_head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+private:
+    struct cell {
+        cell(): sequence(0), value() {}
+        std::atomic<size_t> sequence;
+        T value;
+    };
+    size_t m_mask;
+    std::unique_ptr<cell[]> m_cells;
+    alignas(64) std::atomic<size_t> m_head;
+    alignas(64) std::atomic<size_t> m_tail;
+};
+}
+
+//Verification pipeline for an ordered stream of (possibly reduced) serialized signatures. Parsing and expanding
+//are stateful and run in stream order on the submitting thread, validation runs on a pool of worker threads fed
+//through a lock-free queue. Idle workers and a collector waiting for a result sleep on a condition variable.
+//Results come back in submission order. Every worker remembers the intermediate-level
+//pubkeys it last validated, and the workers share a cache of verified intermediate-level signatures, so an
+//intermediate-level signature gets validated only once.
+template<uint8_t hashlen, uint64_t wotsbits, uint8_t merkleheight, uint8_t merkleheight2, uint8_t ...Args>
+struct verify_pipeline {
+    static constexpr size_t levels = 1 + sizeof...(Args);
+    //Window is the maximum number of submitted signatures whose results have not been collected yet.
+    verify_pipeline(const std::string &root_pubkey, unsigned int threads, size_t window=256, size_t cache_size=1024):
+        m_root_pubkey(root_pubkey), m_window(window), m_submitted(0), m_collected(0), m_stop(false),
+        m_mutex(), m_work_ready(), m_result_ready(),
+        m_queue(window), m_results(new result_slot[window]), m_deserializer(), m_expander(), m_cache(cache_size), m_workers()
+    {
+        if (window == 0 or threads == 0) {
+            throw std::invalid_argument("A verify pipeline needs at least one worker and a window of one.");
+        }
+        for (unsigned int thread=0; thread < threads; thread++) {
+            m_workers.emplace_back([this]() { work(); });
+        }
+    }
+    verify_pipeline(const verify_pipeline&) = delete;
+    verify_pipeline& operator=(const verify_pipeline&) = delete;
+    virtual ~verify_pipeline()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_work_ready.notify_all();
+        for (auto &worker : m_workers) {
+            worker.join();
+        }
+    }
+    //True if no more signatures can be submitted before collecting a result.
+    bool full() const
+    {
+        return m_submitted - m_collected >= m_window;
+    }
+    //Parse and expand the next signature of the stream and queue it for validation, returns its sequence number.
+    uint64_t submit(const std::string &serialized, std::string message, bool is_digest=false)
+    {
+        if (full()) {
+            throw std::length_error("Verify pipeline window full, collect results first.");
+        }
+        uint64_t sequence = m_submitted++;
+        job item;
+        item.sequence = sequence;
+        item.message = std::move(message);
+        item.is_digest = is_digest;
+        try {
+            item.parts = m_deserializer(serialized).second;
+            m_expander.expand(item.parts);
+        }
+        catch (const std::exception &) {
+            //Unparsable, or reduced without the state to expand it, either way not valid.
+            store_result(sequence, false);
+            return sequence;
+        }
+        //The queue holds at least window jobs and no more than window are ever in flight, so there is always room.
+        if (not m_queue.try_push(std::move(item))) {
+            throw std::logic_error("Verify pipeline queue overflow.");
+        }
+        {
+            //Taking the lock orders the push before a worker's check for work, so the wakeup can not get lost.
+            std::lock_guard<std::mutex> lock(m_mutex);
+        }
+        m_work_ready.notify_one();
+        return sequence;
+    }
+    //Wait for the result of the oldest signature whose result has not been collected yet.
+    bool next_result()
+    {
+        if (m_collected == m_submitted) {
+            throw std::logic_error("No pending signatures in verify pipeline.");
+        }
+        result_slot &slot = m_results[m_collected % m_window];
+        if (slot.done.load(std::memory_order_acquire) != m_collected + 1) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_result_ready.wait(lock, [this, &slot]() {
+                return slot.done.load(std::memory_order_acquire) == m_collected + 1;
+            });
+        }
+        m_collected++;
+        return slot.ok;
+    }
+    //Verify a whole stream of (serialized signature, message) pairs, returns the results in stream order.
+    std::vector<bool> verify(const std::vector<std::pair<std::string, std::string>> &stream)
+    {
+        std::vector<bool> rval;
+        for (auto &entry : stream) {
+            if (full()) {
+                rval.push_back(next_result());
+            }
+            submit(entry.first, entry.second);
+        }
+        while (m_collected < m_submitted) {
+            rval.push_back(next_result());
+        }
+        return rval;
+    }
+private:
+    struct job {
+        job(): sequence(0), parts(), message(), is_digest(false) {}
+        uint64_t sequence;
+        std::pair<std::string, std::vector<std::pair<std::string, std::string>>> parts;
+        std::string message;
+        bool is_digest;
+    };
+    struct result_slot {
+        result_slot(): done(0), ok(false) {}
+        std::atomic<uint64_t> done;
+        bool ok;
+    };
+    void store_result(uint64_t sequence, bool ok)
+    {
+        result_slot &slot = m_results[sequence % m_window];
+        slot.ok = ok;
+        slot.done.store(sequence + 1, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+        }
+        m_result_ready.notify_one();
+    }
+    void work()
+    {
+        std::vector<std::string> last_known(levels, "");
+        last_known.push_back(m_root_pubkey);
+        job item;
+        while (true) {
+            bool popped = m_queue.try_pop(item);
+            if (not popped) {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_work_ready.wait(lock, [this, &item, &popped]() {
+                    popped = m_queue.try_pop(item);
+                    return popped or m_stop;
+                });
+                if (not popped) {
+                    return;
+                }
+            }
+            bool ok = false;
+            try {
+                multi_signature<hashlen, wotsbits, merkleheight, merkleheight2, Args...> signature(item.parts, last_known, 0, &m_cache);
+                ok = signature.validate(item.message, item.is_digest);
+            }
+            catch (const std::exception &) {
+                ok = false;
+            }
+            if (ok) {
+                //The whole chain up to the root is valid now, remember it.
+                for (size_t level=0; level < levels; level++) {
+                    last_known[level] = item.parts.second[level].first;
+                }
+            }
+            store_result(item.sequence, ok);
+        }
+    }
+    std::string m_root_pubkey;
+    size_t m_window;
+    uint64_t m_submitted;
+    uint64_t m_collected;
+    bool m_stop;
+    std::mutex m_mutex;
+    std::condition_variable m_work_ready;
+    std::condition_variable m_result_ready;
+    non_api::bounded_queue<job> m_queue;
+    std::unique_ptr<result_slot[]> m_results;
+    deserializer<hashlen, wotsbits, merkleheight, merkleheight2, Args...> m_deserializer;
+    expander m_expander;
+    verified_pair_cache<hashlen> m_cache;
+    std::vector<std::thread> m_workers;
+};
+
+//Verification state for many signers at once, keyed by root pubkey. Signers live in a sharded hash map, so
+//threads verifying for different signers rarely meet on a lock. Every signer has its own expander and last_known
+//pubkeys, expansion runs under the signer's own lock while validation runs unlocked, and all signers share one
+//cache of verified intermediate-level signatures. Optionally, a cache of verified signatures makes signatures
+//that arrive again cheap. Signers have to be added before their signatures verify, so signatures claiming made-up
+//root pubkeys can't make the registry grow.
+template<uint8_t hashlen, uint64_t wotsbits, uint8_t merkleheight, uint8_t merkleheight2, uint8_t ...Args>
+struct verifier_registry {
+    static constexpr size_t levels = 1 + sizeof...(Args);
+    //A dedup_size of zero disables the verified signature cache.
+    verifier_registry(size_t shard_count=64, size_t cache_size=4096, size_t dedup_size=0):
+        m_shards(shard_count == 0 ? 1 : shard_count), m_cache(cache_size),
+        m_dedup(dedup_size > 0 ? new verified_signature_cache<hashlen>(dedup_size) : nullptr) {}
+    //The verified signature cache, for its counters, or nullptr if disabled.
+    verified_signature_cache<hashlen> *dedup_cache()
+    {
+        return m_dedup.get();
+    }
+    //Start keeping state for a signer, a signer that is already known keeps its state.
+    void add(const std::string &root_pubkey)
+    {
+        if (root_pubkey.size() != hashlen) {
+            throw std::invalid_argument("Root pubkey has the wrong size.");
+        }
+        shard &target = get_shard(root_pubkey);
+        std::lock_guard<std::mutex> lock(target.mutex);
+        auto &signer = target.signers[root_pubkey];
+        if (not signer) {
+            signer = std::make_shared<signer_state>(root_pubkey);
+        }
+    }
+    //Verify the next signature of a signer, expanding it in arrival order. Signatures of unknown signers fail.
+    bool verify(const std::string &root_pubkey, const std::string &serialized, const std::string &message, bool is_digest=false)
+    {
+        auto signer = get_signer(root_pubkey);
+        if (not signer) {
+            return false;
+        }
+        std::pair<std::string, std::vector<std::pair<std::string, std::string>>> parts;
+        std::vector<std::string> last_known;
+        uint64_t position = 0;
+        bool expanded = false;
+        {
+            std::lock_guard<std::mutex> lock(signer->mutex);
+            expanded = expand(*signer, serialized, parts, last_known, position);
+            signer->next_sequence++;
+        }
+        signer->ready.notify_all();
+        return expanded and validate(root_pubkey, serialized, *signer, parts, last_known, position, message, is_digest);
+    }
+    //Verify signature number 'sequence' of a signer's stream, counting from zero. Expansion waits until all
+    //earlier signatures of the signer have been expanded, so a reduced stream can be verified from many threads.
+    bool verify(const std::string &root_pubkey, uint64_t sequence, const std::string &serialized, const std::string &message, bool is_digest=false)
+    {
+        auto signer = get_signer(root_pubkey);
+        if (not signer) {
+            return false;
+        }
+        std::pair<std::string, std::vector<std::pair<std::string, std::string>>> parts;
+        std::vector<std::string> last_known;
+        uint64_t position = 0;
+        bool expanded = false;
+        {
+            std::unique_lock<std::mutex> lock(signer->mutex);
+            signer->ready.wait(lock, [&signer, sequence]() { return signer->next_sequence >= sequence; });
+            if (signer->next_sequence != sequence) {
+                throw std::invalid_argument("Signature sequence number already used for this signer.");
+            }
+            expanded = expand(*signer, serialized, parts, last_known, position);
+            signer->next_sequence++;
+        }
+        signer->ready.notify_all();
+        return expanded and validate(root_pubkey, serialized, *signer, parts, last_known, position, message, is_digest);
+    }
+    //Drop all state kept for a signer, its signatures fail until it is added again.
+    void forget(const std::string &root_pubkey)
+    {
+        shard &target = get_shard(root_pubkey);
+        std::lock_guard<std::mutex> lock(target.mutex);
+        target.signers.erase(root_pubkey);
+    }
+    //The number of signers with state in the registry.
+    size_t size()
+    {
+        size_t rval = 0;
+        for (auto &target : m_shards) {
+            std::lock_guard<std::mutex> lock(target.mutex);
+            rval += target.signers.size();
+        }
+        return rval;
+    }
+private:
+    struct signer_state {
+        signer_state(const std::string &root_pubkey):
+            mutex(), ready(), expand(), last_known(levels, ""), known_position(0), expanded(0), next_sequence(0)
+        {
+            last_known.push_back(root_pubkey);
+        }
+        std::mutex mutex;
+        std::condition_variable ready;
+        expander expand;
+        std::vector<std::string> last_known;
+        //One past the expansion position of the signature last_known was taken from.
+        uint64_t known_position;
+        //The number of signatures expanded so far.
+        uint64_t expanded;
+        uint64_t next_sequence;
+    };
+    struct shard {
+        shard(): mutex(), signers() {}
+        std::mutex mutex;
+        std::unordered_map<std::string, std::shared_ptr<signer_state>> signers;
+    };
+    shard &get_shard(const std::string &root_pubkey)
+    {
+        return m_shards[std::hash<std::string>()(root_pubkey) % m_shards.size()];
+    }
+    //The state of a signer, or nullptr for signers that weren't added.
+    std::shared_ptr<signer_state> get_signer(const std::string &root_pubkey)
+    {
+        shard &target = get_shard(root_pubkey);
+        std::lock_guard<std::mutex> lock(target.mutex);
+        auto found = target.signers.find(root_pubkey);
+        if (found == target.signers.end()) {
+            return nullptr;
+        }
+        return found->second;
+    }
+    //Deserialize and expand under the signer lock, taking a snapshot of its last_known pubkeys and noting the
+    //position of the signature in the signer's stream.
+    static bool expand(signer_state &signer,
+                       const std::string &serialized,
+                       std::pair<std::string, std::vector<std::pair<std::string, std::string>>> &parts,
+                       std::vector<std::string> &last_known,
+                       uint64_t &position)
+    {
+        position = signer.expanded++;
+        try {
+            deserializer<hashlen, wotsbits, merkleheight, merkleheight2, Args...> deserialize;
+            parts = deserialize(serialized).second;
+            signer.expand.expand(parts);
+        }
+        catch (const std::exception &) {
+            return false;
+        }
+        last_known = signer.last_known;
+        return true;
+    }
+    bool validate(const std::string &root_pubkey,
+                  const std::string &serialized,
+                  signer_state &signer,
+                  std::pair<std::string, std::vector<std::pair<std::string, std::string>>> &parts,
+                  std::vector<std::string> &last_known,
+                  uint64_t position,
+                  const std::string &message,
+                  bool is_digest)
+    {
+        bool ok = false;
+        try {
+            std::string digest = message;
+            if (m_dedup) {
+                if (not is_digest) {
+                    digest = message_hasher<hashlen>(parts.first.substr(hashlen, hashlen)).update(message).finish();
+                }
+                if (m_dedup->contains(root_pubkey, serialized, digest)) {
+                    return true;
+                }
+            }
+            multi_signature<hashlen, wotsbits, merkleheight, merkleheight2, Args...> signature(parts, last_known, m_cache);
+            ok = signature.validate(digest, is_digest or m_dedup);
+            if (ok and m_dedup) {
+                m_dedup->insert(root_pubkey, serialized, digest);
+            }
+        }
+        catch (const std::exception &) {
+            ok = false;
+        }
+        if (ok) {
+            //The whole chain up to the root is valid now, remember it for the next signature of this signer,
+            //unless a later signature of the signer already finished validation first.
+            std::lock_guard<std::mutex> lock(signer.mutex);
+            if (position >= signer.known_position) {
+                for (size_t level=0; level < levels; level++) {
+                    signer.last_known[level] = parts.second[level].first;
+                }
+                signer.known_position = position + 1;
+            }
+        }
+        return ok;
+    }
+    std::vector<shard> m_shards;
+    verified_pair_cache<hashlen> m_cache;
+    std::unique_ptr<verified_signature_cache<hashlen>> m_dedup;
 };
 }
 #endif
@@ -0,0 +1,127 @@
+#ifndef SPQ_TOOL_HPP
+#define SPQ_TOOL_HPP
+// Shared parts of the spq-sign and spq-verify command line tools.
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <cstdio>
+#include <limits>
+#include "spq_sigs.hpp"
+
+namespace spqtool {
+// Key parameters used by the command line tools. Four levels of 32 signatures each give a million signatures per key.
+constexpr unsigned char hashlen=24;
+constexpr unsigned char wotsbits=12;
+constexpr unsigned char merkleheight=5;
+constexpr uint64_t bottom_capacity = 1ull << merkleheight;
+typedef spqsigs::spq_signing_key<hashlen, wotsbits, merkleheight, merkleheight, merkleheight, merkleheight> signing_key;
+typedef spqsigs::multi_signature<hashlen, wotsbits, merkleheight, merkleheight, merkleheight, merkleheight> signature;
+typedef spqsigs::deserializer<hashlen, wotsbits, merkleheight, merkleheight, merkleheight, merkleheight> deserializer;
+typedef spqsigs::view_deserializer<hashlen, wotsbits, merkleheight, merkleheight, merkleheight, merkleheight> view_deserializer;
+constexpr size_t levels = 4;
+typedef std::pair<std::string, std::vector<std::pair<std::string, std::string>>> signature_parts;
+// Extension used for detached signature files.
+const std::string signature_extension(".spqsig");
+
+// Check if a file exists.
+inline bool file_exists(const std::string &path) {
+    std::ifstream in(path, std::ios::binary);
+    return in.good();
+}
+
+// Read a (small) file as a whole.
+inline std::string read_file(const std::string &path) {
+    std::ifstream in(path, std::ios::binary);
+    if (not in.good()) {
+        throw std::runtime_error("Unable to read " + path);
+    }
+    std::ostringstream content;
+    content << in.rdbuf();
+    return content.str();
+}
+
+// Write a (small) file, replacing any previous version atomically.
+inline void write_file(const std::string &path, const std::string &content) {
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        out.write(content.c_str(), static_cast<std::streamsize>(content.size()));
+        if (not out.good()) {
+            throw std::runtime_error("Unable to write " + tmp);
+        }
+    }
+    if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+        throw std::runtime_error("Unable to replace " + path);
+    }
+}
+
+// Append to a file, creating it if it doesn't exist yet.
+inline void append_file(const std::string &path, const std::string &content) {
+    std::ofstream out(path, std::ios::binary | std::ios::app);
+    out.write(content.c_str(), static_cast<std::streamsize>(content.size()));
+    out.flush();
+    if (not out.good()) {
+        throw std::runtime_error("Unable to append to " + path);
+    }
+}
+
+// Run job(index) for every index below count on a pool of worker threads.
+template<typename Job>
+void parallel_for(size_t count, unsigned int threads, Job job) {
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> pool;
+    for (unsigned int thread=0; thread < threads; thread++) {
+        pool.emplace_back([&next, count, &job]() {
+            for (size_t index = next++; index < count; index = next++) {
+                job(index);
+            }
+        });
+    }
+    for (auto &worker : pool) {
+        worker.join();
+    }
+}
+
+// Parse a count option value, at least one. Returns false if the value is not a plain decimal number.
+inline bool parse_count(const std::string &text, unsigned int &count) {
+    if (text.empty() or text.find_first_not_of("0123456789") != std::string::npos) {
+        return false;
+    }
+    try {
+        unsigned long value = std::stoul(text);
+        if (value > std::numeric_limits<unsigned int>::max()) {
+            return false;
+        }
+        count = std::max(1u, static_cast<unsigned int>(value));
+    }
+    catch (const std::exception &) {
+        return false;
+    }
+    return true;
+}
+
+// Parse the leading '-j <threads>' option, returns the index of the first remaining argument, or argc if the
+// thread count is invalid so the caller prints its usage.
+inline int parse_threads(int argc, char **argv, unsigned int &threads) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+    if (argc > 2 and std::string(argv[1]) == "-j") {
+        return parse_count(argv[2], threads) ? 3 : argc;
+    }
+    return 1;
+}
+
+inline double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Print a throughput report.
+inline void report(const std::string &what, size_t files, size_t bytes, double seconds) {
+    std::cerr << what << " " << files << " files, " << bytes << " bytes in " << seconds << " s ("
+              << (seconds > 0 ? static_cast<double>(files) / seconds : 0) << " files/s, "
+              << (seconds > 0 ? static_cast<double>(bytes) / seconds / 1048576 : 0) << " MiB/s)" << std::endl;
+}
+}
+#endif
@@ -0,0 +1,54 @@
+// spq-verify: verify files against their detached signatures.
+//
+// usage: spq-verify [-j threads] <pubkeyfile> <file>...
+//
+// Every file is checked against its <file>.spqsig detached signature, made by spq-sign with the key whose public key
+// is in pubkeyfile. Files are memory mapped, and hashing plus validation run on a pool of threads. The threads share
+// a cache of verified intermediate-level signatures, so the few intermediate-level keys above all signatures get
+// validated once rather than for every file.
+#include "spq_tool.hpp"
+
+int main(int argc, char **argv) {
+    unsigned int threads;
+    int first = spqtool::parse_threads(argc, argv, threads);
+    if (argc - first < 2) {
+        std::cerr << "usage: spq-verify [-j threads] <pubkeyfile> <file>..." << std::endl;
+        return 2;
+    }
+    std::string pubkey = spqtool::read_file(argv[first]);
+    std::vector<std::string> files(argv + first + 1, argv + argc);
+    std::vector<std::string> results(files.size());
+    std::vector<size_t> sizes(files.size(), 0);
+    spqsigs::verified_pair_cache<spqtool::hashlen> cache(4096);
+    auto start = std::chrono::steady_clock::now();
+    spqtool::parallel_for(files.size(), threads, [&](size_t index) {
+        try {
+            spqtool::view_deserializer deserialize;
+            std::string serialized = spqtool::read_file(files[index] + spqtool::signature_extension);
+            auto parts = deserialize(serialized).second;
+            //Nothing known but the public key, every level gets validated unless the cache has it.
+            std::vector<std::string> last_known(spqtool::levels - 1, "");
+            last_known.push_back(pubkey);
+            spqtool::signature signature(parts, last_known, cache);
+            spqsigs::non_api::mapped_file input(files[index]);
+            sizes[index] = input.size();
+            std::string digest = signature.hasher().update(input.view()).finish();
+            results[index] = signature.validate(digest, true) ? "OK" : "FAIL";
+        }
+        catch (const std::exception &e) {
+            results[index] = std::string("FAIL (") + e.what() + ")";
+        }
+    });
+    double seconds = spqtool::seconds_since(start);
+    int failed = 0;
+    size_t bytes = 0;
+    for (size_t index=0; index < files.size(); index++) {
+        std::cout << files[index] << ": " << results[index] << std::endl;
+        if (results[index] != "OK") {
+            failed++;
+        }
+        bytes += sizes[index];
+    }
+    spqtool::report("Verified", files.size(), bytes, seconds);
+    return failed == 0 ? 0 : 1;
+}
@@ -1,6 +1,13 @@
 #!/bin/bash
+GCCFLAGS="-W -pedantic-errors -Wno-long-long -Woverloaded-virtual -Wundef -Wsign-compare -Wredundant-decls -Wctor-dtor-privacy  -Wnon-virtual-dtor -Wchar-subscripts  -Wcomment -Wformat -Wmissing-braces -Wparentheses -Wtrigraphs -Wunused-function -Wunused-label -Wunused-variable -Wunused-value -Wunknown-pragmas -Wfloat-equal -Wendif-labels -Wreturn-type -Wpacked -Wcast-align -Wpointer-arith -Wcast-qual -Wwrite-strings -Wformat-nonliteral -Wformat-security -Wswitch-enum -Wsign-promo -Wreorder -Wunreachable-code -Weffc++ -Wconversion -Wshadow -Wunused-parameter -Wold-style-cast -std=c++17"
 echo "####### CLANG #######"
 clang++ -std=c++17 main.cpp -lsodium
 echo "#######  GCC  #######"
-g++ -W -pedantic-errors -Wno-long-long -Woverloaded-virtual -Wundef -Wsign-compare -Wredundant-decls -Wctor-dtor-privacy  -Wnon-virtual-dtor -Wchar-subscripts  -Wcomment -Wformat -Wmissing-braces -Wparentheses -Wtrigraphs -Wunused-function -Wunused-label -Wunused-variable -Wunused-value -Wunknown-pragmas -Wfloat-equal -Wendif-labels -Wreturn-type -Wpacked -Wcast-align -Wpointer-arith -Wcast-qual -Wwrite-strings -Wformat-nonliteral -Wformat-security -Wswitch-enum -Wsign-promo -Wreorder -Wunreachable-code -Weffc++ -Wconversion -Wshadow -Wunused-parameter -Wold-style-cast -std=c++17 main.cpp -lsodium
+g++ $GCCFLAGS main.cpp -lsodium
+echo "##### BENCHMARK #####"
+g++ $GCCFLAGS -O2 -pthread benchmark.cpp -o benchmark -lsodium
+echo "#####  TOOLS  #####"
+g++ $GCCFLAGS -O2 -pthread spq_sign.cpp -o spq-sign -lsodium
+g++ $GCCFLAGS -O2 -pthread spq_verify.cpp -o spq-verify -lsodium
+g++ $GCCFLAGS -O2 -pthread spq_audit.cpp -o spq-audit -lsodium
 echo "#####################"